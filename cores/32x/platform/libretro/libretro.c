@@ -2108,6 +2108,7 @@ void retro_run(void)
 {
    bool updated = false;
    int pad, i, padcount;
+   int av_enable = 3;
    static void *buff;
 
    PicoIn.skipFrame = 0;
@@ -2183,6 +2184,10 @@ void retro_run(void)
          frameskip_counter++;
    }
 
+   /* Skip frames the frontend discards */
+   if (environ_cb(RETRO_ENVIRONMENT_GET_AUDIO_VIDEO_ENABLE, &av_enable) && !(av_enable & 1))
+      PicoIn.skipFrame = 1;
+
    /* If frameskip settings have changed, update
     * frontend audio latency */
    if (update_audio_latency) {
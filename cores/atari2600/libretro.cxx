@@ -337,12 +337,19 @@ void retro_run(void)
    videoWidth = tia.width();
    videoHeight = tia.height();
 
-   const uint32_t *palette = console->getPalette(0);
-   //Copy the frame from stella to libretro
-   for (int i = 0; i < videoHeight * videoWidth; ++i)
-      frameBuffer[i] = palette[tia.currentFrameBuffer()[i]];
+   //Skip the palette conversion when the frontend discards this frame
+   int avEnable = 3;
+   if (!environ_cb(RETRO_ENVIRONMENT_GET_AUDIO_VIDEO_ENABLE, &avEnable) || (avEnable & 1))
+   {
+      const uint32_t *palette = console->getPalette(0);
+      //Copy the frame from stella to libretro
+      for (int i = 0; i < videoHeight * videoWidth; ++i)
+         frameBuffer[i] = palette[tia.currentFrameBuffer()[i]];
 
-   video_cb(frameBuffer, videoWidth, videoHeight, videoWidth << 2);
+      video_cb(frameBuffer, videoWidth, videoHeight, videoWidth << 2);
+   }
+   else
+      video_cb(NULL, videoWidth, videoHeight, videoWidth << 2);
 
    //AUDIO
    //Process one frame of audio from stella
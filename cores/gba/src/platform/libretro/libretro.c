@@ -385,10 +385,19 @@ void retro_run(void) {
 		}
 	}
 
+	// Skip drawing the scanlines of a frame the frontend discards
+	int avEnable = 3;
+	if (environCallback(RETRO_ENVIRONMENT_GET_AUDIO_VIDEO_ENABLE, &avEnable) && !(avEnable & 1)) {
+		struct GBAVideo* video = &((struct GBA*) core->board)->video;
+		if (video->frameskipCounter < 1) {
+			video->frameskipCounter = 1;
+		}
+	}
+
 	core->runFrame(core);
 	unsigned width, height;
 	core->desiredVideoDimensions(core, &width, &height);
-	videoCallback(outputBuffer, width, height, BYTES_PER_PIXEL * 256);
+	videoCallback((avEnable & 1) ? outputBuffer : NULL, width, height, BYTES_PER_PIXEL * 256);
 
 	// This was from aliaspider patch (4539a0e), game boy audio is buggy with it (adapted for this refactored core)
 /*
@@ -2175,6 +2175,8 @@ int YM2612SaveContext(unsigned char *state)
     {
       index = (ym2612.CH[c].SLOT[s].DT - ym2612.OPN.ST.dt_tab[0]) >> 5;
       save_param(&index,sizeof(index));
+      /* the loader skips one more byte per slot, so keep it cleared */
+      state[bufferptr] = 0;
       bufferptr += sizeof(index);
     }
   }
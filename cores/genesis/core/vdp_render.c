@@ -4153,6 +4153,46 @@ void render_line(int line)
   remap_line(line);
 }
 
+void skip_line(int line)
+{
+  /* Sprite collision and overflow flags are only updated while sprites are drawn, */
+  /* so frames that are not displayed still run the sprite layer over a blank line */
+  if (reg[1] & 0x40)
+  {
+    /* Update pattern cache */
+    if (bg_list_index)
+    {
+      update_bg_pattern_cache(bg_list_index);
+      bg_list_index = 0;
+    }
+
+    /* Background pixels never carry the sprite marker used for collisions */
+    memset(&linebuf[0][0x20 - bitmap.viewport.x], 0, bitmap.viewport.w + 2*bitmap.viewport.x);
+
+    /* Render sprite layer */
+    render_obj(line & 1);
+
+    /* Parse sprites for next line */
+    if (line < (bitmap.viewport.h - 1))
+    {
+      parse_satb(line);
+    }
+  }
+  else
+  {
+    /* Master System & Game Gear VDP specific */
+    if (system_hw < SYSTEM_MD)
+    {
+      /* Update SOVR flag */
+      status |= spr_ovr;
+      spr_ovr = 0;
+
+      /* Sprites are still parsed when display is disabled */
+      parse_satb(line);
+    }
+  }
+}
+
 void blank_line(int line, int offset, int width)
 {
   memset(&linebuf[0][0x20 + offset], 0x40, width);
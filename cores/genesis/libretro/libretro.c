@@ -1972,10 +1972,16 @@ size_t retro_serialize_size(void) { return STATE_SIZE; }
 
 bool retro_serialize(void *data, size_t size)
 {
+   int written;
+
    if (size != STATE_SIZE)
       return FALSE;
 
-   state_save(data);
+   written = state_save(data);
+
+   /* the state is usually smaller than STATE_SIZE: clear the rest so that
+      saves of the same frame are identical */
+   memset((uint8_t*)data + written, 0, size - written);
 
    return TRUE;
 }
@@ -2283,14 +2289,22 @@ void retro_reset(void)
 void retro_run(void)
 {
    bool updated = false;
+   int av_enable = 3;
+   int do_skip;
    is_running = true;
 
+   /* skip VDP rendering when the frontend discards this frame; sprites are
+      still processed so that collision and overflow flags match */
+   if (!environ_cb(RETRO_ENVIRONMENT_GET_AUDIO_VIDEO_ENABLE, &av_enable))
+      av_enable = 3;
+   do_skip = !(av_enable & 1);
+
    if (system_hw == SYSTEM_MCD)
-      system_frame_scd(0);
+      system_frame_scd(do_skip);
    else if ((system_hw & SYSTEM_PBC) == SYSTEM_MD)
-      system_frame_gen(0);
+      system_frame_gen(do_skip);
    else
-      system_frame_sms(0);
+      system_frame_sms(do_skip);
 
    if (bitmap.viewport.changed & 9)
    {
@@ -2311,7 +2325,7 @@ void retro_run(void)
       }
    }
 
-   if (config.gun_cursor)
+   if (config.gun_cursor && !do_skip)
    {
       if (input.system[0] == SYSTEM_LIGHTPHASER)
       {
@@ -2332,7 +2346,7 @@ void retro_run(void)
       }
    }
 
-   video_cb(bitmap.data, vwidth, vheight, 720 * 2);
+   video_cb(do_skip ? NULL : bitmap.data, vwidth, vheight, 720 * 2);
    audio_cb(soundbuffer, audio_update(soundbuffer));
 
    environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE_UPDATE, &updated);
@@ -1299,6 +1299,7 @@ void retro_run(void)
    unsigned i;
    uint8_t *gfx;
    int32_t ssize = 0;
+   int av_enable = 3;
    bool updated = false;
 
    if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE_UPDATE, &updated) && updated)
@@ -1312,6 +1313,12 @@ void retro_run(void)
 
    audio_batch_cb((const int16_t*)sound, ssize);
 
+   /* The PPU's own frameskip path approximates sprite 0 hits and mapper
+    * hooks, so frames the frontend discards are still drawn and only the
+    * palette conversion is skipped */
+   if (environ_cb(RETRO_ENVIRONMENT_GET_AUDIO_VIDEO_ENABLE, &av_enable) && !(av_enable & 1))
+      return;
+
    retro_run_blit(gfx);
 }
 
@@ -1699,6 +1699,7 @@ void retro_run(void)
    static int32_t rects[FB_HEIGHT];
    static unsigned width, height;
    bool resolution_changed = false;
+   int av_enable = 3;
    rects[0] = ~0;
 
    EmulateSpecStruct spec = {0};
@@ -1713,6 +1714,10 @@ void retro_run(void)
    spec.VideoFormatChanged = false;
    spec.SoundFormatChanged = false;
 
+   // Skip drawing frames the frontend discards; sprite IRQs are still raised
+   if (environ_cb(RETRO_ENVIRONMENT_GET_AUDIO_VIDEO_ENABLE, &av_enable) && !(av_enable & 1))
+      spec.skip = true;
+
    if (spec.SoundRate != last_sound_rate)
    {
       spec.SoundFormatChanged = true;
@@ -1727,12 +1732,17 @@ void retro_run(void)
 
    spec.SoundBufSize = spec.SoundBufSizeALMS + SoundBufSize;
 
-   if (width  != spec.DisplayRect.w || height != spec.DisplayRect.h)
-      resolution_changed = true;
+   if (spec.skip)
+      video_cb(NULL, width, height, FB_WIDTH * 2);
+   else
+   {
+      if (width  != spec.DisplayRect.w || height != spec.DisplayRect.h)
+         resolution_changed = true;
 
-   width  = spec.DisplayRect.w;
-   height = spec.DisplayRect.h;
-   video_cb(surf->pixels + surf->pitch * spec.DisplayRect.y, width, height, FB_WIDTH * 2);
+      width  = spec.DisplayRect.w;
+      height = spec.DisplayRect.h;
+      video_cb(surf->pixels + surf->pitch * spec.DisplayRect.y, width, height, FB_WIDTH * 2);
+   }
 
    audio_batch_cb(spec.SoundBuf, spec.SoundBufSize);
 
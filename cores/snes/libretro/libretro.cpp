@@ -968,6 +968,7 @@ void retro_run()
 {
    static uint16 height = PPU.ScreenHeight;
    bool updated = false;
+   int av_enable = 3;
    if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE_UPDATE, &updated) && updated)
       update_variables();
    if (height != PPU.ScreenHeight)
@@ -977,6 +978,12 @@ void retro_run()
    }
    poll_cb();
    report_buttons();
+
+   // Don't render frames the frontend discards
+   if (!environ_cb(RETRO_ENVIRONMENT_GET_AUDIO_VIDEO_ENABLE, &av_enable))
+      av_enable = 3;
+   IPPU.RenderThisFrame = (av_enable & 1) ? TRUE : FALSE;
+
    S9xMainLoop();
 }
 
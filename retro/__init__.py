@@ -2,8 +2,10 @@ import os
 import sys
 
 import retro.data
-from retro._retro import Movie, RetroEmulator, core_path
+from retro._retro import Movie, RetroEmulator, StatePool, core_path
 from retro.enums import Actions, Observations, State
+from retro.fork_server import ForkServer
+from retro.game_pool import GamePool
 from retro.retro_env import RetroEnv
 
 ROOT_DIR = os.path.abspath(os.path.dirname(__file__))
@@ -16,9 +18,12 @@ with open(os.path.join(os.path.dirname(__file__), "VERSION.txt")) as f:
 __all__ = [
     "Movie",
     "RetroEmulator",
+    "StatePool",
     "Actions",
     "State",
     "Observations",
+    "GamePool",
+    "ForkServer",
     "get_core_path",
     "get_romfile_system",
     "get_system_info",
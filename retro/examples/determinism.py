@@ -19,8 +19,7 @@ class MoreDeterministicRetroState(gym.Wrapper):
     It's likely that reward and done will not be correct if they
     depend on lua state (e.g. Sonic "contest" scenario)
 
-    For most emulated systems this is 10%-50% slower, for Atari2600 it is
-    60x slower.  It's unclear why stella is slow slow to save/load a state.
+    For most emulated systems this is 10%-50% slower.
     This also fails on GameBoy games due to https://github.com/openai/retro/issues/116
 
     If other wrappers have state (such as Timelimit), they would need to be extended
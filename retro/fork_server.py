@@ -0,0 +1,161 @@
+import gc
+import multiprocessing
+import os
+import sys
+import traceback
+
+import retro
+
+__all__ = ["ForkServer"]
+
+
+class ForkServer:
+    """
+    Builds an environment once in a server process and forks ready-to-step
+    workers from it
+
+    Workers inherit the loaded core, ROM, parsed integration and initial state
+    copy-on-write, so starting one costs a fork instead of a full environment
+    construction. Only available on platforms with `os.fork`.
+    """
+
+    def __init__(self, game, state=retro.State.DEFAULT, **kwargs):
+        if not hasattr(os, "fork"):
+            raise NotImplementedError("ForkServer requires os.fork")
+        self._conn, child = multiprocessing.Pipe()
+        self._pid = os.fork()
+        if self._pid == 0:
+            # The child must never return into the caller's code
+            try:
+                self._conn.close()
+                _serve(child, game, state, kwargs)
+            finally:
+                os._exit(1)
+        child.close()
+
+        error = self._conn.recv()
+        if error is not None:
+            os.waitpid(self._pid, 0)
+            self._pid = None
+            raise error
+
+    def spawn(self, target, *args, **kwargs):
+        """
+        Fork a worker that calls `target(env, *args, **kwargs)` and exits
+
+        `target` and its arguments are pickled, so `target` has to be defined
+        at module level. Returns the worker's pid.
+        """
+        return self._request("spawn", target, args, kwargs)
+
+    def wait(self, pid):
+        """
+        Wait for a worker to exit and return its exit code
+        """
+        return self._request("wait", pid)
+
+    def close(self):
+        if self._pid is None:
+            return
+        try:
+            self._conn.send(None)
+        except OSError:
+            pass
+        self._conn.close()
+        os.waitpid(self._pid, 0)
+        self._pid = None
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
+    def __del__(self):
+        if getattr(self, "_pid", None):
+            self.close()
+
+    def _request(self, *request):
+        if self._pid is None:
+            raise RuntimeError("ForkServer is closed")
+        self._conn.send(request)
+        result = self._conn.recv()
+        if isinstance(result, BaseException):
+            raise result
+        return result
+
+
+def _serve(conn, game, state, kwargs):
+    try:
+        env = retro.make(game, state, **kwargs)
+    except BaseException as e:
+        conn.send(e)
+        os._exit(1)
+    conn.send(None)
+
+    # Keep the collector from writing to every inherited object in each worker
+    gc.collect()
+    gc.freeze()
+
+    finished = {}
+    while True:
+        try:
+            request = conn.recv()
+        except EOFError:
+            break
+        if request is None:
+            break
+
+        # Reap workers as they finish so that unwaited ones don't linger
+        while True:
+            try:
+                pid, status = os.waitpid(-1, os.WNOHANG)
+            except ChildProcessError:
+                break
+            if not pid:
+                break
+            finished[pid] = _exit_code(status)
+
+        try:
+            if request[0] == "spawn":
+                _, target, args, target_kwargs = request
+                pid = os.fork()
+                if pid == 0:
+                    try:
+                        conn.close()
+                        _run(target, env, args, target_kwargs)
+                    finally:
+                        os._exit(1)
+                conn.send(pid)
+            elif request[0] == "wait":
+                pid = request[1]
+                if pid not in finished:
+                    _, status = os.waitpid(pid, 0)
+                    finished[pid] = _exit_code(status)
+                conn.send(finished.pop(pid))
+        except Exception as e:
+            conn.send(e)
+
+    env.close()
+    os._exit(0)
+
+
+def _exit_code(status):
+    if os.WIFSIGNALED(status):
+        return -os.WTERMSIG(status)
+    return os.WEXITSTATUS(status)
+
+
+def _run(target, env, args, kwargs):
+    code = 0
+    try:
+        target(env, *args, **kwargs)
+    except SystemExit as e:
+        code = e.code if isinstance(e.code, int) else 1
+    except BaseException:
+        traceback.print_exc()
+        code = 1
+    finally:
+        sys.stdout.flush()
+        sys.stderr.flush()
+        os._exit(code)
@@ -0,0 +1,104 @@
+import gzip
+from collections import OrderedDict
+
+import retro
+import retro.data
+
+__all__ = ["GamePool"]
+
+
+class GamePool:
+    """
+    Keeps environments for recently used games resident
+
+    Each game keeps its loaded core, ROM, parsed integration and decompressed
+    states, so switching back to it only costs a state load. The least recently
+    used game is closed once more than `capacity` games are open.
+    """
+
+    def __init__(
+        self,
+        capacity=8,
+        inttype=retro.data.Integrations.DEFAULT,
+        **kwargs,
+    ):
+        self.capacity = capacity
+        self.inttype = inttype
+        self.kwargs = kwargs
+        self.env = None
+        self._envs = OrderedDict()
+        self._states = {}
+
+    def switch_game(self, game, state=retro.State.DEFAULT, seed=None):
+        """
+        Make `game` the active environment and reset it to `state`
+
+        Returns the observation and info of the reset, like `env.reset()`
+        """
+        env = self._envs.get(game)
+        if env is None:
+            env = self._open(game)
+        self._envs.move_to_end(game)
+
+        if state == retro.State.DEFAULT:
+            env.statename, env.initial_state = self._states[game, state]
+        elif state == retro.State.NONE:
+            env.statename, env.initial_state = None, None
+        else:
+            env.statename, env.initial_state = self._load_state(game, state)
+
+        self.env = env
+        return env.reset(seed=seed)
+
+    def close(self):
+        for env in self._envs.values():
+            env.close()
+        self._envs.clear()
+        self._states.clear()
+        self.env = None
+
+    def __contains__(self, game):
+        return game in self._envs
+
+    def __len__(self):
+        return len(self._envs)
+
+    def _open(self, game):
+        while len(self._envs) >= self.capacity:
+            self._evict(next(iter(self._envs)))
+
+        try:
+            env = retro.make(game, inttype=self.inttype, **self.kwargs)
+        except RuntimeError:
+            # The core may not be able to hold another game; drop every
+            # resident game on the same system and load it again
+            system = retro.get_romfile_system(
+                retro.data.get_romfile_path(game, self.inttype),
+            )
+            for other in [g for g, e in self._envs.items() if e.system == system]:
+                self._evict(other)
+            env = retro.make(game, inttype=self.inttype, **self.kwargs)
+
+        self._envs[game] = env
+        self._states[game, retro.State.DEFAULT] = (env.statename, env.initial_state)
+        return env
+
+    def _evict(self, game):
+        env = self._envs.pop(game)
+        if env is self.env:
+            self.env = None
+        env.close()
+        for key in [key for key in self._states if key[0] == game]:
+            del self._states[key]
+
+    def _load_state(self, game, state):
+        if not state.endswith(".state"):
+            state += ".state"
+        key = (game, state)
+        if key not in self._states:
+            with gzip.open(
+                retro.data.get_file_path(game, state, self.inttype),
+                "rb",
+            ) as fh:
+                self._states[key] = (state, fh.read())
+        return self._states[key]
@@ -1,4 +1,3 @@
-import gc
 import gzip
 import json
 import os
@@ -20,6 +19,11 @@ class RetroEnv(gym.Env):
     """
 
     metadata = {"render_modes": ["human", "rgb_array"], "video.frames_per_second": 60.0}
+    # Systems whose master palette fits in the 256 colors obs_color="indexed"
+    # holds. The NES has 64 colors, but the PPU emphasis bits tint them 8 ways,
+    # so a game that mixes several emphasis settings in one episode can still
+    # exceed 256 and fail with a ValueError from step()
+    INDEXED_SYSTEMS = frozenset({"Nes", "Atari2600", "Sms", "GameBoy"})
 
     def __init__(
         self,
@@ -33,6 +37,21 @@ class RetroEnv(gym.Env):
         inttype=retro.data.Integrations.STABLE,
         obs_type=retro.Observations.IMAGE,
         render_mode="human",
+        frameskip=1,
+        headless=False,
+        core_profile=None,
+        core_options=None,
+        resize=None,
+        resize_filter="nearest",
+        grayscale=False,
+        frame_stack=1,
+        frame_pool=None,
+        track_changes=False,
+        channels_first=False,
+        obs_dtype=np.uint8,
+        obs_color="rgb",
+        shadow_ram=False,
+        reuse_obs=False,
     ):
         if not hasattr(self, "spec"):
             self.spec = None
@@ -44,6 +63,9 @@ class RetroEnv(gym.Env):
         self.statename = state
         self.initial_state = None
         self.players = players
+        self.frameskip = frameskip
+        self.headless = headless
+        self._branches = None
 
         # Don't return multiple rewards in multiplayer mode by default
         # as stable-baselines3 vectorized environments doesn't support it
@@ -95,12 +117,31 @@ class RetroEnv(gym.Env):
             scenario_path = retro.data.get_file_path(game, scenario + ".json", inttype)
 
         self.system = retro.get_romfile_system(rom_path)
+        if obs_color == "indexed" and self.system not in self.INDEXED_SYSTEMS:
+            raise ValueError(
+                f"obs_color='indexed' is not supported for {self.system}, "
+                "whose palette can exceed 256 colors",
+            )
 
-        # We can't have more than one emulator per process. Before creating an
-        # emulator, ensure that unused ones are garbage-collected
-        gc.collect()
-        self.em = retro.RetroEmulator(rom_path)
+        self.em = retro.RetroEmulator(rom_path, core_profile, core_options or {})
         self.em.configure_data(self.data)
+        if headless:
+            # Audio is never consumed and skipped frames need not be drawn. A step
+            # that ends the episode on a skipped frame runs one more frame to draw
+            # the terminal observation
+            self.em.set_audio_enabled(False)
+        if frame_pool:
+            # Each screen is the "max" or "mean" of the last two frames, which
+            # keeps sprites that flicker on alternate frames visible
+            self.em.set_screen_pool(frame_pool)
+        if track_changes:
+            # Frames that leave the screen unchanged, such as menus and pauses,
+            # reuse the last converted observation
+            self.em.set_track_changes(True)
+        if shadow_ram:
+            # Systems that store RAM as byte-swapped words (Genesis, 32X, Saturn)
+            # read variables from a copy swapped once per frame
+            self.data.set_shadow_ram(True)
         self.em.step()
 
         core = retro.get_system_info(self.system)
@@ -119,6 +160,40 @@ class RetroEnv(gym.Env):
             del self.em
             raise
 
+        # Image observations can be resized, converted to grayscale and stacked
+        # natively in one pass over the frame. Each observation is returned as
+        # a new array; with reuse_obs a read-only view of the internal buffer
+        # is returned instead, which the next step overwrites in place unless
+        # the frame size changes. resize_filter is "nearest", "area" or
+        # "bilinear". Observations can be laid out channel first and written as
+        # float16 or float32 in [0, 1], ready to hand to a learner. obs_color
+        # "indexed" stores an index per pixel into get_palette(), which starts
+        # over every episode, and "rgb565" stores a uint16 per pixel. Indexing
+        # is only offered where it is lossless (INDEXED_SYSTEMS), and rgb565
+        # drops the low bits of cores that output 24-bit color
+        self._observation = None
+        self._reuse_obs = reuse_obs
+        obs_dtype = np.dtype(obs_dtype)
+        if obs_type == retro.Observations.IMAGE and (
+            resize
+            or grayscale
+            or frame_stack > 1
+            or channels_first
+            or obs_dtype != np.uint8
+            or obs_color != "rgb"
+        ):
+            height, width = resize or (0, 0)
+            self._observation = retro._retro.Observation(
+                width,
+                height,
+                grayscale,
+                frame_stack,
+                resize_filter,
+                "chw" if channels_first else "hwc",
+                obs_dtype.name,
+                obs_color,
+            )
+
         self.button_combos = self.data.valid_actions()
         if use_restricted_actions == retro.Actions.DISCRETE:
             combos = 1
@@ -134,14 +209,21 @@ class RetroEnv(gym.Env):
 
         if self._obs_type == retro.Observations.RAM:
             shape = self.get_ram().shape
+        elif self._observation:
+            shape = self._observation.update(self.em, self.data).shape
         else:
             img = [self.get_screen(p) for p in range(players)]
             shape = img[0].shape
+        high, dtype = 255, np.uint8
+        if self._observation is not None and obs_color == "rgb565":
+            high, dtype = 0xFFFF, np.uint16
+        elif self._observation is not None and obs_dtype != np.uint8:
+            high, dtype = 1, obs_dtype
         self.observation_space = gym.spaces.Box(
             low=0,
-            high=255,
+            high=high,
             shape=shape,
-            dtype=np.uint8,
+            dtype=dtype,
         )
 
         self.use_restricted_actions = use_restricted_actions
@@ -159,12 +241,26 @@ class RetroEnv(gym.Env):
         if self._obs_type == retro.Observations.RAM:
             self.ram = self.get_ram()
             return self.ram
+        elif self._observation:
+            self.img = self._observation.update(self.em, self.data)
+            return self._output_obs(self.img)
         elif self._obs_type == retro.Observations.IMAGE:
             self.img = self.get_screen()
             return self.img
         else:
             raise ValueError(f"Unrecognized observation type: {self._obs_type}")
 
+    def _output_obs(self, ob):
+        # The native observation is overwritten by the next update, and with
+        # stacking it also holds the frames that later observations are built from
+        if self._observation is None:
+            return ob
+        if self._reuse_obs:
+            ob = ob.view()
+            ob.flags.writeable = False
+            return ob
+        return ob.copy()
+
     def action_to_array(self, a):
         actions = []
         for p in range(self.players):
@@ -195,24 +291,56 @@ class RetroEnv(gym.Env):
         if self.img is None and self.ram is None:
             raise RuntimeError("Please call env.reset() before env.step()")
 
-        for p, ap in enumerate(self.action_to_array(a)):
-            if self.movie:
-                for i in range(self.num_buttons):
-                    self.movie.set_key(i, ap[i], p)
-            self.em.set_button_mask(ap, p)
-
         if self.movie:
-            self.movie.step()
-        self.em.step()
-        self.data.update_ram()
-        ob = self._update_obs()
-        rew, done, info = self.compute_step()
+            ob, rew, done, info = self._step_recorded(a)
+        else:
+            # Decode the action, run all frames and compute the reward natively
+            ob, rews, done, info = self.data.step(
+                self.em,
+                a,
+                self.use_restricted_actions.value,
+                self.players,
+                self.frameskip,
+                self._obs_type.value,
+                self.headless,
+                self._observation,
+            )
+            if self._obs_type == retro.Observations.RAM:
+                self.ram = ob
+            else:
+                self.img = ob
+                ob = self._output_obs(ob)
+            rew = rews if self.players > 1 and self.multi_rewards else rews[0]
 
         if self.render_mode == "human":
             self.render()
 
         return ob, rew, bool(done), False, dict(info)
 
+    def _step_recorded(self, a):
+        actions = self.action_to_array(a)
+        rew = None
+        for _ in range(max(self.frameskip, 1)):
+            for p, ap in enumerate(actions):
+                for i in range(self.num_buttons):
+                    self.movie.set_key(i, ap[i], p)
+                self.em.set_button_mask(ap, p)
+
+            self.movie.step()
+            self.em.step()
+            self.data.update_ram()
+            frame_rew, done, info = self.compute_step()
+            if rew is None:
+                rew = frame_rew
+            elif isinstance(rew, list):
+                rew = [r + f for r, f in zip(rew, frame_rew)]
+            else:
+                rew += frame_rew
+            if done:
+                break
+        ob = self._update_obs()
+        return ob, rew, done, info
+
     def reset(self, seed=None, options=None):
         super().reset(seed=seed)
 
@@ -234,6 +362,8 @@ class RetroEnv(gym.Env):
             self.movie.step()
         self.data.reset()
         self.data.update_ram()
+        if self._observation:
+            self._observation.reset()
 
         if self.render_mode == "human":
             self.render()
@@ -243,7 +373,7 @@ class RetroEnv(gym.Env):
     def render(self):
         mode = self.render_mode
 
-        img = self.get_screen() if self.img is None else self.img
+        img = self.get_screen() if self.img is None or self._observation else self.img
         if mode == "rgb_array":
             return img
         elif mode == "human":
@@ -254,7 +384,36 @@ class RetroEnv(gym.Env):
             self.viewer.imshow(img)
             return self.viewer.isopen
 
+    def evaluate_branches(self, branches, state=None, workers=4, observe=False):
+        """
+        Play each sequence of actions in `branches` from `state`, or from the
+        current state, on `workers` parallel copies of the game. The copies
+        are kept between calls and pick up changes to the game data, scenario
+        and core options
+
+        Returns the total reward, done flag and final state of every branch,
+        and its final observation if `observe` is set
+        """
+        if state is None:
+            state = self.em.get_state()
+        workers = max(workers, 1)
+        if self._branches is None or self._branches.workers() != workers:
+            self._branches = None
+            self._branches = retro._retro.BranchEvaluator(self.em, self.data, workers)
+        rews, dones, states, obs = self._branches.evaluate(
+            state,
+            branches,
+            self.use_restricted_actions.value,
+            self.players,
+            self.frameskip,
+            self._obs_type.value if observe else None,
+        )
+        if not (self.players > 1 and self.multi_rewards):
+            rews = rews[:, 0]
+        return rews, dones, states, obs
+
     def close(self):
+        self._branches = None
         if hasattr(self, "em"):
             del self.em
         if self.viewer:
@@ -274,11 +433,13 @@ class RetroEnv(gym.Env):
         self.data.set_value(name, val)
 
     def get_ram(self):
-        blocks = []
-        for offset in sorted(self.data.memory.blocks):
-            arr = np.frombuffer(self.data.memory.blocks[offset], dtype=np.uint8)
-            blocks.append(arr)
-        return np.concatenate(blocks)
+        return self.data.get_ram()
+
+    def get_palette(self):
+        """
+        RGB colour of each index of "indexed" observations this episode
+        """
+        return self._observation.palette()
 
     def get_screen(self, player=0):
         img = self.em.get_screen()
@@ -0,0 +1,41 @@
+#!/usr/bin/env python
+"""
+Time rendered frames against frames run with rendering skipped, which is what
+every intermediate frame of a frameskipped step costs in headless mode
+"""
+
+import argparse
+import timeit
+
+import retro
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("roms", nargs="+", help="paths to ROM files, one per core")
+    parser.add_argument("--frames", type=int, default=60)
+    parser.add_argument("--number", type=int, default=1000)
+    args = parser.parse_args()
+
+    print(f"{'system':<12} {'render':>12} {'skip':>12} {'speedup':>8}")
+    for rom in args.roms:
+        em = retro.RetroEmulator(rom)
+        for _ in range(args.frames):
+            em.step()
+        state = em.get_state()
+
+        times = []
+        for render in (True, False):
+            em.set_state(state)
+            seconds = timeit.timeit(lambda: em.step(render), number=args.number)
+            times.append(seconds / args.number * 1e6)
+        del em
+
+        print(
+            f"{retro.get_romfile_system(rom):<12} {times[0]:>9.1f} us "
+            f"{times[1]:>9.1f} us {times[0] / times[1]:>7.2f}x",
+        )
+
+
+if __name__ == "__main__":
+    main()
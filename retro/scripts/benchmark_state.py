@@ -0,0 +1,40 @@
+#!/usr/bin/env python
+"""
+Time how long it takes to restore a savestate, which is what every
+env.reset() pays for, and to take one
+"""
+
+import argparse
+import timeit
+
+import retro
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("rom", help="path to a ROM file")
+    parser.add_argument("--frames", type=int, default=60)
+    parser.add_argument("--number", type=int, default=1000)
+    args = parser.parse_args()
+
+    em = retro.RetroEmulator(args.rom)
+    for _ in range(args.frames):
+        em.step()
+    state = em.get_state()
+
+    seconds = timeit.timeit(lambda: em.set_state(state), number=args.number)
+    print(f"set_state: {seconds / args.number * 1e6:.1f} us")
+    seconds = timeit.timeit(em.get_state, number=args.number)
+    print(f"get_state: {seconds / args.number * 1e6:.1f} us")
+    buffer = bytearray(em.state_size())
+    seconds = timeit.timeit(lambda: em.get_state_into(buffer), number=args.number)
+    print(f"get_state_into: {seconds / args.number * 1e6:.1f} us")
+    pool = retro.StatePool(em)
+    seconds = timeit.timeit(pool.save, number=args.number)
+    print(f"StatePool.save: {seconds / args.number * 1e6:.1f} us")
+    seconds = timeit.timeit(em.step, number=args.number)
+    print(f"step: {seconds / args.number * 1e6:.1f} us")
+
+
+if __name__ == "__main__":
+    main()
@@ -73,6 +73,45 @@ size_t ramBase(const string& core) {
 	return s_cores[core].value("rambase", 0);
 }
 
+map<string, string> coreOptions(const string& core, const string& profile) {
+	map<string, string> options;
+	const auto& info = s_cores[core];
+	// Options belong to the libretro core, so they can be declared once on any
+	// platform that shares its lib
+	const string& lib = s_coreToLib[core];
+	for (auto platform = s_cores.cbegin(); platform != s_cores.cend(); ++platform) {
+		if (platform.key() == core || s_coreToLib[platform.key()] != lib || platform->find("options") == platform->end()) {
+			continue;
+		}
+		for (auto option = (*platform)["options"].cbegin(); option != (*platform)["options"].cend(); ++option) {
+			options[option.key()] = option->get<string>();
+		}
+	}
+	if (info.find("options") != info.end()) {
+		for (auto option = info["options"].cbegin(); option != info["options"].cend(); ++option) {
+			options[option.key()] = option->get<string>();
+		}
+	}
+	if (!profile.empty() && info.find("profiles") != info.end() && info["profiles"].find(profile) != info["profiles"].end()) {
+		const auto& overrides = info["profiles"][profile];
+		for (auto option = overrides.cbegin(); option != overrides.cend(); ++option) {
+			options[option.key()] = option->get<string>();
+		}
+	}
+	return options;
+}
+
+vector<string> coreProfiles(const string& core) {
+	vector<string> results;
+	const auto& info = s_cores[core];
+	if (info.find("profiles") != info.end()) {
+		for (auto profile = info["profiles"].cbegin(); profile != info["profiles"].cend(); ++profile) {
+			results.emplace_back(profile.key());
+		}
+	}
+	return results;
+}
+
 void configureData(GameData* data, const string& core) {
 	if (s_cores[core].find("types") != s_cores[core].end()) {
 		vector<Retro::DataType> typesVec;
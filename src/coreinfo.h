@@ -1,5 +1,6 @@
 #pragma once
 
+#include <map>
 #include <string>
 #include <vector>
 
@@ -13,6 +14,8 @@ std::string coreForRom(const std::string& rom);
 std::vector<std::string> buttons(const std::string& core);
 std::vector<std::string> keybinds(const std::string& core);
 size_t ramBase(const std::string& core);
+std::map<std::string, std::string> coreOptions(const std::string& core, const std::string& profile = {});
+std::vector<std::string> coreProfiles(const std::string& core);
 void configureData(GameData*, const std::string& core);
 
 bool loadCoreInfo(const std::string& json);
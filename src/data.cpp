@@ -9,6 +9,7 @@
 
 #include "json.hpp"
 
+#include <algorithm>
 #include <fstream>
 
 using namespace Retro;
@@ -91,6 +92,7 @@ bool GameData::load(istream* file) {
 
 	unordered_map<std::string, Variable> oldVars;
 	oldVars.swap(m_vars);
+	m_tableDirty = true;
 	for (auto var = info->cbegin(); var != info->cend(); ++var) {
 		if (var->find("address") == var->cend() || var->find("type") == var->cend()) {
 			oldVars.swap(m_vars);
@@ -158,6 +160,7 @@ void GameData::reset() {
 	m_lastMem.reset();
 	m_cloneMem.reset();
 	m_vars.clear();
+	m_tableDirty = true;
 	m_searches.clear();
 	m_searchOldMem.clear();
 }
@@ -167,8 +170,17 @@ void GameData::restart() {
 }
 
 void GameData::updateRam() {
+	m_mem.invalidateShadow();
 	m_lastMem = move(m_cloneMem);
-	m_cloneMem.clone(m_mem);
+	m_cloneMem.clone(readMemory());
+}
+
+void GameData::setShadowRam(bool shadow) {
+	m_shadowRam = shadow;
+}
+
+const AddressSpace& GameData::readMemory() const {
+	return m_shadowRam ? m_mem.shadow() : m_mem;
 }
 
 void GameData::setTypes(const vector<DataType> types) {
@@ -187,7 +199,7 @@ void GameData::setActions(const vector<vector<vector<string>>>& actions) {
 	::setActions(m_buttons, actions, m_actions);
 }
 
-map<int, set<int>> GameData::validActions() const {
+const map<int, set<int>>& GameData::validActions() const {
 	return m_actions;
 }
 
@@ -216,7 +228,7 @@ Variant GameData::lookupValue(const string& name) const {
 	if (v == m_vars.end()) {
 		throw invalid_argument(name);
 	}
-	return m_mem[v->second];
+	return readMemory()[v->second];
 }
 
 Datum GameData::lookupValue(const TypedSearchResult& result) {
@@ -224,7 +236,7 @@ Datum GameData::lookupValue(const TypedSearchResult& result) {
 }
 
 int64_t GameData::lookupValue(const TypedSearchResult& result) const {
-	return m_mem[Variable{ result.type, result.address }];
+	return readMemory()[Variable{ result.type, result.address }];
 }
 
 int64_t GameData::lookupDelta(const string& name) const {
@@ -258,9 +270,10 @@ unordered_map<string, Datum> GameData::lookupAll() {
 
 unordered_map<string, int64_t> GameData::lookupAll() const {
 	unordered_map<string, int64_t> data;
+	const AddressSpace& mem = readMemory();
 	for (auto var = m_vars.cbegin(); var != m_vars.cend(); ++var) {
 		try {
-			data.emplace(var->first, m_mem[var->second]);
+			data.emplace(var->first, mem[var->second]);
 		} catch (...) {
 		}
 	}
@@ -270,6 +283,60 @@ unordered_map<string, int64_t> GameData::lookupAll() const {
 	return data;
 }
 
+void GameData::compileVariables() {
+	if (m_tableDirty) {
+		m_tableNames.clear();
+		m_tableTypes.clear();
+		m_tableAddresses.clear();
+		m_tableMasks.clear();
+		for (const auto& var : m_vars) {
+			m_tableNames.emplace_back(var.first);
+		}
+		sort(m_tableNames.begin(), m_tableNames.end());
+		for (const auto& name : m_tableNames) {
+			const Variable& var = m_vars.at(name);
+			m_tableTypes.emplace_back(var.type);
+			m_tableAddresses.emplace_back(var.address);
+			m_tableMasks.emplace_back(var.mask);
+		}
+	} else if (m_tableSpace == &readMemory() && m_tableGeneration == m_tableSpace->generation()) {
+		return;
+	}
+	m_tableDirty = false;
+	m_tableSpace = &readMemory();
+	m_tableGeneration = m_tableSpace->generation();
+	m_tableBases.resize(m_tableNames.size());
+	m_tableOffsets.resize(m_tableNames.size());
+	for (size_t i = 0; i < m_tableNames.size(); ++i) {
+		m_tableBases[i] = static_cast<const uint8_t*>(m_tableSpace->resolve(m_tableAddresses[i], &m_tableOffsets[i]));
+	}
+}
+
+void GameData::lookupVariables(int64_t* values) {
+	compileVariables();
+	const MemoryOverlay& overlay = m_tableSpace->overlay();
+	for (size_t i = 0; i < m_tableNames.size(); ++i) {
+		const uint8_t* base = m_tableBases[i];
+		if (!base) {
+			values[i] = 0;
+			continue;
+		}
+		int64_t value;
+		if (overlay.width > 1) {
+			uint8_t fakeBase[16];
+			value = m_tableTypes[i].decode(overlay.parse(base, m_tableOffsets[i], fakeBase, m_tableTypes[i].width));
+		} else {
+			value = m_tableTypes[i].decode(&base[m_tableOffsets[i]]);
+		}
+		values[i] = value & m_tableMasks[i];
+	}
+}
+
+const vector<string>& GameData::variableNames() {
+	compileVariables();
+	return m_tableNames;
+}
+
 void GameData::setValue(const std::string& name, int64_t v) {
 	auto variant = m_customVars.find(name);
 	if (variant != m_customVars.end()) {
@@ -309,12 +376,14 @@ Variable GameData::getVariable(const string& name) const {
 void GameData::setVariable(const string& name, const Variable& var) {
 	removeVariable(name);
 	m_vars.emplace(name, var);
+	m_tableDirty = true;
 }
 
 void GameData::removeVariable(const string& name) {
 	auto iter = m_vars.find(name);
 	if (iter != m_vars.end()) {
 		m_vars.erase(iter);
+		m_tableDirty = true;
 	}
 }
 
@@ -334,9 +403,11 @@ void GameData::search(const std::string& name, int64_t value) {
 			m_searches.emplace(name, Search{});
 		}
 	}
+	// Searches scan every address, so they always read the shadow
+	m_mem.invalidateShadow();
 	Search* search = &m_searches[name];
-	search->search(m_mem, value);
-	m_searchOldMem[name].clone(m_mem);
+	search->search(m_mem.shadow(), value);
+	m_searchOldMem[name].clone(m_mem.shadow());
 }
 
 void GameData::deltaSearch(const std::string& name, Operation op, int64_t reference) {
@@ -347,12 +418,14 @@ void GameData::deltaSearch(const std::string& name, Operation op, int64_t refere
 			m_searches.emplace(name, Search{});
 		}
 	}
+	m_mem.invalidateShadow();
+	const AddressSpace& mem = m_mem.shadow();
 	if (m_searchOldMem.find(name) == m_searchOldMem.cend()) {
-		m_searchOldMem[name].clone(m_mem);
+		m_searchOldMem[name].clone(mem);
 	}
 	Search* search = &m_searches[name];
-	search->delta(m_mem, m_searchOldMem[name], op, reference);
-	m_searchOldMem[name].clone(m_mem);
+	search->delta(mem, m_searchOldMem[name].shadow(), op, reference);
+	m_searchOldMem[name].clone(mem);
 }
 
 size_t GameData::numSearches() const {
@@ -903,9 +976,11 @@ float Scenario::calculateReward(unsigned player) const {
 		return ScriptContext::get(m_rewardFunc[player].second)->callFunction(m_rewardFunc[player].first);
 	}
 
+	// Read through the const path, which uses the shadow when there is one
+	const GameData& data = m_data;
 	float reward = m_rewardTime[player].calculate(1, 1);
 	for (auto var = m_rewardVars[player].cbegin(); var != m_rewardVars[player].cend(); ++var) {
-		reward += var->second.calculate(m_data.lookupValue(var->first), m_data.lookupDelta(var->first));
+		reward += var->second.calculate(data.lookupValue(var->first), data.lookupDelta(var->first));
 	}
 	return reward;
 }
@@ -914,8 +989,9 @@ bool Scenario::calculateDone() const {
 	if (m_doneFunc.first.size()) {
 		return ScriptContext::get(m_doneFunc.second)->callFunction(m_doneFunc.first);
 	}
+	const GameData& data = m_data;
 	for (auto var = m_doneVars.cbegin(); var != m_doneVars.cend(); ++var) {
-		int done = var->second.test(m_data.lookupValue(var->first), m_data.lookupDelta(var->first));
+		int done = var->second.test(data.lookupValue(var->first), data.lookupDelta(var->first));
 		if (done > 0 && m_doneCondition == DoneCondition::ANY) {
 			return true;
 		}
@@ -936,8 +1012,9 @@ bool Scenario::calculateDone() const {
 }
 
 bool Scenario::isDone(const DoneNode& subnode) const {
+	const GameData& data = m_data;
 	for (auto var = subnode.vars.cbegin(); var != subnode.vars.cend(); ++var) {
-		int done = var->second.test(m_data.lookupValue(var->first), m_data.lookupDelta(var->first));
+		int done = var->second.test(data.lookupValue(var->first), data.lookupDelta(var->first));
 		if (done > 0 && subnode.condition == DoneCondition::ANY) {
 			return true;
 		}
@@ -961,7 +1038,7 @@ void Scenario::setActions(const vector<vector<vector<string>>>& actions) {
 	::setActions(m_data.buttons(), actions, m_actions);
 }
 
-map<int, set<int>> Scenario::validActions() const {
+const map<int, set<int>>& Scenario::validActions() const {
 	if (m_actions.empty()) {
 		return m_data.validActions();
 	}
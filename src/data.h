@@ -33,12 +33,16 @@ public:
 	const AddressSpace& addressSpace() const { return m_mem; }
 	void updateRam();
 
+	// Reads values through the address space's shadow instead of its overlay
+	void setShadowRam(bool);
+	bool shadowRam() const { return m_shadowRam; }
+
 	void setTypes(const std::vector<DataType> types);
 	void setButtons(const std::vector<std::string>& names);
 	std::vector<std::string> buttons() const;
 
 	void setActions(const std::vector<std::vector<std::vector<std::string>>>& actions);
-	std::map<int, std::set<int>> validActions() const;
+	const std::map<int, std::set<int>>& validActions() const;
 	unsigned filterAction(unsigned) const;
 
 	Datum lookupValue(const std::string& name);
@@ -48,6 +52,11 @@ public:
 	std::unordered_map<std::string, Datum> lookupAll();
 	std::unordered_map<std::string, int64_t> lookupAll() const;
 
+	/* Decodes every variable into values, ordered like variableNames().
+	 * Unmapped variables read as 0. */
+	void lookupVariables(int64_t* values);
+	const std::vector<std::string>& variableNames();
+
 	void setValue(const std::string& name, int64_t);
 	void setValue(const std::string& name, const Variant&);
 
@@ -74,15 +83,30 @@ public:
 #endif
 
 private:
+	void compileVariables();
+	const AddressSpace& readMemory() const;
+
 	AddressSpace m_mem;
 	AddressSpace m_cloneMem;
 	AddressSpace m_lastMem;
+	bool m_shadowRam = false;
 	std::vector<DataType> m_types;
 
 	std::map<int, std::set<int>> m_actions;
 	std::vector<std::string> m_buttons;
 
 	std::unordered_map<std::string, Variable> m_vars;
+
+	// m_vars compiled into parallel arrays, sorted by name
+	bool m_tableDirty = true;
+	const AddressSpace* m_tableSpace = nullptr;
+	uint64_t m_tableGeneration = 0;
+	std::vector<std::string> m_tableNames;
+	std::vector<DataType> m_tableTypes;
+	std::vector<size_t> m_tableAddresses;
+	std::vector<uint64_t> m_tableMasks;
+	std::vector<const uint8_t*> m_tableBases;
+	std::vector<size_t> m_tableOffsets;
 	std::unordered_map<std::string, Search> m_searches;
 	std::unordered_map<std::string, AddressSpace> m_searchOldMem;
 	std::unordered_map<std::string, std::unique_ptr<Variant>> m_customVars;
@@ -119,7 +143,7 @@ public:
 	void getCrop(size_t* x, size_t* y, size_t* width, size_t* height, unsigned player = 0) const;
 
 	void setActions(const std::vector<std::vector<std::vector<std::string>>>& actions);
-	std::map<int, std::set<int>> validActions() const;
+	const std::map<int, std::set<int>>& validActions() const;
 	unsigned filterAction(unsigned) const;
 
 	enum class Measurement {
@@ -1,10 +1,17 @@
 #include <cassert>
 #ifndef _WIN32
 #include <dlfcn.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #endif
+#include <algorithm>
+#include <cmath>
 #include <fstream>
 #include <map>
-#include <sstream>
+#include <memory>
+#include <mutex>
 #include <unordered_map>
 #include <vector>
 
@@ -23,38 +30,146 @@ using namespace std;
 
 namespace Retro {
 
-static Emulator* s_loadedEmulator = nullptr;
+// Callbacks from a core carry no context, so each entry into a core records
+// which emulator it belongs to for the duration of the call
+static thread_local Emulator* s_activeEmulator = nullptr;
 
-static map<string, const char*> s_envVariables = {
-	{ "genesis_plus_gx_bram", "per game" },
-	{ "genesis_plus_gx_render", "single field" },
-	{ "genesis_plus_gx_blargg_ntsc_filter", "disabled" }
+// Cores are opened once per instance; additional instances of the same core
+// get a private copy of the library so that its globals are not shared
+static mutex s_coreMutex;
+static unordered_map<string, int> s_coreUsers;
+static size_t s_loadedCores = 0;
+
+// Stereo frames buffered by default; over half a second at 48 kHz
+static const size_t AUDIO_CAPACITY = 32768;
+
+class Emulator::Activation {
+public:
+	Activation(Emulator* emulator)
+		: m_previous(s_activeEmulator) {
+		s_activeEmulator = emulator;
+	}
+	~Activation() {
+		s_activeEmulator = m_previous;
+	}
+
+private:
+	Emulator* m_previous;
+};
+
+// Read-only mapping of a ROM file. Emulators in the same process that load
+// the same file share one mapping, and the OS shares its pages between
+// processes
+class Emulator::RomImage {
+public:
+	static shared_ptr<RomImage> open(const string& path) {
+		static mutex cacheMutex;
+		static unordered_map<string, weak_ptr<RomImage>> cache;
+
+		lock_guard<mutex> lock(cacheMutex);
+		auto rom = cache[path].lock();
+		if (!rom) {
+			rom = make_shared<RomImage>();
+			if (!rom->map(path)) {
+				cache.erase(path);
+				return nullptr;
+			}
+			cache[path] = rom;
+		}
+		return rom;
+	}
+
+	~RomImage() {
+#ifdef _WIN32
+		if (m_data) {
+			UnmapViewOfFile(m_data);
+		}
+#else
+		if (m_data) {
+			munmap(m_data, m_size);
+		}
+#endif
+	}
+
+	const void* data() const { return m_data; }
+	size_t size() const { return m_size; }
+
+private:
+	bool map(const string& path) {
+#ifdef _WIN32
+		HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE) {
+			return false;
+		}
+		LARGE_INTEGER size;
+		HANDLE mapping = nullptr;
+		if (GetFileSizeEx(file, &size) && size.QuadPart) {
+			mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		}
+		CloseHandle(file);
+		if (!mapping) {
+			return false;
+		}
+		m_data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		CloseHandle(mapping);
+		m_size = size.QuadPart;
+#else
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0) {
+			return false;
+		}
+		struct stat st;
+		if (fstat(fd, &st) || !st.st_size) {
+			::close(fd);
+			return false;
+		}
+		m_data = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		::close(fd);
+		if (m_data == MAP_FAILED) {
+			m_data = nullptr;
+		}
+		m_size = st.st_size;
+#endif
+		return m_data;
+	}
+
+	void* m_data = nullptr;
+	size_t m_size = 0;
 };
 
-static void (*retro_init)(void);
-static void (*retro_deinit)(void);
-static unsigned (*retro_api_version)(void);
-static void (*retro_get_system_info)(struct retro_system_info* info);
-static void (*retro_get_system_av_info)(struct retro_system_av_info* info);
-static void (*retro_reset)(void);
-static void (*retro_run)(void);
-static size_t (*retro_serialize_size)(void);
-static bool (*retro_serialize)(void* data, size_t size);
-static bool (*retro_unserialize)(const void* data, size_t size);
-static bool (*retro_load_game)(const struct retro_game_info* game);
-static void (*retro_unload_game)(void);
-static void* (*retro_get_memory_data)(unsigned id);
-static size_t (*retro_get_memory_size)(unsigned id);
-static void (*retro_cheat_reset)(void);
-static void (*retro_cheat_set)(unsigned index, bool enabled, const char* code);
-static void (*retro_set_environment)(retro_environment_t);
-static void (*retro_set_video_refresh)(retro_video_refresh_t);
-static void (*retro_set_audio_sample)(retro_audio_sample_t);
-static void (*retro_set_audio_sample_batch)(retro_audio_sample_batch_t);
-static void (*retro_set_input_poll)(retro_input_poll_t);
-static void (*retro_set_input_state)(retro_input_state_t);
+static string copyCore(const string& corePath) {
+#ifdef _WIN32
+	char dir[MAX_PATH];
+	char file[MAX_PATH];
+	if (!GetTempPathA(MAX_PATH, dir) || !GetTempFileNameA(dir, "rc", 0, file)) {
+		return {};
+	}
+	if (!CopyFileA(corePath.c_str(), file, FALSE)) {
+		DeleteFileA(file);
+		return {};
+	}
+	return file;
+#else
+	const char* dir = getenv("TMPDIR");
+	string file = string(dir ? dir : "/tmp") + "/retro-core-XXXXXX";
+	int fd = mkstemp(&file[0]);
+	if (fd < 0) {
+		return {};
+	}
+	::close(fd);
+	ifstream in(corePath, ios::binary);
+	ofstream out(file, ios::binary | ios::trunc);
+	out << in.rdbuf();
+	if (in.fail() || out.fail()) {
+		unlink(file.c_str());
+		return {};
+	}
+	return file;
+#endif
+}
 
 Emulator::Emulator() {
+	setAudioCapacity(AUDIO_CAPACITY);
 }
 
 Emulator::~Emulator() {
@@ -70,13 +185,15 @@ Emulator::~Emulator() {
 }
 
 bool Emulator::isLoaded() {
-	return s_loadedEmulator;
+	lock_guard<mutex> lock(s_coreMutex);
+	return s_loadedCores;
 }
 
 bool Emulator::loadRom(const string& romPath) {
 	if (m_romLoaded) {
 		unloadRom();
 	}
+	Activation activation(this);
 
 	auto core = coreForRom(romPath);
 	if (core.size() == 0) {
@@ -86,6 +203,7 @@ bool Emulator::loadRom(const string& romPath) {
 	if (m_coreHandle && m_core != core) {
 		unloadCore();
 	}
+	updateCoreOptions(core);
 	if (!m_coreHandle) {
 		string lib = libForCore(core) + "_libretro.";
 #ifdef __APPLE__
@@ -101,193 +219,383 @@ bool Emulator::loadRom(const string& romPath) {
 		m_core = core;
 	}
 
-	retro_game_info gameInfo;
-	ifstream in(romPath, ios::binary | ios::ate);
-	if (in.fail()) {
-		return false;
-	}
-	ostringstream out;
-	gameInfo.size = in.tellg();
-	if (in.fail()) {
-		return false;
-	}
-	char* romData = new char[gameInfo.size];
+	retro_system_info systemInfo;
+	m_retro.retro_get_system_info(&systemInfo);
+
+	retro_game_info gameInfo{};
 	gameInfo.path = romPath.c_str();
-	gameInfo.data = romData;
-	in.seekg(0, ios::beg);
-	in.read(romData, gameInfo.size);
-	if (in.fail()) {
-		delete[] romData;
-		return false;
+	if (!systemInfo.need_fullpath) {
+		// Disc-based cores open the image themselves; cartridges are mapped
+		m_rom = RomImage::open(romPath);
+		if (!m_rom) {
+			return false;
+		}
+		gameInfo.data = m_rom->data();
+		gameInfo.size = m_rom->size();
 	}
-	in.close();
 
-	auto res = retro_load_game(&gameInfo);
-	delete[] romData;
-	if (!res) {
+	if (!m_retro.retro_load_game(&gameInfo)) {
+		m_rom.reset();
 		return false;
 	}
-	retro_get_system_av_info(&m_avInfo);
+	m_coreOptionsUpdated = false;
+	m_serializeSize = 0;
+	m_retro.retro_get_system_av_info(&m_avInfo);
 	fixScreenSize(romPath);
 
+	m_resetState.clear();
+	if (!strcmp(systemInfo.library_name, "Stella")) {
+		// Stella does not properly clear everything when reseting or loading a
+		// savestate, so keep the state of the freshly loaded game to return to
+		m_resetState.resize(serializeSize());
+		if (!m_retro.retro_serialize(m_resetState.data(), m_resetState.size())) {
+			m_resetState.clear();
+		}
+	}
+	m_audioFrames = 0;
+	setAudioResampleRate(m_audioResampleRate);
+
 	m_romLoaded = true;
 	m_romPath = romPath;
 	return true;
 }
 
-void Emulator::run() {
-	assert(s_loadedEmulator == this);
-	m_audioData.clear();
-	retro_run();
+void Emulator::run(bool render) {
+	assert(m_coreHandle);
+	Activation activation(this);
+	if (!m_audioAccumulate) {
+		m_audioFrames = 0;
+	}
+	if (render) {
+		// The image from before a reset or a loaded state isn't a previous frame
+		m_hasPreviousImage = m_keepPreviousImage && m_imgData && m_imgCurrent;
+		if (m_hasPreviousImage) {
+			m_previousWidth = m_avInfo.geometry.base_width;
+			m_previousHeight = m_avInfo.geometry.base_height;
+			m_previousPitch = m_imgPitch;
+			m_previousDepth = m_imgDepth;
+			m_previousImage.resize(m_previousPitch * m_previousHeight);
+			memcpy(m_previousImage.data(), m_imgData, m_previousImage.size());
+		}
+	}
+	m_renderFrame = render;
+	m_changedBegin = 0;
+	m_changedEnd = 0;
+	m_retro.retro_run();
+	m_renderFrame = true;
+	m_imgCurrent = true;
+	if (m_addressSpace) {
+		m_addressSpace->invalidateShadow();
+	}
+}
+
+void Emulator::setKeepPreviousImage(bool keep) {
+	m_keepPreviousImage = keep;
+	m_hasPreviousImage = false;
+	if (!keep) {
+		m_previousImage = {};
+	}
+}
+
+const void* Emulator::getPreviousImageData() const {
+	if (!m_hasPreviousImage || m_previousWidth != m_avInfo.geometry.base_width || m_previousHeight != m_avInfo.geometry.base_height || m_previousPitch != m_imgPitch || m_previousDepth != m_imgDepth) {
+		return nullptr;
+	}
+	return m_previousImage.data();
+}
+
+void Emulator::setTrackChanges(bool track) {
+	m_trackChanges = track;
+	// The next image is compared against nothing, so it always changes
+	m_shadowImage = {};
+	m_shadowWidth = 0;
+	m_shadowHeight = 0;
+	m_shadowDepth = 0;
+}
+
+void Emulator::getChangedRows(unsigned* begin, unsigned* end) const {
+	*begin = m_changedBegin;
+	*end = m_changedEnd;
+}
+
+void Emulator::compareImage(const void* data, unsigned width, unsigned height, size_t pitch) {
+	if (!data) {
+		// The core duplicated the last frame
+		return;
+	}
+	if (!m_trackChanges) {
+		m_changedEnd = height;
+		++m_imageVersion;
+		return;
+	}
+
+	size_t rowSize = width * ((m_imgDepth + 7) / 8);
+	bool resized = width != m_shadowWidth || height != m_shadowHeight || m_imgDepth != m_shadowDepth;
+	if (resized) {
+		m_shadowImage.resize(rowSize * height);
+		m_shadowWidth = width;
+		m_shadowHeight = height;
+		m_shadowDepth = m_imgDepth;
+	}
+	const uint8_t* in = static_cast<const uint8_t*>(data);
+	uint8_t* shadow = m_shadowImage.data();
+	for (unsigned y = 0; y < height; ++y) {
+		// Only the visible part of the row is compared; padding may be garbage
+		if (resized || memcmp(&in[pitch * y], &shadow[rowSize * y], rowSize)) {
+			memcpy(&shadow[rowSize * y], &in[pitch * y], rowSize);
+			if (m_changedBegin == m_changedEnd) {
+				m_changedBegin = y;
+			}
+			m_changedEnd = y + 1;
+		}
+	}
+	if (m_changedBegin < m_changedEnd) {
+		++m_imageVersion;
+	}
+}
+
+size_t Emulator::runSequence(const uint16_t* masks, size_t frames, unsigned players, const function<bool(size_t)>& afterFrame, bool renderAll) {
+	assert(players <= MAX_PLAYERS);
+	for (size_t frame = 0; frame < frames; ++frame) {
+		for (unsigned p = 0; p < players; ++p) {
+			setButtonMask(p, masks[frame * players + p]);
+		}
+		run(renderAll || frame + (m_keepPreviousImage ? 2 : 1) >= frames);
+		if (afterFrame && !afterFrame(frame)) {
+			return frame + 1;
+		}
+	}
+	return frames;
+}
+
+void Emulator::setButtonMask(int port, uint16_t mask) {
+	for (int key = 0; key < N_BUTTONS; ++key) {
+		m_buttonMask[port][key] = (mask >> key) & 1;
+	}
 }
 
 void Emulator::reset() {
-	assert(s_loadedEmulator == this);
+	assert(m_coreHandle);
+	Activation activation(this);
 
 	memset(m_buttonMask, 0, sizeof(m_buttonMask));
+	m_hasPreviousImage = false;
+	m_imgCurrent = false;
 
-	retro_system_info systemInfo;
-	retro_get_system_info(&systemInfo);
-	if (!strcmp(systemInfo.library_name, "Stella")) {
-		// Stella does not properly clear everything when reseting or loading a savestate
-		string romPath = m_romPath;
+	if (!m_resetState.empty()) {
+		m_retro.retro_unserialize(m_resetState.data(), m_resetState.size());
+	}
 
-#ifdef _WIN32
-		FreeLibrary(m_coreHandle);
-#else
-		dlclose(m_coreHandle);
-#endif
-		m_coreHandle = nullptr;
-		s_loadedEmulator = nullptr;
-		m_romLoaded = false;
-		loadRom(m_romPath);
-		if (m_addressSpace) {
-			m_addressSpace->reset();
-			m_addressSpace->addBlock(Retro::ramBase(m_core), retro_get_memory_size(RETRO_MEMORY_SYSTEM_RAM), retro_get_memory_data(RETRO_MEMORY_SYSTEM_RAM));
-		}
+	m_retro.retro_reset();
+	if (m_addressSpace) {
+		m_addressSpace->invalidateShadow();
 	}
+}
+
+void Emulator::setCoreProfile(const string& profile) {
+	m_coreProfile = profile;
+	updateCoreOptions(m_core);
+}
+
+void Emulator::setCoreOption(const string& key, const string& value) {
+	m_coreOptionOverrides[key] = value;
+	updateCoreOptions(m_core);
+}
 
-	retro_reset();
+string Emulator::coreOption(const string& key) const {
+	const auto& option = m_coreOptions.find(key);
+	if (option == m_coreOptions.end()) {
+		return {};
+	}
+	return option->second;
+}
+
+void Emulator::updateCoreOptions(const string& core) {
+	if (core.empty()) {
+		return;
+	}
+	auto options = Retro::coreOptions(core, m_coreProfile);
+	for (const auto& option : m_coreOptionOverrides) {
+		options[option.first] = option.second;
+	}
+	if (options != m_coreOptions) {
+		m_coreOptions = move(options);
+		m_coreOptionsUpdated = true;
+	}
 }
 
 void Emulator::unloadCore() {
 	if (!m_coreHandle) {
 		return;
 	}
+	Activation activation(this);
 	if (m_romLoaded) {
 		unloadRom();
 	}
-	retro_deinit();
-#ifdef _WIN32
-	FreeLibrary(m_coreHandle);
-#else
-	dlclose(m_coreHandle);
-#endif
-	m_coreHandle = nullptr;
-	s_loadedEmulator = nullptr;
+	m_retro.retro_deinit();
+	closeCore();
 }
 
 void Emulator::unloadRom() {
 	if (!m_romLoaded) {
 		return;
 	}
-	retro_unload_game();
+	Activation activation(this);
+	m_retro.retro_unload_game();
+	m_rom.reset();
 	m_romLoaded = false;
 	m_romPath.clear();
 	m_addressSpace = nullptr;
+	m_hasPreviousImage = false;
+	m_imgCurrent = false;
 	m_map.clear();
 }
 
 bool Emulator::serialize(void* data, size_t size) {
-	assert(s_loadedEmulator == this);
-	return retro_serialize(data, size);
+	assert(m_coreHandle);
+	Activation activation(this);
+	return m_retro.retro_serialize(data, size);
 }
 
 bool Emulator::unserialize(const void* data, size_t size) {
-	assert(s_loadedEmulator == this);
+	assert(m_coreHandle);
+	Activation activation(this);
+	m_hasPreviousImage = false;
+	m_imgCurrent = false;
+	if (m_addressSpace) {
+		m_addressSpace->invalidateShadow();
+	}
 	try {
-		retro_system_info systemInfo;
-		retro_get_system_info(&systemInfo);
-		if (!strcmp(systemInfo.library_name, "Stella")) {
-			reset();
+		if (!m_resetState.empty()) {
+			// Start from the freshly loaded game, as Stella keeps some of the
+			// running console's state across a load
+			m_retro.retro_unserialize(m_resetState.data(), m_resetState.size());
+			m_retro.retro_reset();
 		}
-
-		return retro_unserialize(data, size);
+		return m_retro.retro_unserialize(data, size);
 	} catch (...) {
 		return false;
 	}
 }
 
 size_t Emulator::serializeSize() {
-	assert(s_loadedEmulator == this);
-	return retro_serialize_size();
+	assert(m_coreHandle);
+	if (!m_serializeSize) {
+		// Some cores (Stella) produce a full state just to measure it
+		Activation activation(this);
+		m_serializeSize = m_retro.retro_serialize_size();
+	}
+	return m_serializeSize;
 }
 
 void Emulator::clearCheats() {
-	assert(s_loadedEmulator == this);
-	retro_cheat_reset();
+	assert(m_coreHandle);
+	Activation activation(this);
+	m_retro.retro_cheat_reset();
 }
 
 void Emulator::setCheat(unsigned index, bool enabled, const char* code) {
-	assert(s_loadedEmulator == this);
-	retro_cheat_set(index, enabled, code);
+	assert(m_coreHandle);
+	Activation activation(this);
+	m_retro.retro_cheat_set(index, enabled, code);
 }
 
 bool Emulator::loadCore(const string& corePath) {
-	if (s_loadedEmulator) {
-		return false;
+	string libPath = corePath;
+	{
+		lock_guard<mutex> lock(s_coreMutex);
+		if (s_coreUsers[corePath]) {
+			libPath = copyCore(corePath);
+			if (libPath.empty()) {
+				return false;
+			}
+		}
+		++s_coreUsers[corePath];
+		++s_loadedCores;
 	}
+	m_coreLibPath = corePath;
 
 #ifdef _WIN32
-	m_coreHandle = LoadLibrary(corePath.c_str());
+	m_coreHandle = LoadLibrary(libPath.c_str());
+	if (libPath != corePath) {
+		m_coreCopyPath = libPath;
+	}
 #else
-	m_coreHandle = dlopen(corePath.c_str(), RTLD_LAZY);
+	m_coreHandle = dlopen(libPath.c_str(), RTLD_LAZY | RTLD_LOCAL);
+	if (libPath != corePath) {
+		// The mapping keeps the copy alive until it is closed
+		unlink(libPath.c_str());
+	}
 #endif
 	if (!m_coreHandle) {
+		closeCore();
 		return false;
 	}
 
-	retro_init = reinterpret_cast<void (*)()>(GETSYM(m_coreHandle, "retro_init"));
-	retro_deinit = reinterpret_cast<void (*)()>(GETSYM(m_coreHandle, "retro_deinit"));
-	retro_api_version = reinterpret_cast<unsigned int (*)()>(GETSYM(m_coreHandle, "retro_api_version"));
-	retro_get_system_info = reinterpret_cast<void (*)(struct retro_system_info*)>(GETSYM(m_coreHandle, "retro_get_system_info"));
-	retro_get_system_av_info = reinterpret_cast<void (*)(struct retro_system_av_info*)>(GETSYM(m_coreHandle, "retro_get_system_av_info"));
-	retro_reset = reinterpret_cast<void (*)()>(GETSYM(m_coreHandle, "retro_reset"));
-	retro_run = reinterpret_cast<void (*)()>(GETSYM(m_coreHandle, "retro_run"));
-	retro_serialize_size = reinterpret_cast<size_t (*)()>(GETSYM(m_coreHandle, "retro_serialize_size"));
-	retro_serialize = reinterpret_cast<bool (*)(void*, size_t)>(GETSYM(m_coreHandle, "retro_serialize"));
-	retro_unserialize = reinterpret_cast<bool (*)(const void*, size_t)>(GETSYM(m_coreHandle, "retro_unserialize"));
-	retro_load_game = reinterpret_cast<bool (*)(const struct retro_game_info*)>(GETSYM(m_coreHandle, "retro_load_game"));
-	retro_unload_game = reinterpret_cast<void (*)()>(GETSYM(m_coreHandle, "retro_unload_game"));
-	retro_get_memory_data = reinterpret_cast<void* (*) (unsigned int)>(GETSYM(m_coreHandle, "retro_get_memory_data"));
-	retro_get_memory_size = reinterpret_cast<size_t (*)(unsigned int)>(GETSYM(m_coreHandle, "retro_get_memory_size"));
-	retro_cheat_reset = reinterpret_cast<void (*)()>(GETSYM(m_coreHandle, "retro_cheat_reset"));
-	retro_cheat_set = reinterpret_cast<void (*)(unsigned int, bool, const char*)>(GETSYM(m_coreHandle, "retro_cheat_set"));
-	retro_set_environment = reinterpret_cast<void (*)(retro_environment_t)>(GETSYM(m_coreHandle, "retro_set_environment"));
-	retro_set_video_refresh = reinterpret_cast<void (*)(retro_video_refresh_t)>(GETSYM(m_coreHandle, "retro_set_video_refresh"));
-	retro_set_audio_sample = reinterpret_cast<void (*)(retro_audio_sample_t)>(GETSYM(m_coreHandle, "retro_set_audio_sample"));
-	retro_set_audio_sample_batch = reinterpret_cast<void (*)(retro_audio_sample_batch_t)>(GETSYM(m_coreHandle, "retro_set_audio_sample_batch"));
-	retro_set_input_poll = reinterpret_cast<void (*)(retro_input_poll_t)>(GETSYM(m_coreHandle, "retro_set_input_poll"));
-	retro_set_input_state = reinterpret_cast<void (*)(short (*)(unsigned int, unsigned int, unsigned int, unsigned int))>(GETSYM(m_coreHandle, "retro_set_input_state"));
+	m_retro.retro_init = reinterpret_cast<void (*)()>(GETSYM(m_coreHandle, "retro_init"));
+	m_retro.retro_deinit = reinterpret_cast<void (*)()>(GETSYM(m_coreHandle, "retro_deinit"));
+	m_retro.retro_api_version = reinterpret_cast<unsigned int (*)()>(GETSYM(m_coreHandle, "retro_api_version"));
+	m_retro.retro_get_system_info = reinterpret_cast<void (*)(struct retro_system_info*)>(GETSYM(m_coreHandle, "retro_get_system_info"));
+	m_retro.retro_get_system_av_info = reinterpret_cast<void (*)(struct retro_system_av_info*)>(GETSYM(m_coreHandle, "retro_get_system_av_info"));
+	m_retro.retro_reset = reinterpret_cast<void (*)()>(GETSYM(m_coreHandle, "retro_reset"));
+	m_retro.retro_run = reinterpret_cast<void (*)()>(GETSYM(m_coreHandle, "retro_run"));
+	m_retro.retro_serialize_size = reinterpret_cast<size_t (*)()>(GETSYM(m_coreHandle, "retro_serialize_size"));
+	m_retro.retro_serialize = reinterpret_cast<bool (*)(void*, size_t)>(GETSYM(m_coreHandle, "retro_serialize"));
+	m_retro.retro_unserialize = reinterpret_cast<bool (*)(const void*, size_t)>(GETSYM(m_coreHandle, "retro_unserialize"));
+	m_retro.retro_load_game = reinterpret_cast<bool (*)(const struct retro_game_info*)>(GETSYM(m_coreHandle, "retro_load_game"));
+	m_retro.retro_unload_game = reinterpret_cast<void (*)()>(GETSYM(m_coreHandle, "retro_unload_game"));
+	m_retro.retro_get_memory_data = reinterpret_cast<void* (*) (unsigned int)>(GETSYM(m_coreHandle, "retro_get_memory_data"));
+	m_retro.retro_get_memory_size = reinterpret_cast<size_t (*)(unsigned int)>(GETSYM(m_coreHandle, "retro_get_memory_size"));
+	m_retro.retro_cheat_reset = reinterpret_cast<void (*)()>(GETSYM(m_coreHandle, "retro_cheat_reset"));
+	m_retro.retro_cheat_set = reinterpret_cast<void (*)(unsigned int, bool, const char*)>(GETSYM(m_coreHandle, "retro_cheat_set"));
+	m_retro.retro_set_environment = reinterpret_cast<void (*)(retro_environment_t)>(GETSYM(m_coreHandle, "retro_set_environment"));
+	m_retro.retro_set_video_refresh = reinterpret_cast<void (*)(retro_video_refresh_t)>(GETSYM(m_coreHandle, "retro_set_video_refresh"));
+	m_retro.retro_set_audio_sample = reinterpret_cast<void (*)(retro_audio_sample_t)>(GETSYM(m_coreHandle, "retro_set_audio_sample"));
+	m_retro.retro_set_audio_sample_batch = reinterpret_cast<void (*)(retro_audio_sample_batch_t)>(GETSYM(m_coreHandle, "retro_set_audio_sample_batch"));
+	m_retro.retro_set_input_poll = reinterpret_cast<void (*)(retro_input_poll_t)>(GETSYM(m_coreHandle, "retro_set_input_poll"));
+	m_retro.retro_set_input_state = reinterpret_cast<void (*)(short (*)(unsigned int, unsigned int, unsigned int, unsigned int))>(GETSYM(m_coreHandle, "retro_set_input_state"));
 
 	// The default according to the docs
 	m_imgDepth = 15;
-	s_loadedEmulator = this;
 
-	retro_set_environment(cbEnvironment);
-	retro_set_video_refresh(cbVideoRefresh);
-	retro_set_audio_sample(cbAudioSample);
-	retro_set_audio_sample_batch(cbAudioSampleBatch);
-	retro_set_input_poll(cbInputPoll);
-	retro_set_input_state(cbInputState);
-	retro_init();
+	m_retro.retro_set_environment(cbEnvironment);
+	m_retro.retro_set_video_refresh(cbVideoRefresh);
+	m_retro.retro_set_audio_sample(cbAudioSample);
+	m_retro.retro_set_audio_sample_batch(cbAudioSampleBatch);
+	m_retro.retro_set_input_poll(cbInputPoll);
+	m_retro.retro_set_input_state(cbInputState);
+	m_retro.retro_init();
 
 	return true;
 }
 
+void Emulator::closeCore() {
+	if (m_coreHandle) {
+#ifdef _WIN32
+		FreeLibrary(m_coreHandle);
+#else
+		dlclose(m_coreHandle);
+#endif
+		m_coreHandle = nullptr;
+	}
+	m_retro = {};
+	if (!m_coreCopyPath.empty()) {
+#ifdef _WIN32
+		DeleteFileA(m_coreCopyPath.c_str());
+#endif
+		m_coreCopyPath.clear();
+	}
+	if (!m_coreLibPath.empty()) {
+		lock_guard<mutex> lock(s_coreMutex);
+		--s_coreUsers[m_coreLibPath];
+		--s_loadedCores;
+		m_coreLibPath.clear();
+	}
+}
+
 void Emulator::fixScreenSize(const string& romName) {
 	retro_system_info systemInfo;
-	retro_get_system_info(&systemInfo);
+	m_retro.retro_get_system_info(&systemInfo);
 	if (!strcmp(systemInfo.library_name, "Genesis Plus GX")) {
 		switch (romName.back()) {
 		case 'd': // Mega Drive
@@ -355,47 +663,57 @@ static void cbLog(enum retro_log_level level, const char *fmt, ...) {
 }
 
 bool Emulator::cbEnvironment(unsigned cmd, void* data) {
-	assert(s_loadedEmulator);
+	assert(s_activeEmulator);
 	switch (cmd) {
 	case RETRO_ENVIRONMENT_SET_PIXEL_FORMAT:
 		switch (*reinterpret_cast<retro_pixel_format*>(data)) {
 		case RETRO_PIXEL_FORMAT_XRGB8888:
-			s_loadedEmulator->m_imgDepth = 32;
+			s_activeEmulator->m_imgDepth = 32;
 			break;
 		case RETRO_PIXEL_FORMAT_RGB565:
-			s_loadedEmulator->m_imgDepth = 16;
+			s_activeEmulator->m_imgDepth = 16;
 			break;
 		case RETRO_PIXEL_FORMAT_0RGB1555:
-			s_loadedEmulator->m_imgDepth = 15;
+			s_activeEmulator->m_imgDepth = 15;
 			break;
 		default:
-			s_loadedEmulator->m_imgDepth = 0;
+			s_activeEmulator->m_imgDepth = 0;
 			break;
 		}
 		return true;
 	case RETRO_ENVIRONMENT_GET_VARIABLE: {
 		struct retro_variable* var = reinterpret_cast<struct retro_variable*>(data);
-		if (s_envVariables.count(string(var->key))) {
-			var->value = s_envVariables[string(var->key)];
+		const auto& option = s_activeEmulator->m_coreOptions.find(var->key);
+		if (option != s_activeEmulator->m_coreOptions.end()) {
+			var->value = option->second.c_str();
 			return true;
 		}
 		return false;
 	}
+	case RETRO_ENVIRONMENT_GET_VARIABLE_UPDATE:
+		*reinterpret_cast<bool*>(data) = s_activeEmulator->m_coreOptionsUpdated;
+		s_activeEmulator->m_coreOptionsUpdated = false;
+		return true;
 	case RETRO_ENVIRONMENT_GET_SYSTEM_DIRECTORY:
-		if (!s_loadedEmulator->m_corePath) {
-			s_loadedEmulator->m_corePath = strdup(corePath().c_str());
+		if (!s_activeEmulator->m_corePath) {
+			s_activeEmulator->m_corePath = strdup(corePath().c_str());
 		}
-		*reinterpret_cast<const char**>(data) = s_loadedEmulator->m_corePath;
+		*reinterpret_cast<const char**>(data) = s_activeEmulator->m_corePath;
 		return true;
 	case RETRO_ENVIRONMENT_GET_CAN_DUPE:
 		*reinterpret_cast<bool*>(data) = true;
 		return true;
 	case RETRO_ENVIRONMENT_SET_MEMORY_MAPS:
-		s_loadedEmulator->m_map.clear();
+		s_activeEmulator->m_map.clear();
 		for (size_t i = 0; i < static_cast<const retro_memory_map*>(data)->num_descriptors; ++i) {
-			s_loadedEmulator->m_map.emplace_back(static_cast<const retro_memory_map*>(data)->descriptors[i]);
+			s_activeEmulator->m_map.emplace_back(static_cast<const retro_memory_map*>(data)->descriptors[i]);
+		}
+		s_activeEmulator->reconfigureAddressSpace();
+		return true;
+	case RETRO_ENVIRONMENT_GET_AUDIO_VIDEO_ENABLE:
+		if (data) {
+			*reinterpret_cast<int*>(data) = (s_activeEmulator->m_videoEnabled && s_activeEmulator->m_renderFrame ? 1 : 0) | (s_activeEmulator->m_audioEnabled ? 2 : 0);
 		}
-		s_loadedEmulator->reconfigureAddressSpace();
 		return true;
 	// Logs needs to be handled even when not used, otherwise some cores (ex: mame2003_plus) will crash
 	// Also very useful when integrating new emulators to debug issues within the core itself
@@ -411,46 +729,115 @@ bool Emulator::cbEnvironment(unsigned cmd, void* data) {
 }
 
 void Emulator::cbVideoRefresh(const void* data, unsigned width, unsigned height, size_t pitch) {
-	assert(s_loadedEmulator);
+	assert(s_activeEmulator);
 	if (data) {
-		s_loadedEmulator->m_imgData = data;
+		s_activeEmulator->m_imgData = data;
 	}
 	if (pitch) {
-		s_loadedEmulator->m_imgPitch = pitch;
+		s_activeEmulator->m_imgPitch = pitch;
 	}
 
-	s_loadedEmulator -> m_avInfo.geometry.base_width = width;
-	s_loadedEmulator -> m_avInfo.geometry.base_height = height;
+	s_activeEmulator->m_avInfo.geometry.base_width = width;
+	s_activeEmulator->m_avInfo.geometry.base_height = height;
+	s_activeEmulator->compareImage(data, width, height, s_activeEmulator->m_imgPitch);
 }
 
 void Emulator::cbAudioSample(int16_t left, int16_t right) {
-	assert(s_loadedEmulator);
-	s_loadedEmulator->m_audioData.push_back(left);
-	s_loadedEmulator->m_audioData.push_back(right);
+	assert(s_activeEmulator);
+	if (!s_activeEmulator->m_audioEnabled) {
+		return;
+	}
+	int16_t frame[2] = { left, right };
+	s_activeEmulator->writeAudio(frame, 1);
 }
 
 size_t Emulator::cbAudioSampleBatch(const int16_t* data, size_t frames) {
-	assert(s_loadedEmulator);
-	s_loadedEmulator->m_audioData.insert(s_loadedEmulator->m_audioData.end(), data, &data[frames * 2]);
+	assert(s_activeEmulator);
+	if (!s_activeEmulator->m_audioEnabled) {
+		return frames;
+	}
+	s_activeEmulator->writeAudio(data, frames);
 	return frames;
 }
 
+void Emulator::setAudioCapacity(size_t frames) {
+	m_audioCapacity = max<size_t>(frames, 1);
+	m_audioData.assign(m_audioCapacity * 4, 0);
+	m_audioHead = 0;
+	m_audioFrames = 0;
+}
+
+void Emulator::setAudioResampleRate(double rate) {
+	m_audioResampleRate = max(rate, 0.0);
+	m_audioPhase = 0;
+	m_audioLast[0] = 0;
+	m_audioLast[1] = 0;
+}
+
+void Emulator::consumeAudio(size_t frames) {
+	m_audioFrames -= min(frames, m_audioFrames);
+}
+
+void Emulator::writeAudio(const int16_t* data, size_t frames) {
+	int16_t* ring = m_audioData.data();
+	size_t mirror = m_audioCapacity * 2;
+	double nativeRate = m_avInfo.timing.sample_rate;
+	if (m_audioResampleRate <= 0 || nativeRate <= 0 || m_audioResampleRate == nativeRate) {
+		// Keep only what fits, then copy in up to two runs that each go to
+		// both halves of the ring
+		size_t written = frames;
+		if (frames > m_audioCapacity) {
+			data = &data[(frames - m_audioCapacity) * 2];
+			frames = m_audioCapacity;
+		}
+		while (frames) {
+			size_t run = min(frames, m_audioCapacity - m_audioHead);
+			memcpy(&ring[m_audioHead * 2], data, run * 4);
+			memcpy(&ring[m_audioHead * 2 + mirror], data, run * 4);
+			m_audioHead = (m_audioHead + run) % m_audioCapacity;
+			data = &data[run * 2];
+			frames -= run;
+		}
+		m_audioFrames = min(m_audioFrames + written, m_audioCapacity);
+		return;
+	}
+
+	// Output frames fall between the previous input frame and the current one
+	double step = nativeRate / m_audioResampleRate;
+	for (size_t i = 0; i < frames; ++i) {
+		const int16_t* frame = &data[i * 2];
+		for (; m_audioPhase < 1.0; m_audioPhase += step) {
+			for (int c = 0; c < 2; ++c) {
+				int16_t sample = m_audioLast[c] + lround((frame[c] - m_audioLast[c]) * m_audioPhase);
+				ring[m_audioHead * 2 + c] = sample;
+				ring[m_audioHead * 2 + mirror + c] = sample;
+			}
+			m_audioHead = (m_audioHead + 1) % m_audioCapacity;
+			m_audioFrames = min(m_audioFrames + 1, m_audioCapacity);
+		}
+		m_audioPhase -= 1.0;
+		m_audioLast[0] = frame[0];
+		m_audioLast[1] = frame[1];
+	}
+}
+
 void Emulator::cbInputPoll() {
-	assert(s_loadedEmulator);
+	assert(s_activeEmulator);
 }
 
 int16_t Emulator::cbInputState(unsigned port, unsigned, unsigned, unsigned id) {
-	assert(s_loadedEmulator);
-	return s_loadedEmulator->m_buttonMask[port][id];
+	assert(s_activeEmulator);
+	return s_activeEmulator->m_buttonMask[port][id];
 }
 
 void Emulator::configureData(GameData* data) {
+	Activation activation(this);
 	m_addressSpace = &data->addressSpace();
 	m_addressSpace->reset();
 	Retro::configureData(data, m_core);
 	reconfigureAddressSpace();
-	if (m_addressSpace->blocks().empty() && retro_get_memory_size(RETRO_MEMORY_SYSTEM_RAM)) {
-		m_addressSpace->addBlock(Retro::ramBase(m_core), retro_get_memory_size(RETRO_MEMORY_SYSTEM_RAM), retro_get_memory_data(RETRO_MEMORY_SYSTEM_RAM));
+	if (m_addressSpace->blocks().empty() && m_retro.retro_get_memory_size(RETRO_MEMORY_SYSTEM_RAM)) {
+		m_addressSpace->addBlock(Retro::ramBase(m_core), m_retro.retro_get_memory_size(RETRO_MEMORY_SYSTEM_RAM), m_retro.retro_get_memory_data(RETRO_MEMORY_SYSTEM_RAM));
 	}
 }
 
@@ -3,6 +3,9 @@
 #include "libretro.h"
 #include "memory.h"
 
+#include <functional>
+#include <map>
+#include <memory>
 #include <string>
 #include <vector>
 #include <cstring>
@@ -27,7 +30,17 @@ public:
 
 	bool loadRom(const std::string& romPath);
 
-	void run();
+	// Frames run with render = false are still emulated, but cores that
+	// support it skip drawing them and the previous image is kept
+	void run(bool render = true);
+
+	// Runs one frame per row of masks, each row holding a button mask per
+	// player. afterFrame is called with the index of every frame once it has
+	// run and stops the sequence by returning false. Without renderAll only the
+	// last frame of the sequence is rendered, so a sequence stopped before it
+	// leaves the image of an earlier frame; run one more frame to draw a
+	// current one. Returns the number of frames run
+	size_t runSequence(const uint16_t* masks, size_t frames, unsigned players, const std::function<bool(size_t)>& afterFrame = {}, bool renderAll = true);
 	void reset();
 	AddressSpace* getAddressSpace();
 	const void* getImageData() { return m_imgData; }
@@ -35,38 +48,122 @@ public:
 	int getImageWidth() { return m_avInfo.geometry.base_width; }
 	int getImagePitch() { return m_imgPitch; }
 	int getImageDepth() { return m_imgDepth; }
+
+	// Keeps a copy of the image from before each rendered frame, so that the
+	// last two frames can be pooled. Sequences render their last two frames
+	// while this is on. There is no previous image for the first frame after a
+	// reset or a loaded state, or when the image changed size; otherwise it
+	// has the same size, depth and pitch as the current image
+	void setKeepPreviousImage(bool keep);
+	bool keepPreviousImage() const { return m_keepPreviousImage; }
+	const void* getPreviousImageData() const;
+
+	// Compares each new image against a copy of the last one, row by row, so
+	// that static screens can skip conversion. Without tracking every
+	// rendered frame counts as changed
+	void setTrackChanges(bool track);
+	bool trackChanges() const { return m_trackChanges; }
+	// Whether the last frame changed the image, and which rows [begin, end)
+	// changed. A frame that changed size changes every row
+	bool frameChanged() const { return m_changedBegin < m_changedEnd; }
+	void getChangedRows(unsigned* begin, unsigned* end) const;
+	// Counts the frames that changed the image. Anything derived from the
+	// image is still current while this stays the same
+	uint64_t imageVersion() const { return m_imageVersion; }
 	double getFrameRate() { return m_avInfo.timing.fps; }
-	int getAudioSamples() { return m_audioData.size() / 2; }
-	double getAudioRate() { return m_avInfo.timing.sample_rate; }
-	const int16_t* getAudioData() { return m_audioData.data(); }
+	int getAudioSamples() { return m_audioFrames; }
+	double getAudioRate() { return m_audioResampleRate > 0 ? m_audioResampleRate : m_avInfo.timing.sample_rate; }
+	const int16_t* getAudioData() { return &m_audioData[((m_audioHead + m_audioCapacity - m_audioFrames) % m_audioCapacity) * 2]; }
+
+	// Audio is kept in a ring of stereo frames. By default it holds the samples
+	// of the last run(); when accumulating it keeps the newest frames until they
+	// are consumed. A resample rate of 0 keeps the core's native rate
+	void setAudioCapacity(size_t frames);
+	size_t audioCapacity() const { return m_audioCapacity; }
+	void setAudioAccumulate(bool accumulate) { m_audioAccumulate = accumulate; }
+	bool audioAccumulate() const { return m_audioAccumulate; }
+	void setAudioResampleRate(double rate);
+	void consumeAudio(size_t frames);
+
+	// Disabled audio is dropped and disabled video may be skipped by the core;
+	// both can be toggled between frames
+	void setAudioEnabled(bool enabled) { m_audioEnabled = enabled; }
+	bool audioEnabled() const { return m_audioEnabled; }
+	void setVideoEnabled(bool enabled) { m_videoEnabled = enabled; }
+	bool videoEnabled() const { return m_videoEnabled; }
 	void unloadCore();
 	void unloadRom();
 
 	bool serialize(void* data, size_t size);
 	bool unserialize(const void* data, size_t size);
+	// Measured once per loaded game
 	size_t serializeSize();
 
 	void setKey(int port, int key, bool active) { m_buttonMask[port][key] = active; }
+	void setButtonMask(int port, uint16_t mask);
 	bool getKey(int port, int key) { return m_buttonMask[port][key]; }
 
 	void clearCheats();
 	void setCheat(unsigned index, bool enabled, const char* code);
 
+	// Core options start from the platform's "options" in its core JSON, then
+	// the selected profile, then individual overrides. Changes after loading are
+	// picked up the next time the core checks for updated variables
+	void setCoreProfile(const std::string& profile);
+	void setCoreOption(const std::string& key, const std::string& value);
+	std::string coreOption(const std::string& key) const;
+	const std::map<std::string, std::string>& coreOptions() const { return m_coreOptions; }
+
 	std::string core() const { return m_core; }
+	std::string romPath() const { return m_romPath; }
 	void configureData(GameData*);
 	std::vector<std::string> buttons() const;
 	std::vector<std::string> keybinds() const;
 
 private:
+	class Activation;
+	class RomImage;
+
+	// Entry points of this instance's private copy of the core
+	struct CoreFunctions {
+		void (*retro_init)(void);
+		void (*retro_deinit)(void);
+		unsigned (*retro_api_version)(void);
+		void (*retro_get_system_info)(struct retro_system_info* info);
+		void (*retro_get_system_av_info)(struct retro_system_av_info* info);
+		void (*retro_reset)(void);
+		void (*retro_run)(void);
+		size_t (*retro_serialize_size)(void);
+		bool (*retro_serialize)(void* data, size_t size);
+		bool (*retro_unserialize)(const void* data, size_t size);
+		bool (*retro_load_game)(const struct retro_game_info* game);
+		void (*retro_unload_game)(void);
+		void* (*retro_get_memory_data)(unsigned id);
+		size_t (*retro_get_memory_size)(unsigned id);
+		void (*retro_cheat_reset)(void);
+		void (*retro_cheat_set)(unsigned index, bool enabled, const char* code);
+		void (*retro_set_environment)(retro_environment_t);
+		void (*retro_set_video_refresh)(retro_video_refresh_t);
+		void (*retro_set_audio_sample)(retro_audio_sample_t);
+		void (*retro_set_audio_sample_batch)(retro_audio_sample_batch_t);
+		void (*retro_set_input_poll)(retro_input_poll_t);
+		void (*retro_set_input_state)(retro_input_state_t);
+	};
+
 	bool loadCore(const std::string& corePath);
+	void closeCore();
 	void fixScreenSize(const std::string& romName);
+	void updateCoreOptions(const std::string& core);
 	void reconfigureAddressSpace();
 
 	static bool cbEnvironment(unsigned cmd, void* data);
 	static void cbVideoRefresh(const void* data, unsigned width, unsigned height, size_t pitch);
+	void compareImage(const void* data, unsigned width, unsigned height, size_t pitch);
 	static void cbAudioSample(int16_t left, int16_t right);
 	static size_t cbAudioSampleBatch(const int16_t* data, size_t frames);
 	static void cbInputPoll();
+
+	void writeAudio(const int16_t* data, size_t frames);
 	static int16_t cbInputState(unsigned port, unsigned device, unsigned index, unsigned id);
 
 	bool m_buttonMask[MAX_PLAYERS][N_BUTTONS]{};
@@ -76,8 +173,42 @@ private:
 	size_t m_imgPitch = 0;
 	int m_imgDepth = 0;
 
-	// Audio buffer; accumulated during run()
+	std::vector<uint8_t> m_previousImage;
+	unsigned m_previousWidth = 0;
+	unsigned m_previousHeight = 0;
+	size_t m_previousPitch = 0;
+	int m_previousDepth = 0;
+	bool m_keepPreviousImage = false;
+	bool m_hasPreviousImage = false;
+	// Cleared when the core's state is replaced, which leaves the image stale
+	bool m_imgCurrent = false;
+
+	// Packed copy of the last image, for change tracking
+	std::vector<uint8_t> m_shadowImage;
+	unsigned m_shadowWidth = 0;
+	unsigned m_shadowHeight = 0;
+	int m_shadowDepth = 0;
+	bool m_trackChanges = false;
+	unsigned m_changedBegin = 0;
+	unsigned m_changedEnd = 0;
+	uint64_t m_imageVersion = 0;
+
+	// Audio ring buffer, stored twice back to back so the buffered frames are
+	// always contiguous
 	std::vector<int16_t> m_audioData;
+	size_t m_audioCapacity = 0;
+	size_t m_audioHead = 0;
+	size_t m_audioFrames = 0;
+	bool m_audioAccumulate = false;
+
+	// Linear resampler state
+	double m_audioResampleRate = 0;
+	double m_audioPhase = 0;
+	int16_t m_audioLast[2]{};
+
+	bool m_audioEnabled = true;
+	bool m_videoEnabled = true;
+	bool m_renderFrame = true;
 	AddressSpace* m_addressSpace = nullptr;
 
 	retro_system_av_info m_avInfo = {};
@@ -85,13 +216,24 @@ private:
 
 	char* m_corePath = nullptr;
 
+	CoreFunctions m_retro{};
 #ifdef _WIN32
 	HMODULE m_coreHandle = nullptr;
 #else
 	void* m_coreHandle = nullptr;
 #endif
+	std::string m_coreLibPath;
+	std::string m_coreCopyPath;
 	bool m_romLoaded = false;
 	std::string m_core;
 	std::string m_romPath;
+	std::shared_ptr<RomImage> m_rom;
+
+	std::string m_coreProfile;
+	std::map<std::string, std::string> m_coreOptionOverrides;
+	std::map<std::string, std::string> m_coreOptions;
+	bool m_coreOptionsUpdated = false;
+	std::vector<uint8_t> m_resetState;
+	size_t m_serializeSize = 0;
 };
 }
@@ -0,0 +1,333 @@
+#include "imageops-kernels.h"
+
+#ifdef __AVX2__
+#include <immintrin.h>
+
+using namespace Retro;
+
+static inline __m256i _load(const void* in) {
+	return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in));
+}
+
+static inline __m256i _convert565ToGray(__m256i pix) {
+	/* Mask out and normalize channels */
+	__m256i r = _mm256_srli_epi16(_mm256_and_si256(pix, _mm256_set1_epi16(0xF800)), 10);
+	__m256i g = _mm256_srli_epi16(_mm256_and_si256(pix, _mm256_set1_epi16(0x07E0)), 5);
+	__m256i b = _mm256_slli_epi16(_mm256_and_si256(pix, _mm256_set1_epi16(0x001F)), 1);
+	/* Combine channels */
+	return _mm256_add_epi16(_mm256_add_epi16(r, g), b);
+}
+
+static inline __m256i _convertX888ToGray(const uint32_t* in) {
+	/* Sum B, G and R of 16 pixels into 32-bit lanes */
+	const __m256i weights = _mm256_set1_epi32(0x00010101);
+	const __m256i ones = _mm256_set1_epi16(1);
+	__m256i gray0 = _load(&in[0]);
+	__m256i gray1 = _load(&in[8]);
+	gray0 = _mm256_srli_epi32(_mm256_madd_epi16(_mm256_maddubs_epi16(gray0, weights), ones), 2);
+	gray1 = _mm256_srli_epi32(_mm256_madd_epi16(_mm256_maddubs_epi16(gray1, weights), ones), 2);
+	/* Pack to 16-bit lanes; packing works per 128-bit lane, so put the quadwords back in order */
+	return _mm256_permute4x64_epi64(_mm256_packus_epi32(gray0, gray1), 0xD8);
+}
+
+static inline __m256i _neighbors16(__m256i a, __m256i b) {
+	/* Keep every other 16-bit lane of 32 */
+	const __m256i even = _mm256_set1_epi32(0xFFFF);
+	__m256i out = _mm256_packus_epi32(_mm256_and_si256(a, even), _mm256_and_si256(b, even));
+	return _mm256_permute4x64_epi64(out, 0xD8);
+}
+
+static inline __m256i _halveW16(__m256i gray) {
+	/* Average neighboring 16-bit lanes into 32-bit lanes */
+	__m256i even = _mm256_and_si256(gray, _mm256_set1_epi32(0xFFFF));
+	__m256i odd = _mm256_srli_epi32(gray, 16);
+	return _mm256_avg_epu16(even, odd);
+}
+
+static inline __m128i _pack32To8(__m256i a, __m256i b) {
+	/* A0-3 B0-3 | A4-7 B4-7 -> A0-7 B0-7 */
+	__m256i out = _mm256_packus_epi16(_mm256_packus_epi32(a, b), _mm256_setzero_si256());
+	out = _mm256_permutevar8x32_epi32(out, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+	return _mm256_castsi256_si128(out);
+}
+
+static inline void _storeBGRX(__m256i pix, uint8_t* out) {
+	/* Drop X and reverse each pixel within 128-bit lanes, then close the gap between the lanes */
+	const __m256i blend = _mm256_setr_epi8(
+		2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+		2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+	pix = _mm256_shuffle_epi8(pix, blend);
+	pix = _mm256_permutevar8x32_epi32(pix, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(&out[0]), _mm256_castsi256_si128(pix));
+	_mm_storel_epi64(reinterpret_cast<__m128i*>(&out[16]), _mm256_extracti128_si256(pix, 1));
+}
+
+static inline __m256i _expand565(const uint16_t* in) {
+	/* Widen 8 pixels to BGRX */
+	__m256i pix = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in)));
+	__m256i r = _mm256_slli_epi32(_mm256_and_si256(pix, _mm256_set1_epi32(0xF800)), 8);
+	__m256i g = _mm256_slli_epi32(_mm256_and_si256(pix, _mm256_set1_epi32(0x07E0)), 5);
+	__m256i b = _mm256_slli_epi32(_mm256_and_si256(pix, _mm256_set1_epi32(0x001F)), 3);
+	return _mm256_or_si256(_mm256_or_si256(r, g), b);
+}
+
+static void image565To888(const uint16_t* in, uint8_t* out, size_t w, size_t h, size_t stride) {
+	for (size_t y = 0; y < h; ++y) {
+		size_t x = 0;
+		for (; x + 15 < w; x += 16) {
+			_storeBGRX(_expand565(&in[x]), &out[0]);
+			_storeBGRX(_expand565(&in[x + 8]), &out[24]);
+			out += 48;
+		}
+		if (x + 7 < w) {
+			_storeBGRX(_expand565(&in[x]), out);
+			out += 24;
+			x += 8;
+		}
+		out = convertRow565To888(&in[x], out, w - x);
+		in += stride / 2;
+	}
+}
+
+static void imageX888To888(const uint32_t* in, uint8_t* out, size_t w, size_t h, size_t stride) {
+	for (size_t y = 0; y < h; ++y) {
+		size_t x = 0;
+		for (; x + 15 < w; x += 16) {
+			_storeBGRX(_load(&in[x]), &out[0]);
+			_storeBGRX(_load(&in[x + 8]), &out[24]);
+			out += 48;
+		}
+		if (x + 7 < w) {
+			_storeBGRX(_load(&in[x]), out);
+			out += 24;
+			x += 8;
+		}
+		out = convertRowX888To888(&in[x], out, w - x);
+		in += stride / 4;
+	}
+}
+
+template<bool Mean>
+static inline __m256i _pool8(__m256i a, __m256i b) {
+	return Mean ? _mm256_avg_epu8(a, b) : _mm256_max_epu8(a, b);
+}
+
+template<bool Mean>
+static void imagePool565To888(const uint16_t* in, const uint16_t* old, uint8_t* out, size_t w, size_t h, size_t stride) {
+	for (size_t y = 0; y < h; ++y) {
+		size_t x = 0;
+		for (; x + 7 < w; x += 8) {
+			_storeBGRX(_pool8<Mean>(_expand565(&in[x]), _expand565(&old[x])), out);
+			out += 24;
+		}
+		out = poolRow565To888(&in[x], &old[x], out, w - x, Mean);
+		in += stride / 2;
+		old += stride / 2;
+	}
+}
+
+static void imagePool565To888(const uint16_t* in, const uint16_t* old, uint8_t* out, size_t w, size_t h, size_t stride, bool mean) {
+	if (mean) {
+		imagePool565To888<true>(in, old, out, w, h, stride);
+	} else {
+		imagePool565To888<false>(in, old, out, w, h, stride);
+	}
+}
+
+template<bool Mean>
+static void imagePoolX888To888(const uint32_t* in, const uint32_t* old, uint8_t* out, size_t w, size_t h, size_t stride) {
+	for (size_t y = 0; y < h; ++y) {
+		size_t x = 0;
+		for (; x + 7 < w; x += 8) {
+			_storeBGRX(_pool8<Mean>(_load(&in[x]), _load(&old[x])), out);
+			out += 24;
+		}
+		out = poolRowX888To888(&in[x], &old[x], out, w - x, Mean);
+		in += stride / 4;
+		old += stride / 4;
+	}
+}
+
+static void imagePoolX888To888(const uint32_t* in, const uint32_t* old, uint8_t* out, size_t w, size_t h, size_t stride, bool mean) {
+	if (mean) {
+		imagePoolX888To888<true>(in, old, out, w, h, stride);
+	} else {
+		imagePoolX888To888<false>(in, old, out, w, h, stride);
+	}
+}
+
+static inline __m256i _halve565(const uint16_t* in0, const uint16_t* in1) {
+	/* 16 pixels from two rows -> 8 grays */
+	__m256i out0 = _halveW16(_convert565ToGray(_load(in0)));
+	__m256i out1 = _halveW16(_convert565ToGray(_load(in1)));
+	return _mm256_avg_epu16(out0, out1);
+}
+
+static inline __m256i _halveX888(const uint32_t* in0, const uint32_t* in1) {
+	/* 16 pixels from two rows -> 8 grays */
+	__m256i out0 = _halveW16(_convertX888ToGray(in0));
+	__m256i out1 = _halveW16(_convertX888ToGray(in1));
+	return _mm256_avg_epu16(out0, out1);
+}
+
+static inline __m256i _quarter565(const uint16_t* in0, const uint16_t* in2) {
+	/* 32 pixels from two rows -> 8 grays */
+	__m256i out0 = _halveW16(_convert565ToGray(_neighbors16(_load(&in0[0]), _load(&in0[16]))));
+	__m256i out1 = _halveW16(_convert565ToGray(_neighbors16(_load(&in2[0]), _load(&in2[16]))));
+	return _mm256_avg_epu16(out0, out1);
+}
+
+static inline __m256i _quarterX888(const uint32_t* in0, const uint32_t* in2) {
+	/* 32 pixels from two rows -> 8 grays */
+	__m256i out0 = _halveW16(_neighbors16(_convertX888ToGray(&in0[0]), _convertX888ToGray(&in0[16])));
+	__m256i out1 = _halveW16(_neighbors16(_convertX888ToGray(&in2[0]), _convertX888ToGray(&in2[16])));
+	return _mm256_avg_epu16(out0, out1);
+}
+
+static void imageHalve565ToGray(const uint16_t* in, uint8_t* out, size_t w, size_t h, size_t stride) {
+	for (size_t y = 0; y + 1 < h; y += 2) {
+		const uint16_t* next = &in[stride / 2];
+		size_t x = 0;
+		for (; x + 31 < w; x += 32) {
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out), _pack32To8(_halve565(&in[x], &next[x]), _halve565(&in[x + 16], &next[x + 16])));
+			out += 16;
+		}
+		if (x + 15 < w) {
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(out), _pack32To8(_halve565(&in[x], &next[x]), _mm256_setzero_si256()));
+			out += 8;
+			x += 16;
+		}
+		out = halveRow565ToGray(&in[x], &next[x], out, w - x);
+		in += stride;
+	}
+}
+
+static void imageHalveX888ToGray(const uint32_t* in, uint8_t* out, size_t w, size_t h, size_t stride) {
+	for (size_t y = 0; y + 1 < h; y += 2) {
+		const uint32_t* next = &in[stride / 4];
+		size_t x = 0;
+		for (; x + 31 < w; x += 32) {
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out), _pack32To8(_halveX888(&in[x], &next[x]), _halveX888(&in[x + 16], &next[x + 16])));
+			out += 16;
+		}
+		if (x + 15 < w) {
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(out), _pack32To8(_halveX888(&in[x], &next[x]), _mm256_setzero_si256()));
+			out += 8;
+			x += 16;
+		}
+		out = halveRowX888ToGray(&in[x], &next[x], out, w - x);
+		in += stride / 2;
+	}
+}
+
+static void imageQuarter565ToGray(const uint16_t* in, uint8_t* out, size_t w, size_t h, size_t stride) {
+	for (size_t y = 0; y + 3 < h; y += 4) {
+		const uint16_t* next = &in[stride];
+		size_t x = 0;
+		for (; x + 63 < w; x += 64) {
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out), _pack32To8(_quarter565(&in[x], &next[x]), _quarter565(&in[x + 32], &next[x + 32])));
+			out += 16;
+		}
+		if (x + 31 < w) {
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(out), _pack32To8(_quarter565(&in[x], &next[x]), _mm256_setzero_si256()));
+			out += 8;
+			x += 32;
+		}
+		out = quarterRow565ToGray(&in[x], &next[x], out, w - x);
+		in += stride * 2;
+	}
+}
+
+static void imageQuarterX888ToGray(const uint32_t* in, uint8_t* out, size_t w, size_t h, size_t stride) {
+	for (size_t y = 0; y + 3 < h; y += 4) {
+		const uint32_t* next = &in[stride / 2];
+		size_t x = 0;
+		for (; x + 63 < w; x += 64) {
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out), _pack32To8(_quarterX888(&in[x], &next[x]), _quarterX888(&in[x + 32], &next[x + 32])));
+			out += 16;
+		}
+		if (x + 31 < w) {
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(out), _pack32To8(_quarterX888(&in[x], &next[x]), _mm256_setzero_si256()));
+			out += 8;
+			x += 32;
+		}
+		out = quarterRowX888ToGray(&in[x], &next[x], out, w - x);
+		in += stride;
+	}
+}
+
+static inline void _accumulate16(uint32_t* out, __m256i values, __m256i weight) {
+	/* Widen 16 values to 32 bits; multiplying against (weight, 0) pairs keeps them unsigned */
+	__m256i lo = _mm256_madd_epi16(_mm256_cvtepu16_epi32(_mm256_castsi256_si128(values)), weight);
+	__m256i hi = _mm256_madd_epi16(_mm256_cvtepu16_epi32(_mm256_extracti128_si256(values, 1)), weight);
+	_mm256_storeu_si256(reinterpret_cast<__m256i*>(&out[0]), _mm256_add_epi32(lo, _load(&out[0])));
+	_mm256_storeu_si256(reinterpret_cast<__m256i*>(&out[8]), _mm256_add_epi32(hi, _load(&out[8])));
+}
+
+static inline void _accumulateRGB16(uint32_t* out, size_t plane, __m256i r, __m256i g, __m256i b, __m256i weight, bool gray) {
+	if (gray) {
+		/* The weighted sum stays below 65536, so 16-bit lanes are enough */
+		__m256i y = _mm256_add_epi16(_mm256_mullo_epi16(r, _mm256_set1_epi16(77)), _mm256_mullo_epi16(g, _mm256_set1_epi16(150)));
+		y = _mm256_add_epi16(y, _mm256_mullo_epi16(b, _mm256_set1_epi16(29)));
+		y = _mm256_srli_epi16(_mm256_add_epi16(y, _mm256_set1_epi16(128)), 8);
+		_accumulate16(out, y, weight);
+	} else {
+		_accumulate16(out, r, weight);
+		_accumulate16(&out[plane], g, weight);
+		_accumulate16(&out[plane * 2], b, weight);
+	}
+}
+
+static inline __m256i _channel16(__m256i pix0, __m256i pix1, int shift) {
+	/* Pack one channel of 16 XRGB pixels into 16-bit lanes, in order */
+	const __m256i mask = _mm256_set1_epi32(0xFF);
+	__m256i lo = _mm256_and_si256(_mm256_srli_epi32(pix0, shift), mask);
+	__m256i hi = _mm256_and_si256(_mm256_srli_epi32(pix1, shift), mask);
+	return _mm256_permute4x64_epi64(_mm256_packus_epi32(lo, hi), 0xD8);
+}
+
+static void imageAccumulate565(const uint16_t* in, unsigned weight, uint32_t* out, size_t w, bool gray) {
+	const __m256i weights = _mm256_set1_epi32(weight);
+	size_t x = 0;
+	for (; x + 15 < w; x += 16) {
+		__m256i pix = _load(&in[x]);
+		__m256i r = _mm256_and_si256(_mm256_srli_epi16(pix, 8), _mm256_set1_epi16(0xF8));
+		__m256i g = _mm256_and_si256(_mm256_srli_epi16(pix, 3), _mm256_set1_epi16(0xFC));
+		__m256i b = _mm256_and_si256(_mm256_slli_epi16(pix, 3), _mm256_set1_epi16(0xF8));
+		_accumulateRGB16(&out[x], w, r, g, b, weights, gray);
+	}
+	accumulateRow565(&in[x], weight, &out[x], w - x, w, gray);
+}
+
+static void imageAccumulateX888(const uint32_t* in, unsigned weight, uint32_t* out, size_t w, bool gray) {
+	const __m256i weights = _mm256_set1_epi32(weight);
+	size_t x = 0;
+	for (; x + 15 < w; x += 16) {
+		__m256i pix0 = _load(&in[x]);
+		__m256i pix1 = _load(&in[x + 8]);
+		_accumulateRGB16(&out[x], w, _channel16(pix0, pix1, 16), _channel16(pix0, pix1, 8), _channel16(pix0, pix1, 0), weights, gray);
+	}
+	accumulateRowX888(&in[x], weight, &out[x], w - x, w, gray);
+}
+
+static const ImageKernelTable s_kernels{
+	image565To888,
+	imageX888To888,
+	imageHalve565ToGray,
+	imageHalveX888ToGray,
+	imageQuarter565ToGray,
+	imageQuarterX888ToGray,
+	imageAccumulate565,
+	imageAccumulateX888,
+	imagePool565To888,
+	imagePoolX888To888,
+};
+#endif
+
+const Retro::ImageKernelTable* Retro::avx2ImageKernels() {
+#ifdef __AVX2__
+	return &s_kernels;
+#else
+	return nullptr;
+#endif
+}
@@ -0,0 +1,330 @@
+#include "imageops-kernels.h"
+
+#if defined(__AVX512F__) && defined(__AVX512BW__)
+#include <immintrin.h>
+
+using namespace Retro;
+
+static inline __m512i _load(const void* in) {
+	return _mm512_loadu_si512(in);
+}
+
+static inline __m512i _convert565ToGray(__m512i pix) {
+	/* Mask out and normalize channels */
+	__m512i r = _mm512_srli_epi16(_mm512_and_si512(pix, _mm512_set1_epi16(0xF800)), 10);
+	__m512i g = _mm512_srli_epi16(_mm512_and_si512(pix, _mm512_set1_epi16(0x07E0)), 5);
+	__m512i b = _mm512_slli_epi16(_mm512_and_si512(pix, _mm512_set1_epi16(0x001F)), 1);
+	/* Combine channels */
+	return _mm512_add_epi16(_mm512_add_epi16(r, g), b);
+}
+
+static inline __m512i _convertX888ToGray(const uint32_t* in) {
+	/* Sum B, G and R of 32 pixels into 32-bit lanes */
+	const __m512i weights = _mm512_set1_epi32(0x00010101);
+	const __m512i ones = _mm512_set1_epi16(1);
+	__m512i gray0 = _load(&in[0]);
+	__m512i gray1 = _load(&in[16]);
+	gray0 = _mm512_srli_epi32(_mm512_madd_epi16(_mm512_maddubs_epi16(gray0, weights), ones), 2);
+	gray1 = _mm512_srli_epi32(_mm512_madd_epi16(_mm512_maddubs_epi16(gray1, weights), ones), 2);
+	/* Pack to 16-bit lanes; packing works per 128-bit lane, so put the quadwords back in order */
+	return _mm512_permutexvar_epi64(_mm512_set_epi64(7, 5, 3, 1, 6, 4, 2, 0), _mm512_packus_epi32(gray0, gray1));
+}
+
+static inline __m512i _neighbors16(__m512i a, __m512i b) {
+	/* Keep every other 16-bit lane of 64 */
+	const __m512i even = _mm512_set1_epi32(0xFFFF);
+	__m512i out = _mm512_packus_epi32(_mm512_and_si512(a, even), _mm512_and_si512(b, even));
+	return _mm512_permutexvar_epi64(_mm512_set_epi64(7, 5, 3, 1, 6, 4, 2, 0), out);
+}
+
+static inline __m512i _halveW16(__m512i gray) {
+	/* Average neighboring 16-bit lanes into 32-bit lanes */
+	__m512i even = _mm512_and_si512(gray, _mm512_set1_epi32(0xFFFF));
+	__m512i odd = _mm512_srli_epi32(gray, 16);
+	return _mm512_avg_epu16(even, odd);
+}
+
+static inline __m256i _pack32To8(__m512i a, __m512i b) {
+	/* A0-3 B0-3 | A4-7 B4-7 | A8-B B8-B | AC-F BC-F -> A0-F B0-F */
+	__m512i out = _mm512_packus_epi16(_mm512_packus_epi32(a, b), _mm512_setzero_si512());
+	out = _mm512_permutexvar_epi32(_mm512_set_epi32(15, 11, 7, 3, 14, 10, 6, 2, 13, 9, 5, 1, 12, 8, 4, 0), out);
+	return _mm512_castsi512_si256(out);
+}
+
+static inline void _storeBGRX(__m512i pix, uint8_t* out) {
+	/* Drop X and reverse each pixel within 128-bit lanes, then close the gaps between the lanes */
+	const __m512i blend = _mm512_set4_epi32(-1, 0x0C0D0E08, 0x090A0405, 0x06000102);
+	pix = _mm512_shuffle_epi8(pix, blend);
+	pix = _mm512_permutexvar_epi32(_mm512_set_epi32(15, 11, 7, 3, 14, 13, 12, 10, 9, 8, 6, 5, 4, 2, 1, 0), pix);
+	_mm512_mask_storeu_epi32(out, 0x0FFF, pix);
+}
+
+static inline __m512i _expand565(const uint16_t* in) {
+	/* Widen 16 pixels to BGRX */
+	__m512i pix = _mm512_cvtepu16_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(in)));
+	__m512i r = _mm512_slli_epi32(_mm512_and_si512(pix, _mm512_set1_epi32(0xF800)), 8);
+	__m512i g = _mm512_slli_epi32(_mm512_and_si512(pix, _mm512_set1_epi32(0x07E0)), 5);
+	__m512i b = _mm512_slli_epi32(_mm512_and_si512(pix, _mm512_set1_epi32(0x001F)), 3);
+	return _mm512_or_si512(_mm512_or_si512(r, g), b);
+}
+
+static void image565To888(const uint16_t* in, uint8_t* out, size_t w, size_t h, size_t stride) {
+	for (size_t y = 0; y < h; ++y) {
+		size_t x = 0;
+		for (; x + 31 < w; x += 32) {
+			_storeBGRX(_expand565(&in[x]), &out[0]);
+			_storeBGRX(_expand565(&in[x + 16]), &out[48]);
+			out += 96;
+		}
+		if (x + 15 < w) {
+			_storeBGRX(_expand565(&in[x]), out);
+			out += 48;
+			x += 16;
+		}
+		out = convertRow565To888(&in[x], out, w - x);
+		in += stride / 2;
+	}
+}
+
+static void imageX888To888(const uint32_t* in, uint8_t* out, size_t w, size_t h, size_t stride) {
+	for (size_t y = 0; y < h; ++y) {
+		size_t x = 0;
+		for (; x + 31 < w; x += 32) {
+			_storeBGRX(_load(&in[x]), &out[0]);
+			_storeBGRX(_load(&in[x + 16]), &out[48]);
+			out += 96;
+		}
+		if (x + 15 < w) {
+			_storeBGRX(_load(&in[x]), out);
+			out += 48;
+			x += 16;
+		}
+		out = convertRowX888To888(&in[x], out, w - x);
+		in += stride / 4;
+	}
+}
+
+template<bool Mean>
+static inline __m512i _pool8(__m512i a, __m512i b) {
+	return Mean ? _mm512_avg_epu8(a, b) : _mm512_max_epu8(a, b);
+}
+
+template<bool Mean>
+static void imagePool565To888(const uint16_t* in, const uint16_t* old, uint8_t* out, size_t w, size_t h, size_t stride) {
+	for (size_t y = 0; y < h; ++y) {
+		size_t x = 0;
+		for (; x + 15 < w; x += 16) {
+			_storeBGRX(_pool8<Mean>(_expand565(&in[x]), _expand565(&old[x])), out);
+			out += 48;
+		}
+		out = poolRow565To888(&in[x], &old[x], out, w - x, Mean);
+		in += stride / 2;
+		old += stride / 2;
+	}
+}
+
+static void imagePool565To888(const uint16_t* in, const uint16_t* old, uint8_t* out, size_t w, size_t h, size_t stride, bool mean) {
+	if (mean) {
+		imagePool565To888<true>(in, old, out, w, h, stride);
+	} else {
+		imagePool565To888<false>(in, old, out, w, h, stride);
+	}
+}
+
+template<bool Mean>
+static void imagePoolX888To888(const uint32_t* in, const uint32_t* old, uint8_t* out, size_t w, size_t h, size_t stride) {
+	for (size_t y = 0; y < h; ++y) {
+		size_t x = 0;
+		for (; x + 15 < w; x += 16) {
+			_storeBGRX(_pool8<Mean>(_load(&in[x]), _load(&old[x])), out);
+			out += 48;
+		}
+		out = poolRowX888To888(&in[x], &old[x], out, w - x, Mean);
+		in += stride / 4;
+		old += stride / 4;
+	}
+}
+
+static void imagePoolX888To888(const uint32_t* in, const uint32_t* old, uint8_t* out, size_t w, size_t h, size_t stride, bool mean) {
+	if (mean) {
+		imagePoolX888To888<true>(in, old, out, w, h, stride);
+	} else {
+		imagePoolX888To888<false>(in, old, out, w, h, stride);
+	}
+}
+
+static inline __m512i _halve565(const uint16_t* in0, const uint16_t* in1) {
+	/* 32 pixels from two rows -> 16 grays */
+	__m512i out0 = _halveW16(_convert565ToGray(_load(in0)));
+	__m512i out1 = _halveW16(_convert565ToGray(_load(in1)));
+	return _mm512_avg_epu16(out0, out1);
+}
+
+static inline __m512i _halveX888(const uint32_t* in0, const uint32_t* in1) {
+	/* 32 pixels from two rows -> 16 grays */
+	__m512i out0 = _halveW16(_convertX888ToGray(in0));
+	__m512i out1 = _halveW16(_convertX888ToGray(in1));
+	return _mm512_avg_epu16(out0, out1);
+}
+
+static inline __m512i _quarter565(const uint16_t* in0, const uint16_t* in2) {
+	/* 64 pixels from two rows -> 16 grays */
+	__m512i out0 = _halveW16(_convert565ToGray(_neighbors16(_load(&in0[0]), _load(&in0[32]))));
+	__m512i out1 = _halveW16(_convert565ToGray(_neighbors16(_load(&in2[0]), _load(&in2[32]))));
+	return _mm512_avg_epu16(out0, out1);
+}
+
+static inline __m512i _quarterX888(const uint32_t* in0, const uint32_t* in2) {
+	/* 64 pixels from two rows -> 16 grays */
+	__m512i out0 = _halveW16(_neighbors16(_convertX888ToGray(&in0[0]), _convertX888ToGray(&in0[32])));
+	__m512i out1 = _halveW16(_neighbors16(_convertX888ToGray(&in2[0]), _convertX888ToGray(&in2[32])));
+	return _mm512_avg_epu16(out0, out1);
+}
+
+static void imageHalve565ToGray(const uint16_t* in, uint8_t* out, size_t w, size_t h, size_t stride) {
+	for (size_t y = 0; y + 1 < h; y += 2) {
+		const uint16_t* next = &in[stride / 2];
+		size_t x = 0;
+		for (; x + 63 < w; x += 64) {
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(out), _pack32To8(_halve565(&in[x], &next[x]), _halve565(&in[x + 32], &next[x + 32])));
+			out += 32;
+		}
+		if (x + 31 < w) {
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm256_castsi256_si128(_pack32To8(_halve565(&in[x], &next[x]), _mm512_setzero_si512())));
+			out += 16;
+			x += 32;
+		}
+		out = halveRow565ToGray(&in[x], &next[x], out, w - x);
+		in += stride;
+	}
+}
+
+static void imageHalveX888ToGray(const uint32_t* in, uint8_t* out, size_t w, size_t h, size_t stride) {
+	for (size_t y = 0; y + 1 < h; y += 2) {
+		const uint32_t* next = &in[stride / 4];
+		size_t x = 0;
+		for (; x + 63 < w; x += 64) {
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(out), _pack32To8(_halveX888(&in[x], &next[x]), _halveX888(&in[x + 32], &next[x + 32])));
+			out += 32;
+		}
+		if (x + 31 < w) {
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm256_castsi256_si128(_pack32To8(_halveX888(&in[x], &next[x]), _mm512_setzero_si512())));
+			out += 16;
+			x += 32;
+		}
+		out = halveRowX888ToGray(&in[x], &next[x], out, w - x);
+		in += stride / 2;
+	}
+}
+
+static void imageQuarter565ToGray(const uint16_t* in, uint8_t* out, size_t w, size_t h, size_t stride) {
+	for (size_t y = 0; y + 3 < h; y += 4) {
+		const uint16_t* next = &in[stride];
+		size_t x = 0;
+		for (; x + 127 < w; x += 128) {
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(out), _pack32To8(_quarter565(&in[x], &next[x]), _quarter565(&in[x + 64], &next[x + 64])));
+			out += 32;
+		}
+		if (x + 63 < w) {
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm256_castsi256_si128(_pack32To8(_quarter565(&in[x], &next[x]), _mm512_setzero_si512())));
+			out += 16;
+			x += 64;
+		}
+		out = quarterRow565ToGray(&in[x], &next[x], out, w - x);
+		in += stride * 2;
+	}
+}
+
+static void imageQuarterX888ToGray(const uint32_t* in, uint8_t* out, size_t w, size_t h, size_t stride) {
+	for (size_t y = 0; y + 3 < h; y += 4) {
+		const uint32_t* next = &in[stride / 2];
+		size_t x = 0;
+		for (; x + 127 < w; x += 128) {
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(out), _pack32To8(_quarterX888(&in[x], &next[x]), _quarterX888(&in[x + 64], &next[x + 64])));
+			out += 32;
+		}
+		if (x + 63 < w) {
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm256_castsi256_si128(_pack32To8(_quarterX888(&in[x], &next[x]), _mm512_setzero_si512())));
+			out += 16;
+			x += 64;
+		}
+		out = quarterRowX888ToGray(&in[x], &next[x], out, w - x);
+		in += stride;
+	}
+}
+
+static inline void _accumulate16(uint32_t* out, __m512i values, __m512i weight) {
+	/* Widen 32 values to 32 bits; multiplying against (weight, 0) pairs keeps them unsigned */
+	__m512i lo = _mm512_madd_epi16(_mm512_cvtepu16_epi32(_mm512_castsi512_si256(values)), weight);
+	__m512i hi = _mm512_madd_epi16(_mm512_cvtepu16_epi32(_mm512_extracti64x4_epi64(values, 1)), weight);
+	_mm512_storeu_si512(&out[0], _mm512_add_epi32(lo, _load(&out[0])));
+	_mm512_storeu_si512(&out[16], _mm512_add_epi32(hi, _load(&out[16])));
+}
+
+static inline void _accumulateRGB16(uint32_t* out, size_t plane, __m512i r, __m512i g, __m512i b, __m512i weight, bool gray) {
+	if (gray) {
+		/* The weighted sum stays below 65536, so 16-bit lanes are enough */
+		__m512i y = _mm512_add_epi16(_mm512_mullo_epi16(r, _mm512_set1_epi16(77)), _mm512_mullo_epi16(g, _mm512_set1_epi16(150)));
+		y = _mm512_add_epi16(y, _mm512_mullo_epi16(b, _mm512_set1_epi16(29)));
+		y = _mm512_srli_epi16(_mm512_add_epi16(y, _mm512_set1_epi16(128)), 8);
+		_accumulate16(out, y, weight);
+	} else {
+		_accumulate16(out, r, weight);
+		_accumulate16(&out[plane], g, weight);
+		_accumulate16(&out[plane * 2], b, weight);
+	}
+}
+
+static inline __m512i _channel16(__m512i pix0, __m512i pix1, int shift) {
+	/* Pack one channel of 32 XRGB pixels into 16-bit lanes, in order */
+	const __m512i mask = _mm512_set1_epi32(0xFF);
+	__m512i lo = _mm512_and_si512(_mm512_srli_epi32(pix0, shift), mask);
+	__m512i hi = _mm512_and_si512(_mm512_srli_epi32(pix1, shift), mask);
+	return _mm512_permutexvar_epi64(_mm512_set_epi64(7, 5, 3, 1, 6, 4, 2, 0), _mm512_packus_epi32(lo, hi));
+}
+
+static void imageAccumulate565(const uint16_t* in, unsigned weight, uint32_t* out, size_t w, bool gray) {
+	const __m512i weights = _mm512_set1_epi32(weight);
+	size_t x = 0;
+	for (; x + 31 < w; x += 32) {
+		__m512i pix = _load(&in[x]);
+		__m512i r = _mm512_and_si512(_mm512_srli_epi16(pix, 8), _mm512_set1_epi16(0xF8));
+		__m512i g = _mm512_and_si512(_mm512_srli_epi16(pix, 3), _mm512_set1_epi16(0xFC));
+		__m512i b = _mm512_and_si512(_mm512_slli_epi16(pix, 3), _mm512_set1_epi16(0xF8));
+		_accumulateRGB16(&out[x], w, r, g, b, weights, gray);
+	}
+	accumulateRow565(&in[x], weight, &out[x], w - x, w, gray);
+}
+
+static void imageAccumulateX888(const uint32_t* in, unsigned weight, uint32_t* out, size_t w, bool gray) {
+	const __m512i weights = _mm512_set1_epi32(weight);
+	size_t x = 0;
+	for (; x + 31 < w; x += 32) {
+		__m512i pix0 = _load(&in[x]);
+		__m512i pix1 = _load(&in[x + 16]);
+		_accumulateRGB16(&out[x], w, _channel16(pix0, pix1, 16), _channel16(pix0, pix1, 8), _channel16(pix0, pix1, 0), weights, gray);
+	}
+	accumulateRowX888(&in[x], weight, &out[x], w - x, w, gray);
+}
+
+static const ImageKernelTable s_kernels{
+	image565To888,
+	imageX888To888,
+	imageHalve565ToGray,
+	imageHalveX888ToGray,
+	imageQuarter565ToGray,
+	imageQuarterX888ToGray,
+	imageAccumulate565,
+	imageAccumulateX888,
+	imagePool565To888,
+	imagePoolX888To888,
+};
+#endif
+
+const Retro::ImageKernelTable* Retro::avx512ImageKernels() {
+#if defined(__AVX512F__) && defined(__AVX512BW__)
+	return &s_kernels;
+#else
+	return nullptr;
+#endif
+}
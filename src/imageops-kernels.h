@@ -0,0 +1,163 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+namespace Retro {
+
+struct ImageKernelTable {
+	void (*image565To888)(const uint16_t* in, uint8_t* out, size_t w, size_t h, size_t stride);
+	void (*imageX888To888)(const uint32_t* in, uint8_t* out, size_t w, size_t h, size_t stride);
+	void (*imageHalve565ToGray)(const uint16_t* in, uint8_t* out, size_t w, size_t h, size_t stride);
+	void (*imageHalveX888ToGray)(const uint32_t* in, uint8_t* out, size_t w, size_t h, size_t stride);
+	void (*imageQuarter565ToGray)(const uint16_t* in, uint8_t* out, size_t w, size_t h, size_t stride);
+	void (*imageQuarterX888ToGray)(const uint32_t* in, uint8_t* out, size_t w, size_t h, size_t stride);
+	void (*imageAccumulate565)(const uint16_t* in, unsigned weight, uint32_t* out, size_t w, bool gray);
+	void (*imageAccumulateX888)(const uint32_t* in, unsigned weight, uint32_t* out, size_t w, bool gray);
+	void (*imagePool565To888)(const uint16_t* in, const uint16_t* old, uint8_t* out, size_t w, size_t h, size_t stride, bool mean);
+	void (*imagePoolX888To888)(const uint32_t* in, const uint32_t* old, uint8_t* out, size_t w, size_t h, size_t stride, bool mean);
+};
+
+/* Resampling weights are fixed point with this many fractional bits, so that
+ * every kernel set accumulates exactly the same sums */
+static const unsigned RESAMPLE_WEIGHT_BITS = 14;
+
+/* Each of these lives in a translation unit built for its instruction set and
+ * returns nullptr when the build didn't enable that instruction set. They
+ * don't check the CPU; that has to happen in code built for the baseline. */
+const ImageKernelTable* avx2ImageKernels();
+const ImageKernelTable* avx512ImageKernels();
+const ImageKernelTable* neonImageKernels();
+
+/* Scalar reference for the vector kernels, which every kernel set uses for the
+ * columns its vector loop doesn't cover. These are static so that each
+ * translation unit keeps a copy built with its own instruction set. */
+static inline unsigned gray565(uint16_t rgb) {
+	return ((rgb & 0xF800) >> 10) + ((rgb & 0x07E0) >> 5) + ((rgb & 0x001F) << 1);
+}
+
+static inline unsigned grayX888(uint32_t xrgb) {
+	return (((xrgb >> 16) & 0xFF) + ((xrgb >> 8) & 0xFF) + (xrgb & 0xFF)) >> 2;
+}
+
+/* ITU-R BT.601 luma, the same weights as OpenCV's RGB to gray conversion */
+static inline unsigned luma(unsigned r, unsigned g, unsigned b) {
+	return (r * 77 + g * 150 + b * 29 + 128) >> 8;
+}
+
+static inline unsigned average(unsigned a, unsigned b) {
+	return (a + b + 1) >> 1;
+}
+
+/* Combines a channel of two frames by their maximum or rounded mean */
+static inline unsigned pool(unsigned a, unsigned b, bool mean) {
+	return mean ? average(a, b) : a > b ? a : b;
+}
+
+static inline uint8_t* convertRow565To888(const uint16_t* in, uint8_t* out, size_t w) {
+	for (size_t x = 0; x < w; ++x) {
+		uint16_t rgb = in[x];
+		out[0] = (rgb & 0xF800) >> 8;
+		out[1] = (rgb & 0x07E0) >> 3;
+		out[2] = (rgb & 0x001F) << 3;
+		out += 3;
+	}
+	return out;
+}
+
+static inline uint8_t* convertRowX888To888(const uint32_t* in, uint8_t* out, size_t w) {
+	for (size_t x = 0; x < w; ++x) {
+		uint32_t xrgb = in[x];
+		out[0] = xrgb >> 16;
+		out[1] = xrgb >> 8;
+		out[2] = xrgb;
+		out += 3;
+	}
+	return out;
+}
+
+static inline uint8_t* poolRow565To888(const uint16_t* in, const uint16_t* old, uint8_t* out, size_t w, bool mean) {
+	for (size_t x = 0; x < w; ++x) {
+		out[0] = pool((in[x] & 0xF800) >> 8, (old[x] & 0xF800) >> 8, mean);
+		out[1] = pool((in[x] & 0x07E0) >> 3, (old[x] & 0x07E0) >> 3, mean);
+		out[2] = pool((in[x] & 0x001F) << 3, (old[x] & 0x001F) << 3, mean);
+		out += 3;
+	}
+	return out;
+}
+
+static inline uint8_t* poolRowX888To888(const uint32_t* in, const uint32_t* old, uint8_t* out, size_t w, bool mean) {
+	for (size_t x = 0; x < w; ++x) {
+		out[0] = pool((in[x] >> 16) & 0xFF, (old[x] >> 16) & 0xFF, mean);
+		out[1] = pool((in[x] >> 8) & 0xFF, (old[x] >> 8) & 0xFF, mean);
+		out[2] = pool(in[x] & 0xFF, old[x] & 0xFF, mean);
+		out += 3;
+	}
+	return out;
+}
+
+static inline uint8_t* halveRow565ToGray(const uint16_t* in0, const uint16_t* in1, uint8_t* out, size_t w) {
+	for (size_t x = 0; x + 1 < w; x += 2) {
+		*out = average(average(gray565(in0[x]), gray565(in0[x + 1])), average(gray565(in1[x]), gray565(in1[x + 1])));
+		++out;
+	}
+	return out;
+}
+
+static inline uint8_t* halveRowX888ToGray(const uint32_t* in0, const uint32_t* in1, uint8_t* out, size_t w) {
+	for (size_t x = 0; x + 1 < w; x += 2) {
+		*out = average(average(grayX888(in0[x]), grayX888(in0[x + 1])), average(grayX888(in1[x]), grayX888(in1[x + 1])));
+		++out;
+	}
+	return out;
+}
+
+/* Quartering samples the top left pixel of each 2x2 quad in a 4x4 block */
+static inline uint8_t* quarterRow565ToGray(const uint16_t* in0, const uint16_t* in2, uint8_t* out, size_t w) {
+	for (size_t x = 0; x + 3 < w; x += 4) {
+		*out = average(average(gray565(in0[x]), gray565(in0[x + 2])), average(gray565(in2[x]), gray565(in2[x + 2])));
+		++out;
+	}
+	return out;
+}
+
+static inline uint8_t* quarterRowX888ToGray(const uint32_t* in0, const uint32_t* in2, uint8_t* out, size_t w) {
+	for (size_t x = 0; x + 3 < w; x += 4) {
+		*out = average(average(grayX888(in0[x]), grayX888(in0[x + 2])), average(grayX888(in2[x]), grayX888(in2[x + 2])));
+		++out;
+	}
+	return out;
+}
+
+/* Adds a weighted source row to planar sums: a single plane of luma, or planes
+ * of red, green and blue that are `plane` values apart */
+static inline void accumulateRow565(const uint16_t* in, unsigned weight, uint32_t* out, size_t w, size_t plane, bool gray) {
+	for (size_t x = 0; x < w; ++x) {
+		unsigned r = (in[x] & 0xF800) >> 8;
+		unsigned g = (in[x] & 0x07E0) >> 3;
+		unsigned b = (in[x] & 0x001F) << 3;
+		if (gray) {
+			out[x] += luma(r, g, b) * weight;
+		} else {
+			out[x] += r * weight;
+			out[x + plane] += g * weight;
+			out[x + plane * 2] += b * weight;
+		}
+	}
+}
+
+static inline void accumulateRowX888(const uint32_t* in, unsigned weight, uint32_t* out, size_t w, size_t plane, bool gray) {
+	for (size_t x = 0; x < w; ++x) {
+		unsigned r = (in[x] >> 16) & 0xFF;
+		unsigned g = (in[x] >> 8) & 0xFF;
+		unsigned b = in[x] & 0xFF;
+		if (gray) {
+			out[x] += luma(r, g, b) * weight;
+		} else {
+			out[x] += r * weight;
+			out[x + plane] += g * weight;
+			out[x + plane * 2] += b * weight;
+		}
+	}
+}
+}
@@ -0,0 +1,280 @@
+#include "imageops-kernels.h"
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+
+using namespace Retro;
+
+static inline uint16x8_t _convert565ToGray(uint16x8_t pix) {
+	/* Mask out and normalize channels */
+	uint16x8_t r = vshrq_n_u16(vandq_u16(pix, vdupq_n_u16(0xF800)), 10);
+	uint16x8_t g = vshrq_n_u16(vandq_u16(pix, vdupq_n_u16(0x07E0)), 5);
+	uint16x8_t b = vshlq_n_u16(vandq_u16(pix, vdupq_n_u16(0x001F)), 1);
+	/* Combine channels */
+	return vaddq_u16(vaddq_u16(r, g), b);
+}
+
+static inline uint16x8x2_t _convertX888ToGray(const uint32_t* in) {
+	/* Deinterleave 16 pixels into B, G, R and X */
+	uint8x16x4_t pix = vld4q_u8(reinterpret_cast<const uint8_t*>(in));
+	uint16x8x2_t gray;
+	gray.val[0] = vaddw_u8(vaddl_u8(vget_low_u8(pix.val[0]), vget_low_u8(pix.val[1])), vget_low_u8(pix.val[2]));
+	gray.val[1] = vaddw_high_u8(vaddl_high_u8(pix.val[0], pix.val[1]), pix.val[2]);
+	gray.val[0] = vshrq_n_u16(gray.val[0], 2);
+	gray.val[1] = vshrq_n_u16(gray.val[1], 2);
+	return gray;
+}
+
+static inline uint8x16x3_t _expand565(const uint16_t* in) {
+	/* Split 16 pixels into R, G and B */
+	uint16x8_t pix0 = vld1q_u16(&in[0]);
+	uint16x8_t pix1 = vld1q_u16(&in[8]);
+	uint8x16x3_t rgb;
+	rgb.val[0] = vandq_u8(vcombine_u8(vshrn_n_u16(pix0, 8), vshrn_n_u16(pix1, 8)), vdupq_n_u8(0xF8));
+	rgb.val[1] = vandq_u8(vcombine_u8(vshrn_n_u16(pix0, 3), vshrn_n_u16(pix1, 3)), vdupq_n_u8(0xFC));
+	rgb.val[2] = vcombine_u8(vmovn_u16(vshlq_n_u16(pix0, 3)), vmovn_u16(vshlq_n_u16(pix1, 3)));
+	return rgb;
+}
+
+static void image565To888(const uint16_t* in, uint8_t* out, size_t w, size_t h, size_t stride) {
+	for (size_t y = 0; y < h; ++y) {
+		size_t x = 0;
+		for (; x + 15 < w; x += 16) {
+			vst3q_u8(out, _expand565(&in[x]));
+			out += 48;
+		}
+		out = convertRow565To888(&in[x], out, w - x);
+		in += stride / 2;
+	}
+}
+
+static void imageX888To888(const uint32_t* in, uint8_t* out, size_t w, size_t h, size_t stride) {
+	for (size_t y = 0; y < h; ++y) {
+		size_t x = 0;
+		for (; x + 15 < w; x += 16) {
+			uint8x16x4_t pix = vld4q_u8(reinterpret_cast<const uint8_t*>(&in[x]));
+			uint8x16x3_t rgb;
+			rgb.val[0] = pix.val[2];
+			rgb.val[1] = pix.val[1];
+			rgb.val[2] = pix.val[0];
+			vst3q_u8(out, rgb);
+			out += 48;
+		}
+		out = convertRowX888To888(&in[x], out, w - x);
+		in += stride / 4;
+	}
+}
+
+template<bool Mean>
+static inline uint8x16_t _pool8(uint8x16_t a, uint8x16_t b) {
+	return Mean ? vrhaddq_u8(a, b) : vmaxq_u8(a, b);
+}
+
+template<bool Mean>
+static void imagePool565To888(const uint16_t* in, const uint16_t* old, uint8_t* out, size_t w, size_t h, size_t stride) {
+	for (size_t y = 0; y < h; ++y) {
+		size_t x = 0;
+		for (; x + 15 < w; x += 16) {
+			uint8x16x3_t rgb = _expand565(&in[x]);
+			uint8x16x3_t oldRgb = _expand565(&old[x]);
+			for (int c = 0; c < 3; ++c) {
+				rgb.val[c] = _pool8<Mean>(rgb.val[c], oldRgb.val[c]);
+			}
+			vst3q_u8(out, rgb);
+			out += 48;
+		}
+		out = poolRow565To888(&in[x], &old[x], out, w - x, Mean);
+		in += stride / 2;
+		old += stride / 2;
+	}
+}
+
+static void imagePool565To888(const uint16_t* in, const uint16_t* old, uint8_t* out, size_t w, size_t h, size_t stride, bool mean) {
+	if (mean) {
+		imagePool565To888<true>(in, old, out, w, h, stride);
+	} else {
+		imagePool565To888<false>(in, old, out, w, h, stride);
+	}
+}
+
+template<bool Mean>
+static void imagePoolX888To888(const uint32_t* in, const uint32_t* old, uint8_t* out, size_t w, size_t h, size_t stride) {
+	for (size_t y = 0; y < h; ++y) {
+		size_t x = 0;
+		for (; x + 15 < w; x += 16) {
+			uint8x16x4_t pix = vld4q_u8(reinterpret_cast<const uint8_t*>(&in[x]));
+			uint8x16x4_t oldPix = vld4q_u8(reinterpret_cast<const uint8_t*>(&old[x]));
+			uint8x16x3_t rgb;
+			rgb.val[0] = _pool8<Mean>(pix.val[2], oldPix.val[2]);
+			rgb.val[1] = _pool8<Mean>(pix.val[1], oldPix.val[1]);
+			rgb.val[2] = _pool8<Mean>(pix.val[0], oldPix.val[0]);
+			vst3q_u8(out, rgb);
+			out += 48;
+		}
+		out = poolRowX888To888(&in[x], &old[x], out, w - x, Mean);
+		in += stride / 4;
+		old += stride / 4;
+	}
+}
+
+static void imagePoolX888To888(const uint32_t* in, const uint32_t* old, uint8_t* out, size_t w, size_t h, size_t stride, bool mean) {
+	if (mean) {
+		imagePoolX888To888<true>(in, old, out, w, h, stride);
+	} else {
+		imagePoolX888To888<false>(in, old, out, w, h, stride);
+	}
+}
+
+static inline uint16x8_t _halve565(const uint16_t* in) {
+	/* Average 8 pairs of neighboring pixels */
+	uint16x8x2_t pix = vld2q_u16(in);
+	return vrhaddq_u16(_convert565ToGray(pix.val[0]), _convert565ToGray(pix.val[1]));
+}
+
+static void imageHalve565ToGray(const uint16_t* in, uint8_t* out, size_t w, size_t h, size_t stride) {
+	for (size_t y = 0; y + 1 < h; y += 2) {
+		const uint16_t* in1 = &in[stride / 2];
+		size_t x = 0;
+		for (; x + 31 < w; x += 32) {
+			// Halve height
+			uint16x8_t out0 = vrhaddq_u16(_halve565(&in[x]), _halve565(&in1[x]));
+			uint16x8_t out1 = vrhaddq_u16(_halve565(&in[x + 16]), _halve565(&in1[x + 16]));
+			vst1q_u8(out, vcombine_u8(vqmovn_u16(out0), vqmovn_u16(out1)));
+			out += 16;
+		}
+		out = halveRow565ToGray(&in[x], &in1[x], out, w - x);
+		in += stride;
+	}
+}
+
+static inline uint16x8_t _halveX888(const uint32_t* in) {
+	/* Average 8 pairs of neighboring pixels */
+	uint16x8x2_t gray = _convertX888ToGray(in);
+	return vrhaddq_u16(vuzp1q_u16(gray.val[0], gray.val[1]), vuzp2q_u16(gray.val[0], gray.val[1]));
+}
+
+static void imageHalveX888ToGray(const uint32_t* in, uint8_t* out, size_t w, size_t h, size_t stride) {
+	for (size_t y = 0; y + 1 < h; y += 2) {
+		const uint32_t* in1 = &in[stride / 4];
+		size_t x = 0;
+		for (; x + 31 < w; x += 32) {
+			// Halve height
+			uint16x8_t out0 = vrhaddq_u16(_halveX888(&in[x]), _halveX888(&in1[x]));
+			uint16x8_t out1 = vrhaddq_u16(_halveX888(&in[x + 16]), _halveX888(&in1[x + 16]));
+			vst1q_u8(out, vcombine_u8(vqmovn_u16(out0), vqmovn_u16(out1)));
+			out += 16;
+		}
+		out = halveRowX888ToGray(&in[x], &in1[x], out, w - x);
+		in += stride / 2;
+	}
+}
+
+static inline uint16x8_t _quarter565(const uint16_t* in) {
+	/* Average the first and third pixel of 8 groups of 4 */
+	uint16x8x4_t pix = vld4q_u16(in);
+	return vrhaddq_u16(_convert565ToGray(pix.val[0]), _convert565ToGray(pix.val[2]));
+}
+
+static void imageQuarter565ToGray(const uint16_t* in, uint8_t* out, size_t w, size_t h, size_t stride) {
+	for (size_t y = 0; y + 3 < h; y += 4) {
+		const uint16_t* in2 = &in[stride];
+		size_t x = 0;
+		for (; x + 63 < w; x += 64) {
+			// Halve height
+			uint16x8_t out0 = vrhaddq_u16(_quarter565(&in[x]), _quarter565(&in2[x]));
+			uint16x8_t out1 = vrhaddq_u16(_quarter565(&in[x + 32]), _quarter565(&in2[x + 32]));
+			vst1q_u8(out, vcombine_u8(vqmovn_u16(out0), vqmovn_u16(out1)));
+			out += 16;
+		}
+		out = quarterRow565ToGray(&in[x], &in2[x], out, w - x);
+		in += stride * 2;
+	}
+}
+
+static inline uint16x8_t _quarterX888(const uint32_t* in) {
+	/* Average the first and third pixel of 8 groups of 4 */
+	uint16x8x2_t gray0 = _convertX888ToGray(&in[0]);
+	uint16x8x2_t gray1 = _convertX888ToGray(&in[16]);
+	uint16x8_t even0 = vuzp1q_u16(gray0.val[0], gray0.val[1]);
+	uint16x8_t even1 = vuzp1q_u16(gray1.val[0], gray1.val[1]);
+	return vrhaddq_u16(vuzp1q_u16(even0, even1), vuzp2q_u16(even0, even1));
+}
+
+static void imageQuarterX888ToGray(const uint32_t* in, uint8_t* out, size_t w, size_t h, size_t stride) {
+	for (size_t y = 0; y + 3 < h; y += 4) {
+		const uint32_t* in2 = &in[stride / 2];
+		size_t x = 0;
+		for (; x + 63 < w; x += 64) {
+			// Halve height
+			uint16x8_t out0 = vrhaddq_u16(_quarterX888(&in[x]), _quarterX888(&in2[x]));
+			uint16x8_t out1 = vrhaddq_u16(_quarterX888(&in[x + 32]), _quarterX888(&in2[x + 32]));
+			vst1q_u8(out, vcombine_u8(vqmovn_u16(out0), vqmovn_u16(out1)));
+			out += 16;
+		}
+		out = quarterRowX888ToGray(&in[x], &in2[x], out, w - x);
+		in += stride;
+	}
+}
+
+static inline void _accumulate16(uint32_t* out, uint16x8_t values, uint16_t weight) {
+	vst1q_u32(&out[0], vmlal_n_u16(vld1q_u32(&out[0]), vget_low_u16(values), weight));
+	vst1q_u32(&out[4], vmlal_n_u16(vld1q_u32(&out[4]), vget_high_u16(values), weight));
+}
+
+static inline void _accumulateRGB16(uint32_t* out, size_t plane, uint16x8_t r, uint16x8_t g, uint16x8_t b, uint16_t weight, bool gray) {
+	if (gray) {
+		/* The weighted sum stays below 65536, so 16-bit lanes are enough */
+		uint16x8_t y = vmlaq_n_u16(vmlaq_n_u16(vmulq_n_u16(r, 77), g, 150), b, 29);
+		y = vshrq_n_u16(vaddq_u16(y, vdupq_n_u16(128)), 8);
+		_accumulate16(out, y, weight);
+	} else {
+		_accumulate16(out, r, weight);
+		_accumulate16(&out[plane], g, weight);
+		_accumulate16(&out[plane * 2], b, weight);
+	}
+}
+
+static void imageAccumulate565(const uint16_t* in, unsigned weight, uint32_t* out, size_t w, bool gray) {
+	size_t x = 0;
+	for (; x + 7 < w; x += 8) {
+		uint16x8_t pix = vld1q_u16(&in[x]);
+		uint16x8_t r = vandq_u16(vshrq_n_u16(pix, 8), vdupq_n_u16(0xF8));
+		uint16x8_t g = vandq_u16(vshrq_n_u16(pix, 3), vdupq_n_u16(0xFC));
+		uint16x8_t b = vandq_u16(vshlq_n_u16(pix, 3), vdupq_n_u16(0xF8));
+		_accumulateRGB16(&out[x], w, r, g, b, weight, gray);
+	}
+	accumulateRow565(&in[x], weight, &out[x], w - x, w, gray);
+}
+
+static void imageAccumulateX888(const uint32_t* in, unsigned weight, uint32_t* out, size_t w, bool gray) {
+	size_t x = 0;
+	for (; x + 15 < w; x += 16) {
+		/* B, G, R and X planes of 16 pixels */
+		uint8x16x4_t pix = vld4q_u8(reinterpret_cast<const uint8_t*>(&in[x]));
+		_accumulateRGB16(&out[x], w, vmovl_u8(vget_low_u8(pix.val[2])), vmovl_u8(vget_low_u8(pix.val[1])), vmovl_u8(vget_low_u8(pix.val[0])), weight, gray);
+		_accumulateRGB16(&out[x + 8], w, vmovl_high_u8(pix.val[2]), vmovl_high_u8(pix.val[1]), vmovl_high_u8(pix.val[0]), weight, gray);
+	}
+	accumulateRowX888(&in[x], weight, &out[x], w - x, w, gray);
+}
+
+static const ImageKernelTable s_kernels{
+	image565To888,
+	imageX888To888,
+	imageHalve565ToGray,
+	imageHalveX888ToGray,
+	imageQuarter565ToGray,
+	imageQuarterX888ToGray,
+	imageAccumulate565,
+	imageAccumulateX888,
+	imagePool565To888,
+	imagePoolX888To888,
+};
+#endif
+
+const Retro::ImageKernelTable* Retro::neonImageKernels() {
+#if defined(__ARM_NEON) && defined(__aarch64__)
+	return &s_kernels;
+#else
+	return nullptr;
+#endif
+}
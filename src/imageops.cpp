@@ -1,25 +1,22 @@
 #include "imageops.h"
+#include "imageops-kernels.h"
 
 #ifdef __SSSE3__
 #include <emmintrin.h>
 #include <tmmintrin.h>
 #endif
+#include <atomic>
 #include <stdexcept>
 #include <cstring>
+#include <vector>
 
 using namespace Retro;
 using namespace std;
 
-static void imageHalve565ToGray(const uint16_t* in, uint8_t* out, size_t w, size_t h, size_t stride);
 static void imageHalve565ToGrayInterlace(const uint16_t* in, const uint16_t* oldin, uint16_t* out, size_t w, size_t h, size_t stride);
-static void imageQuarter565ToGray(const uint16_t* in, uint8_t* out, size_t w, size_t h, size_t stride);
 static void imageQuarter565ToGrayInterlace(const uint16_t* in, const uint16_t* oldin, uint16_t* out, size_t w, size_t h, size_t stride);
-static void image565To888(const uint16_t* in, uint8_t* out, size_t w, size_t h, size_t stride);
-static void imageHalveX888ToGray(const uint32_t* in, uint8_t* out, size_t w, size_t h, size_t stride);
 static void imageHalveX888ToGrayInterlace(const uint32_t* in, const uint16_t* oldin, uint16_t* out, size_t w, size_t h, size_t stride);
-static void imageQuarterX888ToGray(const uint32_t* in, uint8_t* out, size_t w, size_t h, size_t stride);
 static void imageQuarterX888ToGrayInterlace(const uint32_t* in, const uint16_t* oldin, uint16_t* out, size_t w, size_t h, size_t stride);
-static void imageX888To888(const uint32_t* in, uint8_t* out, size_t w, size_t h, size_t stride);
 
 #ifdef __SSSE3__
 const static __m128i maskR16 = _mm_set1_epi16(0xF800);
@@ -43,22 +40,7 @@ static inline __m128i _convert565ToGray(__m128i pix) {
 	r = _mm_add_epi16(r, b);
 	return r;
 }
-#endif
-
-static inline uint8_t _convert565ToGray(uint16_t a, uint16_t b) {
-	uint32_t ab = a | (b << 16);
-	uint32_t r0 = ab & 0xF800F800;
-	uint32_t g0 = ab & 0x07E007E0;
-	uint32_t b0 = ab & 0x001F001F;
-	r0 >>= 10;
-	g0 >>= 5;
-	b0 <<= 1;
-	ab = r0 + g0 + b0;
-	ab += ab >> 16;
-	return ab / 2;
-}
 
-#ifdef __SSSE3__
 static inline __m128i _convertX888ToGray(__m128i pix) {
 	/* Mask out channels */
 	__m128i r = _mm_shuffle_epi8(pix, maskR32);
@@ -70,25 +52,7 @@ static inline __m128i _convertX888ToGray(__m128i pix) {
 	r = _mm_srli_epi16(r, 2);
 	return r;
 }
-#endif
-
-static inline uint8_t _convertX888ToGray(uint32_t a, uint32_t b) {
-	uint32_t r0 = a & 0x00FF0000;
-	uint32_t g0 = a & 0x0000FF00;
-	uint32_t b0 = a & 0x000000FF;
-	uint32_t r1 = b & 0x00FF0000;
-	uint32_t g1 = b & 0x0000FF00;
-	uint32_t b1 = b & 0x000000FF;
-	r0 += r1;
-	g0 += g1;
-	b0 += b1;
-	r0 >>= 16;
-	g0 >>= 8;
-	r0 = r0 + g0 + b0;
-	return r0 / 8;
-}
 
-#ifdef __SSSE3__
 static inline __m128i _halveW16(__m128i a, __m128i b) {
 	/* Swizzle ABCDEFGH IJKLMNOP to ACEGIKMO BDFHJLNP */
 	__m128i tmp0;
@@ -136,10 +100,10 @@ static inline __m128i _halveWNeighbor32(__m128i a, __m128i b) {
 }
 #endif
 
-void imageHalve565ToGray(const uint16_t* in, uint8_t* out, size_t w, size_t h, size_t stride) {
+#ifdef __SSSE3__
+static void imageHalve565ToGray(const uint16_t* in, uint8_t* out, size_t w, size_t h, size_t stride) {
 	for (size_t y = 0; y + 1 < h; y += 2) {
 		size_t x = 0;
-#ifdef __SSSE3__
 		for (; x + 15 < w; x += 16) {
 			__m128i gray0;
 			__m128i gray1;
@@ -158,16 +122,11 @@ void imageHalve565ToGray(const uint16_t* in, uint8_t* out, size_t w, size_t h, s
 			_mm_storel_epi64(reinterpret_cast<__m128i*>(out), out0);
 			out += 8;
 		}
-#endif
-		for (; x < w; x += 2) {
-			unsigned gray0 = _convert565ToGray(in[x], in[x + 1]);
-			unsigned gray1 = _convert565ToGray(in[x + stride / 2], in[x + stride / 2 + 1]);
-			*out = (gray0 + gray1) / 2;
-			++out;
-		}
+		out = halveRow565ToGray(&in[x], &in[x + stride / 2], out, w - x);
 		in += stride;
 	}
 }
+#endif
 
 void imageHalve565ToGrayInterlace(const uint16_t* in, const uint16_t* oldin, uint16_t* out, size_t w, size_t h, size_t stride) {
 	for (size_t y = 0; y + 1 < h; y += 2) {
@@ -197,10 +156,10 @@ void imageHalve565ToGrayInterlace(const uint16_t* in, const uint16_t* oldin, uin
 			out += 8;
 		}
 #endif
-		for (; x < w; x += 2) {
-			unsigned gray0 = _convert565ToGray(in[x], in[x + 1]);
-			unsigned gray1 = _convert565ToGray(in[x + stride / 2], in[x + stride / 2 + 1]);
-			gray0 = (gray0 + gray1) / 2;
+		for (; x + 1 < w; x += 2) {
+			unsigned gray0 = average(gray565(in[x]), gray565(in[x + 1]));
+			unsigned gray1 = average(gray565(in[x + stride / 2]), gray565(in[x + stride / 2 + 1]));
+			gray0 = average(gray0, gray1);
 			gray0 |= *oldin << 8;
 			*out = gray0;
 			++oldin;
@@ -210,10 +169,10 @@ void imageHalve565ToGrayInterlace(const uint16_t* in, const uint16_t* oldin, uin
 	}
 }
 
-void imageQuarter565ToGray(const uint16_t* in, uint8_t* out, size_t w, size_t h, size_t stride) {
+#ifdef __SSSE3__
+static void imageQuarter565ToGray(const uint16_t* in, uint8_t* out, size_t w, size_t h, size_t stride) {
 	for (size_t y = 0; y + 3 < h; y += 4) {
 		size_t x = 0;
-#ifdef __SSSE3__
 		for (; x + 31 < w; x += 32) {
 			__m128i gray0;
 			__m128i gray1;
@@ -236,16 +195,11 @@ void imageQuarter565ToGray(const uint16_t* in, uint8_t* out, size_t w, size_t h,
 			_mm_storel_epi64(reinterpret_cast<__m128i*>(out), out0);
 			out += 8;
 		}
-#endif
-		for (; x + 3 < w; x += 4) {
-			unsigned gray0 = _convert565ToGray(in[x], in[x + 2]);
-			unsigned gray1 = _convert565ToGray(in[x + stride], in[x + stride + 2]);
-			*out = (gray0 + gray1) / 2;
-			++out;
-		}
+		out = quarterRow565ToGray(&in[x], &in[x + stride], out, w - x);
 		in += stride * 2;
 	}
 }
+#endif
 
 void imageQuarter565ToGrayInterlace(const uint16_t* in, const uint16_t* oldin, uint16_t* out, size_t w, size_t h, size_t stride) {
 	for (size_t y = 0; y + 3 < h; y += 4) {
@@ -280,9 +234,9 @@ void imageQuarter565ToGrayInterlace(const uint16_t* in, const uint16_t* oldin, u
 		}
 #endif
 		for (; x + 3 < w; x += 4) {
-			unsigned gray0 = _convert565ToGray(in[x], in[x + 2]);
-			unsigned gray1 = _convert565ToGray(in[x + stride], in[x + stride + 2]);
-			gray0 = (gray0 + gray1) / 2;
+			unsigned gray0 = average(gray565(in[x]), gray565(in[x + 2]));
+			unsigned gray1 = average(gray565(in[x + stride]), gray565(in[x + stride + 2]));
+			gray0 = average(gray0, gray1);
 			gray0 |= *oldin << 8;
 			*out = gray0;
 			++oldin;
@@ -293,7 +247,14 @@ void imageQuarter565ToGrayInterlace(const uint16_t* in, const uint16_t* oldin, u
 }
 
 #ifdef __SSSE3__
-static inline void _convert565To888(const __m128i* in, __m128i* out) {
+static inline void _split565(__m128i pix, __m128i* r, __m128i* g, __m128i* b) {
+	/* Mask out channels and normalize them to 16-bit lanes */
+	*r = _mm_srli_epi16(_mm_and_si128(pix, maskR16), 8);
+	*g = _mm_srli_epi16(_mm_and_si128(pix, maskG16), 3);
+	*b = _mm_slli_epi16(_mm_and_si128(pix, maskB16), 3);
+}
+
+static inline void _store888(__m128i r0, __m128i g0, __m128i b0, __m128i r1, __m128i g1, __m128i b1, __m128i* out) {
 	/* 00 R0 00 R1 00 R2 00 R3 00 R4 00 R5 00 R6 00 R7 -> R0 00 00 R1 00 00 R2 00 00 R3 00 00 R4 00 00 R5 */
 	const static __m128i rblend00 = _mm_set_epi8(0x0A, 0x80, 0x80, 0x08, 0x80, 0x80, 0x06, 0x80, 0x80, 0x04, 0x80, 0x80, 0x02, 0x80, 0x80, 0x00);
 
@@ -330,25 +291,6 @@ static inline void _convert565To888(const __m128i* in, __m128i* out) {
 	/* 00 B8 00 B9 00 BA 00 BB 00 BC 00 BD 00 BE 00 BF -> BA 00 00 BB 00 00 BC 00 00 BD 00 00 BE 00 00 BF */
 	const static __m128i bblend21 = _mm_set_epi8(0x0E, 0x80, 0x80, 0x0C, 0x80, 0x80, 0x0A, 0x80, 0x80, 0x08, 0x80, 0x80, 0x06, 0x80, 0x80, 0x04);
 
-	__m128i pix0 = _mm_load_si128(&in[0]);
-	__m128i pix1 = _mm_load_si128(&in[1]);
-
-	// Mask out channels
-	__m128i r0 = _mm_and_si128(pix0, maskR16);
-	__m128i g0 = _mm_and_si128(pix0, maskG16);
-	__m128i b0 = _mm_and_si128(pix0, maskB16);
-	__m128i r1 = _mm_and_si128(pix1, maskR16);
-	__m128i g1 = _mm_and_si128(pix1, maskG16);
-	__m128i b1 = _mm_and_si128(pix1, maskB16);
-
-	// Normalize channels to 16-bit per channel
-	r0 = _mm_srli_epi16(r0, 8);
-	g0 = _mm_srli_epi16(g0, 3);
-	b0 = _mm_slli_epi16(b0, 3);
-	r1 = _mm_srli_epi16(r1, 8);
-	g1 = _mm_srli_epi16(g1, 3);
-	b1 = _mm_slli_epi16(b1, 3);
-
 	// Halve channel width and mix to discrete bytes
 	__m128i out0 = _mm_shuffle_epi8(r0, rblend00);
 	out0 = _mm_or_si128(out0, _mm_shuffle_epi8(g0, gblend00));
@@ -365,36 +307,73 @@ static inline void _convert565To888(const __m128i* in, __m128i* out) {
 	out2 = _mm_or_si128(out2, _mm_shuffle_epi8(g1, gblend21));
 	out2 = _mm_or_si128(out2, _mm_shuffle_epi8(b1, bblend21));
 
-	_mm_store_si128(&out[0], out0);
-	_mm_store_si128(&out[1], out1);
-	_mm_store_si128(&out[2], out2);
+	_mm_storeu_si128(&out[0], out0);
+	_mm_storeu_si128(&out[1], out1);
+	_mm_storeu_si128(&out[2], out2);
+}
+
+static inline void _convert565To888(const __m128i* in, __m128i* out) {
+	__m128i r0, g0, b0, r1, g1, b1;
+	_split565(_mm_loadu_si128(&in[0]), &r0, &g0, &b0);
+	_split565(_mm_loadu_si128(&in[1]), &r1, &g1, &b1);
+	_store888(r0, g0, b0, r1, g1, b1, out);
+}
+
+template<bool Mean>
+static inline __m128i _pool8(__m128i a, __m128i b) {
+	return Mean ? _mm_avg_epu8(a, b) : _mm_max_epu8(a, b);
 }
-#endif
 
-void image565To888(const uint16_t* in, uint8_t* out, size_t w, size_t h, size_t stride) {
+template<bool Mean>
+static void imagePool565To888(const uint16_t* in, const uint16_t* old, uint8_t* out, size_t w, size_t h, size_t stride) {
 	for (size_t y = 0; y < h; ++y) {
 		size_t x = 0;
-#ifdef __SSSE3__
-		for (; x < w; x += 16) {
-			_convert565To888(reinterpret_cast<const __m128i*>(&in[x]), reinterpret_cast<__m128i*>(out));
+		for (; x + 15 < w; x += 16) {
+			/* Channels sit in the low byte of 16-bit lanes, so byte-wise pooling works on them */
+			__m128i r0, g0, b0, r1, g1, b1;
+			__m128i oldR, oldG, oldB;
+			_split565(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&in[x])), &r0, &g0, &b0);
+			_split565(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&old[x])), &oldR, &oldG, &oldB);
+			r0 = _pool8<Mean>(r0, oldR);
+			g0 = _pool8<Mean>(g0, oldG);
+			b0 = _pool8<Mean>(b0, oldB);
+			_split565(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&in[x + 8])), &r1, &g1, &b1);
+			_split565(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&old[x + 8])), &oldR, &oldG, &oldB);
+			r1 = _pool8<Mean>(r1, oldR);
+			g1 = _pool8<Mean>(g1, oldG);
+			b1 = _pool8<Mean>(b1, oldB);
+			_store888(r0, g0, b0, r1, g1, b1, reinterpret_cast<__m128i*>(out));
 			out += 16 * 3;
 		}
-#endif
-		for (; x < w; ++x) {
-			uint16_t rgb = in[x];
-			out[0] = (rgb & 0xF800) >> 8;
-			out[1] = (rgb & 0x07E0) >> 3;
-			out[2] = (rgb & 0x001F) << 3;
-			out += 3;
+		out = poolRow565To888(&in[x], &old[x], out, w - x, Mean);
+		in += stride / 2;
+		old += stride / 2;
+	}
+}
+
+static void imagePool565To888(const uint16_t* in, const uint16_t* old, uint8_t* out, size_t w, size_t h, size_t stride, bool mean) {
+	if (mean) {
+		imagePool565To888<true>(in, old, out, w, h, stride);
+	} else {
+		imagePool565To888<false>(in, old, out, w, h, stride);
+	}
+}
+
+static void image565To888(const uint16_t* in, uint8_t* out, size_t w, size_t h, size_t stride) {
+	for (size_t y = 0; y < h; ++y) {
+		size_t x = 0;
+		for (; x + 15 < w; x += 16) {
+			_convert565To888(reinterpret_cast<const __m128i*>(&in[x]), reinterpret_cast<__m128i*>(out));
+			out += 16 * 3;
 		}
+		out = convertRow565To888(&in[x], out, w - x);
 		in += stride / 2;
 	}
 }
 
-void imageHalveX888ToGray(const uint32_t* in, uint8_t* out, size_t w, size_t h, size_t stride) {
+static void imageHalveX888ToGray(const uint32_t* in, uint8_t* out, size_t w, size_t h, size_t stride) {
 	for (size_t y = 0; y + 1 < h; y += 2) {
 		size_t x = 0;
-#ifdef __SSSE3__
 		for (; x + 7 < w; x += 8) {
 			__m128i gray0;
 			__m128i gray1;
@@ -403,8 +382,8 @@ void imageHalveX888ToGray(const uint32_t* in, uint8_t* out, size_t w, size_t h,
 			gray1 = _convertX888ToGray(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&in[x + 4])));
 			__m128i out0 = _halveW32(gray0, gray1);
 
-			gray0 = _convertX888ToGray(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&in[x + stride / 2])));
-			gray1 = _convertX888ToGray(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&in[x + 4 + stride / 2])));
+			gray0 = _convertX888ToGray(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&in[x + stride / 4])));
+			gray1 = _convertX888ToGray(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&in[x + 4 + stride / 4])));
 			__m128i out1 = _halveW32(gray0, gray1);
 
 			// Halve height
@@ -415,14 +394,11 @@ void imageHalveX888ToGray(const uint32_t* in, uint8_t* out, size_t w, size_t h,
 			*reinterpret_cast<uint32_t*>(out) = outx;
 			out += 4;
 		}
-#endif
-		for (; x + 1 < w; x += 2) {
-			*out = _convertX888ToGray(in[x], in[x + 1]);
-			++out;
-		}
+		out = halveRowX888ToGray(&in[x], &in[x + stride / 4], out, w - x);
 		in += stride / 2;
 	}
 }
+#endif
 
 void imageHalveX888ToGrayInterlace(const uint32_t* in, const uint16_t* oldin, uint16_t* out, size_t w, size_t h, size_t stride) {
 	for (size_t y = 0; y + 1 < h; y += 2) {
@@ -436,8 +412,8 @@ void imageHalveX888ToGrayInterlace(const uint32_t* in, const uint16_t* oldin, ui
 			gray1 = _convertX888ToGray(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&in[x + 4])));
 			__m128i out0 = _halveW32(gray0, gray1);
 
-			gray0 = _convertX888ToGray(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&in[x + stride / 2])));
-			gray1 = _convertX888ToGray(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&in[x + 4 + stride / 2])));
+			gray0 = _convertX888ToGray(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&in[x + stride / 4])));
+			gray1 = _convertX888ToGray(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&in[x + 4 + stride / 4])));
 			__m128i out1 = _halveW32(gray0, gray1);
 
 			// Halve height
@@ -454,7 +430,9 @@ void imageHalveX888ToGrayInterlace(const uint32_t* in, const uint16_t* oldin, ui
 		}
 #endif
 		for (; x + 1 < w; x += 2) {
-			unsigned gray0 = _convertX888ToGray(in[x], in[x + 1]);
+			unsigned gray0 = average(grayX888(in[x]), grayX888(in[x + 1]));
+			unsigned gray1 = average(grayX888(in[x + stride / 4]), grayX888(in[x + stride / 4 + 1]));
+			gray0 = average(gray0, gray1);
 			gray0 |= *oldin << 8;
 			*out = gray0;
 			++oldin;
@@ -464,10 +442,10 @@ void imageHalveX888ToGrayInterlace(const uint32_t* in, const uint16_t* oldin, ui
 	}
 }
 
-void imageQuarterX888ToGray(const uint32_t* in, uint8_t* out, size_t w, size_t h, size_t stride) {
+#ifdef __SSSE3__
+static void imageQuarterX888ToGray(const uint32_t* in, uint8_t* out, size_t w, size_t h, size_t stride) {
 	for (size_t y = 0; y + 3 < h; y += 4) {
 		size_t x = 0;
-#ifdef __SSSE3__
 		for (; x + 15 < w; x += 16) {
 			__m128i gray0;
 			__m128i gray1;
@@ -492,16 +470,11 @@ void imageQuarterX888ToGray(const uint32_t* in, uint8_t* out, size_t w, size_t h
 			*reinterpret_cast<uint32_t*>(out) = outx;
 			out += 4;
 		}
-#endif
-		for (; x + 3 < w; x += 4) {
-			unsigned gray0 = _convertX888ToGray(in[x], in[x + 2]);
-			unsigned gray1 = _convertX888ToGray(in[x + stride / 2], in[x + stride / 2 + 2]);
-			*out = (gray0 + gray1) / 2;
-			++out;
-		}
+		out = quarterRowX888ToGray(&in[x], &in[x + stride / 2], out, w - x);
 		in += stride;
 	}
 }
+#endif
 
 void imageQuarterX888ToGrayInterlace(const uint32_t* in, const uint16_t* oldin, uint16_t* out, size_t w, size_t h, size_t stride) {
 	for (size_t y = 0; y + 3 < h; y += 4) {
@@ -537,9 +510,9 @@ void imageQuarterX888ToGrayInterlace(const uint32_t* in, const uint16_t* oldin,
 		}
 #endif
 		for (; x + 3 < w; x += 4) {
-			unsigned gray0 = _convertX888ToGray(in[x], in[x + 2]);
-			unsigned gray1 = _convertX888ToGray(in[x + stride / 2], in[x + stride / 2 + 2]);
-			gray0 = (gray0 + gray1) / 2;
+			unsigned gray0 = average(grayX888(in[x]), grayX888(in[x + 2]));
+			unsigned gray1 = average(grayX888(in[x + stride / 2]), grayX888(in[x + stride / 2 + 2]));
+			gray0 = average(gray0, gray1);
 			gray0 |= *oldin << 8;
 			*out = gray0;
 			++oldin;
@@ -549,58 +522,296 @@ void imageQuarterX888ToGrayInterlace(const uint32_t* in, const uint16_t* oldin,
 	}
 }
 
-void imageX888To888(const uint32_t* in, uint8_t* out, size_t w, size_t h, size_t stride) {
+#ifdef __SSSE3__
+static inline void _convertX888To888(__m128i pix0, __m128i pix1, __m128i pix2, __m128i pix3, uint8_t* out) {
+	/* B0 G0 R0 X0 B1 G1 R1 X1 B2 G2 R2 X2 B3 G3 R3 X3 -> R0 G0 B0 R1 G1 B1 R2 G2 B2 R3 G3 B3 00 00 00 00 */
+	const static __m128i blend00 = _mm_set_epi8(0x80, 0x80, 0x80, 0x80, 0x0C, 0x0D, 0x0E, 0x08, 0x09, 0x0A, 0x04, 0x05, 0x06, 0x00, 0x01, 0x02);
+
+	/* B4 G4 R4 X4 B5 G5 R5 X5 B6 G6 R6 X6 B7 G7 R7 X7 -> 00 00 00 00 00 00 00 00 00 00 00 00 R4 G4 B4 R5 */
+	const static __m128i blend01 = _mm_set_epi8(0x06, 0x00, 0x01, 0x02, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80);
+
+	/* B4 G4 R4 X4 B5 G5 R5 X5 B6 G6 R6 X6 B7 G7 R7 X7 -> G5 B5 R6 G6 B6 R7 G7 B7 00 00 00 00 00 00 00 00 */
+	const static __m128i blend11 = _mm_set_epi8(0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x0C, 0x0D, 0x0E, 0x08, 0x09, 0x0A, 0x04, 0x05);
+
+	/* B8 G8 R8 X8 B9 G9 R9 X9 BA GA RA XA BB GB RB XB -> 00 00 00 00 00 00 00 00 R8 G8 B8 R9 G9 B9 RA GA */
+	const static __m128i blend12 = _mm_set_epi8(0x09, 0x0A, 0x04, 0x05, 0x06, 0x00, 0x01, 0x02, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80);
+
+	/* B8 G8 R8 X8 B9 G9 R9 X9 BA GA RA XA BB GB RB XB -> BA RB GB BB 00 00 00 00 00 00 00 00 00 00 00 00 */
+	const static __m128i blend22 = _mm_set_epi8(0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x0C, 0x0D, 0x0E, 0x08);
+
+	/* BC GC RC XC BD GD RD XD BE GE RE XE BF GF RF XF -> 00 00 00 00 RC GC BC RD GD BD RE GE BE RF GF DF */
+	const static __m128i blend23 = _mm_set_epi8(0x0C, 0x0D, 0x0E, 0x08, 0x09, 0x0A, 0x04, 0x05, 0x06, 0x00, 0x01, 0x02, 0x80, 0x80, 0x80, 0x80);
+
+	__m128i out0 = _mm_shuffle_epi8(pix0, blend00);
+	out0 = _mm_or_si128(out0, _mm_shuffle_epi8(pix1, blend01));
+
+	__m128i out1 = _mm_shuffle_epi8(pix1, blend11);
+	out1 = _mm_or_si128(out1, _mm_shuffle_epi8(pix2, blend12));
+
+	__m128i out2 = _mm_shuffle_epi8(pix2, blend22);
+	out2 = _mm_or_si128(out2, _mm_shuffle_epi8(pix3, blend23));
+
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(&out[0]), out0);
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(&out[16]), out1);
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(&out[32]), out2);
+}
+
+static inline __m128i _loadX888(const uint32_t* in) {
+	return _mm_loadu_si128(reinterpret_cast<const __m128i*>(in));
+}
+
+static void imageX888To888(const uint32_t* in, uint8_t* out, size_t w, size_t h, size_t stride) {
+	for (size_t y = 0; y < h; ++y) {
+		size_t x = 0;
+		for (; x + 15 < w; x += 16) {
+			_convertX888To888(_loadX888(&in[x]), _loadX888(&in[x + 4]), _loadX888(&in[x + 8]), _loadX888(&in[x + 12]), out);
+			out += 48;
+		}
+		out = convertRowX888To888(&in[x], out, w - x);
+		in += stride / 4;
+	}
+}
+
+template<bool Mean>
+static void imagePoolX888To888(const uint32_t* in, const uint32_t* old, uint8_t* out, size_t w, size_t h, size_t stride) {
 	for (size_t y = 0; y < h; ++y) {
 		size_t x = 0;
-#ifdef __SSSE3__
 		for (; x + 15 < w; x += 16) {
-			/* B0 G0 R0 X0 B1 G1 R1 X1 B2 G2 R2 X2 B3 G3 R3 X3 -> R0 G0 B0 R1 G1 B1 R2 G2 B2 R3 G3 B3 00 00 00 00 */
-			const static __m128i blend00 = _mm_set_epi8(0x80, 0x80, 0x80, 0x80, 0x0C, 0x0D, 0x0E, 0x08, 0x09, 0x0A, 0x04, 0x05, 0x06, 0x00, 0x01, 0x02);
+			__m128i pix0 = _pool8<Mean>(_loadX888(&in[x]), _loadX888(&old[x]));
+			__m128i pix1 = _pool8<Mean>(_loadX888(&in[x + 4]), _loadX888(&old[x + 4]));
+			__m128i pix2 = _pool8<Mean>(_loadX888(&in[x + 8]), _loadX888(&old[x + 8]));
+			__m128i pix3 = _pool8<Mean>(_loadX888(&in[x + 12]), _loadX888(&old[x + 12]));
+			_convertX888To888(pix0, pix1, pix2, pix3, out);
+			out += 48;
+		}
+		out = poolRowX888To888(&in[x], &old[x], out, w - x, Mean);
+		in += stride / 4;
+		old += stride / 4;
+	}
+}
+
+static void imagePoolX888To888(const uint32_t* in, const uint32_t* old, uint8_t* out, size_t w, size_t h, size_t stride, bool mean) {
+	if (mean) {
+		imagePoolX888To888<true>(in, old, out, w, h, stride);
+	} else {
+		imagePoolX888To888<false>(in, old, out, w, h, stride);
+	}
+}
 
-			/* B4 G4 R4 X4 B5 G5 R5 X5 B6 G6 R6 X6 B7 G7 R7 X7 -> 00 00 00 00 00 00 00 00 00 00 00 00 R4 G4 B4 R5 */
-			const static __m128i blend01 = _mm_set_epi8(0x06, 0x00, 0x01, 0x02, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80);
+static inline void _accumulate16(uint32_t* out, __m128i values, __m128i weight) {
+	/* Widen 8 values to 32 bits; multiplying against (weight, 0) pairs keeps them unsigned */
+	const __m128i zero = _mm_setzero_si128();
+	__m128i lo = _mm_madd_epi16(_mm_unpacklo_epi16(values, zero), weight);
+	__m128i hi = _mm_madd_epi16(_mm_unpackhi_epi16(values, zero), weight);
+	lo = _mm_add_epi32(lo, _mm_loadu_si128(reinterpret_cast<const __m128i*>(&out[0])));
+	hi = _mm_add_epi32(hi, _mm_loadu_si128(reinterpret_cast<const __m128i*>(&out[4])));
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(&out[0]), lo);
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(&out[4]), hi);
+}
+
+static inline void _accumulateRGB16(uint32_t* out, size_t plane, __m128i r, __m128i g, __m128i b, __m128i weight, bool gray) {
+	if (gray) {
+		/* The weighted sum stays below 65536, so 16-bit lanes are enough */
+		__m128i y = _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(77)), _mm_mullo_epi16(g, _mm_set1_epi16(150)));
+		y = _mm_add_epi16(y, _mm_mullo_epi16(b, _mm_set1_epi16(29)));
+		y = _mm_srli_epi16(_mm_add_epi16(y, _mm_set1_epi16(128)), 8);
+		_accumulate16(out, y, weight);
+	} else {
+		_accumulate16(out, r, weight);
+		_accumulate16(&out[plane], g, weight);
+		_accumulate16(&out[plane * 2], b, weight);
+	}
+}
 
-			/* B4 G4 R4 X4 B5 G5 R5 X5 B6 G6 R6 X6 B7 G7 R7 X7 -> G5 B5 R6 G6 B6 R7 G7 B7 00 00 00 00 00 00 00 00 */
-			const static __m128i blend11 = _mm_set_epi8(0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x0C, 0x0D, 0x0E, 0x08, 0x09, 0x0A, 0x04, 0x05);
+static void imageAccumulate565(const uint16_t* in, unsigned weight, uint32_t* out, size_t w, bool gray) {
+	const __m128i weights = _mm_set1_epi32(weight);
+	size_t x = 0;
+	for (; x + 7 < w; x += 8) {
+		__m128i pix = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&in[x]));
+		__m128i r = _mm_and_si128(_mm_srli_epi16(pix, 8), _mm_set1_epi16(0xF8));
+		__m128i g = _mm_and_si128(_mm_srli_epi16(pix, 3), _mm_set1_epi16(0xFC));
+		__m128i b = _mm_and_si128(_mm_slli_epi16(pix, 3), _mm_set1_epi16(0xF8));
+		_accumulateRGB16(&out[x], w, r, g, b, weights, gray);
+	}
+	accumulateRow565(&in[x], weight, &out[x], w - x, w, gray);
+}
 
-			/* B8 G8 R8 X8 B9 G9 R9 X9 BA GA RA XA BB GB RB XB -> 00 00 00 00 00 00 00 00 R8 G8 B8 R9 G9 B9 RA GA */
-			const static __m128i blend12 = _mm_set_epi8(0x09, 0x0A, 0x04, 0x05, 0x06, 0x00, 0x01, 0x02, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80);
+static void imageAccumulateX888(const uint32_t* in, unsigned weight, uint32_t* out, size_t w, bool gray) {
+	const __m128i weights = _mm_set1_epi32(weight);
+	const __m128i mask = _mm_set1_epi32(0xFF);
+	size_t x = 0;
+	for (; x + 7 < w; x += 8) {
+		__m128i pix0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&in[x]));
+		__m128i pix1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&in[x + 4]));
+		__m128i r = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(pix0, 16), mask), _mm_and_si128(_mm_srli_epi32(pix1, 16), mask));
+		__m128i g = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(pix0, 8), mask), _mm_and_si128(_mm_srli_epi32(pix1, 8), mask));
+		__m128i b = _mm_packs_epi32(_mm_and_si128(pix0, mask), _mm_and_si128(pix1, mask));
+		_accumulateRGB16(&out[x], w, r, g, b, weights, gray);
+	}
+	accumulateRowX888(&in[x], weight, &out[x], w - x, w, gray);
+}
+#endif
+
+static void scalar565To888(const uint16_t* in, uint8_t* out, size_t w, size_t h, size_t stride) {
+	for (size_t y = 0; y < h; ++y) {
+		out = convertRow565To888(in, out, w);
+		in += stride / 2;
+	}
+}
+
+static void scalarX888To888(const uint32_t* in, uint8_t* out, size_t w, size_t h, size_t stride) {
+	for (size_t y = 0; y < h; ++y) {
+		out = convertRowX888To888(in, out, w);
+		in += stride / 4;
+	}
+}
 
-			/* B8 G8 R8 X8 B9 G9 R9 X9 BA GA RA XA BB GB RB XB -> BA RB GB BB 00 00 00 00 00 00 00 00 00 00 00 00 */
-			const static __m128i blend22 = _mm_set_epi8(0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x0C, 0x0D, 0x0E, 0x08);
+static void scalarHalve565ToGray(const uint16_t* in, uint8_t* out, size_t w, size_t h, size_t stride) {
+	for (size_t y = 0; y + 1 < h; y += 2) {
+		out = halveRow565ToGray(in, in + stride / 2, out, w);
+		in += stride;
+	}
+}
 
-			/* BC GC RC XC BD GD RD XD BE GE RE XE BF GF RF XF -> 00 00 00 00 RC GC BC RD GD BD RE GE BE RF GF DF */
-			const static __m128i blend23 = _mm_set_epi8(0x0C, 0x0D, 0x0E, 0x08, 0x09, 0x0A, 0x04, 0x05, 0x06, 0x00, 0x01, 0x02, 0x80, 0x80, 0x80, 0x80);
+static void scalarHalveX888ToGray(const uint32_t* in, uint8_t* out, size_t w, size_t h, size_t stride) {
+	for (size_t y = 0; y + 1 < h; y += 2) {
+		out = halveRowX888ToGray(in, in + stride / 4, out, w);
+		in += stride / 2;
+	}
+}
 
-			__m128i pix0 = _mm_load_si128(reinterpret_cast<const __m128i*>(&in[x]));
-			__m128i pix1 = _mm_load_si128(reinterpret_cast<const __m128i*>(&in[x + 4]));
-			__m128i pix2 = _mm_load_si128(reinterpret_cast<const __m128i*>(&in[x + 8]));
-			__m128i pix3 = _mm_load_si128(reinterpret_cast<const __m128i*>(&in[x + 12]));
+static void scalarQuarter565ToGray(const uint16_t* in, uint8_t* out, size_t w, size_t h, size_t stride) {
+	for (size_t y = 0; y + 3 < h; y += 4) {
+		out = quarterRow565ToGray(in, in + stride, out, w);
+		in += stride * 2;
+	}
+}
 
-			__m128i out0 = _mm_shuffle_epi8(pix0, blend00);
-			out0 = _mm_or_si128(out0, _mm_shuffle_epi8(pix1, blend01));
+static void scalarQuarterX888ToGray(const uint32_t* in, uint8_t* out, size_t w, size_t h, size_t stride) {
+	for (size_t y = 0; y + 3 < h; y += 4) {
+		out = quarterRowX888ToGray(in, in + stride / 2, out, w);
+		in += stride;
+	}
+}
 
-			__m128i out1 = _mm_shuffle_epi8(pix1, blend11);
-			out1 = _mm_or_si128(out1, _mm_shuffle_epi8(pix2, blend12));
+static void scalarAccumulate565(const uint16_t* in, unsigned weight, uint32_t* out, size_t w, bool gray) {
+	accumulateRow565(in, weight, out, w, w, gray);
+}
 
-			__m128i out2 = _mm_shuffle_epi8(pix2, blend22);
-			out2 = _mm_or_si128(out2, _mm_shuffle_epi8(pix3, blend23));
+static void scalarAccumulateX888(const uint32_t* in, unsigned weight, uint32_t* out, size_t w, bool gray) {
+	accumulateRowX888(in, weight, out, w, w, gray);
+}
 
-			_mm_storeu_si128(reinterpret_cast<__m128i*>(&out[0]), out0);
-			_mm_storeu_si128(reinterpret_cast<__m128i*>(&out[16]), out1);
-			_mm_storeu_si128(reinterpret_cast<__m128i*>(&out[32]), out2);
-			out += 48;
+static void scalarPool565To888(const uint16_t* in, const uint16_t* old, uint8_t* out, size_t w, size_t h, size_t stride, bool mean) {
+	for (size_t y = 0; y < h; ++y) {
+		out = poolRow565To888(in, old, out, w, mean);
+		in += stride / 2;
+		old += stride / 2;
+	}
+}
+
+static void scalarPoolX888To888(const uint32_t* in, const uint32_t* old, uint8_t* out, size_t w, size_t h, size_t stride, bool mean) {
+	for (size_t y = 0; y < h; ++y) {
+		out = poolRowX888To888(in, old, out, w, mean);
+		in += stride / 4;
+		old += stride / 4;
+	}
+}
+
+static const ImageKernelTable s_scalarKernels{
+	scalar565To888,
+	scalarX888To888,
+	scalarHalve565ToGray,
+	scalarHalveX888ToGray,
+	scalarQuarter565ToGray,
+	scalarQuarterX888ToGray,
+	scalarAccumulate565,
+	scalarAccumulateX888,
+	scalarPool565To888,
+	scalarPoolX888To888,
+};
+
+#ifdef __SSSE3__
+static const ImageKernelTable s_ssse3Kernels{
+	image565To888,
+	imageX888To888,
+	imageHalve565ToGray,
+	imageHalveX888ToGray,
+	imageQuarter565ToGray,
+	imageQuarterX888ToGray,
+	imageAccumulate565,
+	imageAccumulateX888,
+	imagePool565To888,
+	imagePoolX888To888,
+};
+#endif
+
+static const ImageKernelTable* kernelTable(Image::Kernels kernels) {
+	switch (kernels) {
+	case Image::Kernels::SCALAR:
+		return &s_scalarKernels;
+	case Image::Kernels::SSSE3:
+#ifdef __SSSE3__
+		return &s_ssse3Kernels;
+#else
+		return nullptr;
+#endif
+	case Image::Kernels::AVX2:
+#if defined(__x86_64__) || defined(__i386__)
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2")) {
+			return avx2ImageKernels();
 		}
 #endif
-		for (; x < w; ++x) {
-			uint32_t xrgb = in[x];
-			out[0] = xrgb;
-			out[1] = xrgb >> 8;
-			out[2] = xrgb >> 16;
-			out += 3;
+		return nullptr;
+	case Image::Kernels::AVX512:
+#if defined(__x86_64__) || defined(__i386__)
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+			return avx512ImageKernels();
+		}
+#endif
+		return nullptr;
+	case Image::Kernels::NEON:
+		return neonImageKernels();
+	}
+	return nullptr;
+}
+
+static atomic<const ImageKernelTable*>& activeKernelTable() {
+	static atomic<const ImageKernelTable*> table{ kernelTable(Image::bestKernels()) };
+	return table;
+}
+
+bool Image::supportsKernels(Kernels kernels) {
+	return kernelTable(kernels);
+}
+
+Image::Kernels Image::bestKernels() {
+	for (Kernels kernels : { Kernels::AVX512, Kernels::AVX2, Kernels::SSSE3, Kernels::NEON }) {
+		if (supportsKernels(kernels)) {
+			return kernels;
+		}
+	}
+	return Kernels::SCALAR;
+}
+
+void Image::useKernels(Kernels kernels) {
+	const ImageKernelTable* table = kernelTable(kernels);
+	if (!table) {
+		throw invalid_argument("Image kernels are not supported on this CPU");
+	}
+	activeKernelTable().store(table, memory_order_relaxed);
+}
+
+Image::Kernels Image::activeKernels() {
+	const ImageKernelTable* table = activeKernelTable().load(memory_order_relaxed);
+	for (Kernels kernels : { Kernels::SCALAR, Kernels::SSSE3, Kernels::AVX2, Kernels::AVX512, Kernels::NEON }) {
+		if (kernelTable(kernels) == table) {
+			return kernels;
 		}
-		in += stride / 4;
 	}
+	return Kernels::SCALAR;
 }
 
 Image::Image(Format format, const void* in, size_t w, size_t h, size_t stride)
@@ -620,6 +831,97 @@ Image::Image(Format format, void* in, size_t w, size_t h, size_t stride)
 	, m_format(format) {
 }
 
+size_t Image::depth(Format format) {
+	switch (format) {
+	case Image::Format::RGB565:
+	case Image::Format::RGB1555:
+		return 2;
+	case Image::Format::RGB888:
+		return 3;
+	case Image::Format::RGBX888:
+		return 4;
+	case Image::Format::G8:
+	case Image::Format::P8:
+		return 1;
+	}
+	return 1;
+}
+
+Image Image::crop(size_t x, size_t y, size_t w, size_t h) const {
+	if (x + w > m_w || y + h > m_h) {
+		throw invalid_argument("Crop is out of bounds");
+	}
+	size_t offset = m_stride * y + depth(m_format) * x;
+	Image image(*this);
+	image.m_constBuffer = &static_cast<const uint8_t*>(m_constBuffer)[offset];
+	if (m_buffer) {
+		image.m_buffer = &static_cast<uint8_t*>(m_buffer)[offset];
+	}
+	image.m_w = w;
+	image.m_h = h;
+	return image;
+}
+
+/* 0RGB1555 goes through the 565 kernels: moving red and green up a bit leaves
+ * the new low bit of green clear, which expands to the same 8-bit values */
+static inline void repackRow1555(const uint16_t* in, uint16_t* out, size_t w) {
+	size_t x = 0;
+#ifdef __SSSE3__
+	const __m128i maskRG = _mm_set1_epi16(0x7FE0);
+	for (; x + 7 < w; x += 8) {
+		__m128i pix = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&in[x]));
+		pix = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(pix, maskRG), 1), _mm_and_si128(pix, maskB16));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(&out[x]), pix);
+	}
+#endif
+	for (; x < w; ++x) {
+		out[x] = ((in[x] & 0x7FE0) << 1) | (in[x] & 0x001F);
+	}
+}
+
+/* Keeps the top bits of each channel. Unlike the other direction this loses
+ * precision, unless the frame came from 16-bit colour */
+static inline void packRowX888To565(const uint32_t* in, uint16_t* out, size_t w) {
+	size_t x = 0;
+#ifdef __SSSE3__
+	const __m128i maskR = _mm_set1_epi32(0xF800);
+	const __m128i maskG = _mm_set1_epi32(0x07E0);
+	const __m128i maskB = _mm_set1_epi32(0x001F);
+	/* Low halves of each 32-bit lane */
+	const __m128i pack = _mm_set_epi8(0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x0D, 0x0C, 0x09, 0x08, 0x05, 0x04, 0x01, 0x00);
+	for (; x + 7 < w; x += 8) {
+		__m128i packed[2];
+		for (int i = 0; i < 2; ++i) {
+			__m128i pix = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&in[x + i * 4]));
+			__m128i r = _mm_and_si128(_mm_srli_epi32(pix, 8), maskR);
+			__m128i g = _mm_and_si128(_mm_srli_epi32(pix, 5), maskG);
+			__m128i b = _mm_and_si128(_mm_srli_epi32(pix, 3), maskB);
+			packed[i] = _mm_shuffle_epi8(_mm_or_si128(_mm_or_si128(r, g), b), pack);
+		}
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(&out[x]), _mm_unpacklo_epi64(packed[0], packed[1]));
+	}
+#endif
+	for (; x < w; ++x) {
+		out[x] = ((in[x] >> 8) & 0xF800) | ((in[x] >> 5) & 0x07E0) | ((in[x] >> 3) & 0x001F);
+	}
+}
+
+/* Repacks a few rows at a time, so that they are still in cache when the 565
+ * kernel reads them. Bands are a multiple of every divisor in height */
+static const size_t REPACK_ROWS = 16;
+
+template<typename F>
+static void repack1555(const void* in, size_t w, size_t h, size_t stride, F run) {
+	vector<uint16_t> band(w * min(h, REPACK_ROWS));
+	for (size_t y = 0; y < h; y += REPACK_ROWS) {
+		size_t rows = min(h - y, REPACK_ROWS);
+		for (size_t row = 0; row < rows; ++row) {
+			repackRow1555(reinterpret_cast<const uint16_t*>(&static_cast<const uint8_t*>(in)[stride * (y + row)]), &band[w * row], w);
+		}
+		run(band.data(), rows, w * 2);
+	}
+}
+
 void Image::copyTo(Image* other) {
 	if (m_w != other->m_w || m_h != other->m_h) {
 		throw invalid_argument("Image dimensions don't match");
@@ -631,16 +933,40 @@ void Image::copyTo(Image* other) {
 			copyDirectlyTo(other);
 			break;
 		case Image::Format::RGB888:
-			image565To888(static_cast<const uint16_t*>(m_constBuffer), static_cast<uint8_t*>(other->m_buffer), m_w, m_h, m_stride);
+			activeKernelTable().load(memory_order_relaxed)->image565To888(static_cast<const uint16_t*>(m_constBuffer), static_cast<uint8_t*>(other->m_buffer), m_w, m_h, m_stride);
 			break;
 		default:
 			throw logic_error("unimplemented conversion");
 		}
 		break;
+	case Image::Format::RGB1555:
+		switch (other->m_format) {
+		case Image::Format::RGB1555:
+			copyDirectlyTo(other);
+			break;
+		case Image::Format::RGB565:
+			for (size_t y = 0; y < m_h; ++y) {
+				repackRow1555(reinterpret_cast<const uint16_t*>(&static_cast<const uint8_t*>(m_constBuffer)[m_stride * y]), reinterpret_cast<uint16_t*>(&static_cast<uint8_t*>(other->m_buffer)[other->m_stride * y]), m_w);
+			}
+			break;
+		case Image::Format::RGB888: {
+			const ImageKernelTable* kernels = activeKernelTable().load(memory_order_relaxed);
+			uint8_t* out = static_cast<uint8_t*>(other->m_buffer);
+			repack1555(m_constBuffer, m_w, m_h, m_stride, [&](const uint16_t* band, size_t rows, size_t stride) {
+				kernels->image565To888(band, out, m_w, rows, stride);
+				out += m_w * rows * 3;
+			});
+			break;
+		}
+		default:
+			throw logic_error("unimplemented conversion");
+		}
+		break;
 	case Image::Format::RGB888:
 		switch (other->m_format) {
 		case Image::Format::RGB888:
 			copyDirectlyTo(other);
+			break;
 		default:
 			throw logic_error("unimplemented conversion");
 		}
@@ -650,20 +976,24 @@ void Image::copyTo(Image* other) {
 		case Image::Format::RGBX888:
 			copyDirectlyTo(other);
 			break;
+		case Image::Format::RGB565:
+			for (size_t y = 0; y < m_h; ++y) {
+				packRowX888To565(reinterpret_cast<const uint32_t*>(&static_cast<const uint8_t*>(m_constBuffer)[m_stride * y]), reinterpret_cast<uint16_t*>(&static_cast<uint8_t*>(other->m_buffer)[other->m_stride * y]), m_w);
+			}
+			break;
 		case Image::Format::RGB888:
-			imageX888To888(static_cast<const uint32_t*>(m_constBuffer), static_cast<uint8_t*>(other->m_buffer), m_w, m_h, m_stride);
+			activeKernelTable().load(memory_order_relaxed)->imageX888To888(static_cast<const uint32_t*>(m_constBuffer), static_cast<uint8_t*>(other->m_buffer), m_w, m_h, m_stride);
 			break;
 		default:
 			throw logic_error("unimplemented conversion");
 		}
 		break;
 	case Image::Format::G8:
-		switch (other->m_format) {
-		case Image::Format::G8:
-			copyDirectlyTo(other);
-		default:
+	case Image::Format::P8:
+		if (other->m_format != m_format) {
 			throw logic_error("unimplemented conversion");
 		}
+		copyDirectlyTo(other);
 		break;
 	}
 }
@@ -676,24 +1006,40 @@ void Image::halveTo(Image* other) {
 	case Image::Format::RGB565:
 		switch (other->m_format) {
 		case Image::Format::G8:
-			imageHalve565ToGray(static_cast<const uint16_t*>(m_constBuffer), static_cast<uint8_t*>(other->m_buffer), m_w, m_h, m_stride);
+			activeKernelTable().load(memory_order_relaxed)->imageHalve565ToGray(static_cast<const uint16_t*>(m_constBuffer), static_cast<uint8_t*>(other->m_buffer), m_w, m_h, m_stride);
 			break;
 		default:
 			throw logic_error("unimplemented conversion");
 		}
 		break;
+	case Image::Format::RGB1555:
+		switch (other->m_format) {
+		case Image::Format::G8: {
+			const ImageKernelTable* kernels = activeKernelTable().load(memory_order_relaxed);
+			uint8_t* out = static_cast<uint8_t*>(other->m_buffer);
+			repack1555(m_constBuffer, m_w, m_h, m_stride, [&](const uint16_t* band, size_t rows, size_t stride) {
+				kernels->imageHalve565ToGray(band, out, m_w, rows, stride);
+				out += (m_w / 2) * (rows / 2);
+			});
+			break;
+		}
+		default:
+			throw logic_error("unimplemented conversion");
+		}
+		break;
 	case Image::Format::RGB888:
 		throw logic_error("unimplemented conversion");
 	case Image::Format::RGBX888:
 		switch (other->m_format) {
 		case Image::Format::G8:
-			imageHalveX888ToGray(static_cast<const uint32_t*>(m_constBuffer), static_cast<uint8_t*>(other->m_buffer), m_w, m_h, m_stride);
+			activeKernelTable().load(memory_order_relaxed)->imageHalveX888ToGray(static_cast<const uint32_t*>(m_constBuffer), static_cast<uint8_t*>(other->m_buffer), m_w, m_h, m_stride);
 			break;
 		default:
 			throw logic_error("unimplemented conversion");
 		}
 		break;
 	case Image::Format::G8:
+	case Image::Format::P8:
 		throw logic_error("unimplemented conversion");
 	}
 }
@@ -715,6 +1061,22 @@ void Image::halveToInterlace(Image* other, const Image* old) {
 			throw logic_error("unimplemented conversion");
 		}
 		break;
+	case Image::Format::RGB1555:
+		switch (other->m_format) {
+		case Image::Format::G8: {
+			const uint16_t* oldin = static_cast<const uint16_t*>(old->m_constBuffer);
+			uint16_t* out = static_cast<uint16_t*>(other->m_buffer);
+			repack1555(m_constBuffer, m_w, m_h, m_stride, [&](const uint16_t* band, size_t rows, size_t stride) {
+				imageHalve565ToGrayInterlace(band, oldin, out, m_w, rows, stride);
+				oldin += (m_w / 2) * (rows / 2);
+				out += (m_w / 2) * (rows / 2);
+			});
+			break;
+		}
+		default:
+			throw logic_error("unimplemented conversion");
+		}
+		break;
 	case Image::Format::RGB888:
 		throw logic_error("unimplemented conversion");
 	case Image::Format::RGBX888:
@@ -727,6 +1089,7 @@ void Image::halveToInterlace(Image* other, const Image* old) {
 		}
 		break;
 	case Image::Format::G8:
+	case Image::Format::P8:
 		throw logic_error("unimplemented conversion");
 	}
 }
@@ -739,8 +1102,23 @@ void Image::quarterTo(Image* other) {
 	case Image::Format::RGB565:
 		switch (other->m_format) {
 		case Image::Format::G8:
-			imageQuarter565ToGray(static_cast<const uint16_t*>(m_constBuffer), static_cast<uint8_t*>(other->m_buffer), m_w, m_h, m_stride);
+			activeKernelTable().load(memory_order_relaxed)->imageQuarter565ToGray(static_cast<const uint16_t*>(m_constBuffer), static_cast<uint8_t*>(other->m_buffer), m_w, m_h, m_stride);
+			break;
+		default:
+			throw logic_error("unimplemented conversion");
+		}
+		break;
+	case Image::Format::RGB1555:
+		switch (other->m_format) {
+		case Image::Format::G8: {
+			const ImageKernelTable* kernels = activeKernelTable().load(memory_order_relaxed);
+			uint8_t* out = static_cast<uint8_t*>(other->m_buffer);
+			repack1555(m_constBuffer, m_w, m_h, m_stride, [&](const uint16_t* band, size_t rows, size_t stride) {
+				kernels->imageQuarter565ToGray(band, out, m_w, rows, stride);
+				out += (m_w / 4) * (rows / 4);
+			});
 			break;
+		}
 		default:
 			throw logic_error("unimplemented conversion");
 		}
@@ -750,13 +1128,14 @@ void Image::quarterTo(Image* other) {
 	case Image::Format::RGBX888:
 		switch (other->m_format) {
 		case Image::Format::G8:
-			imageQuarterX888ToGray(static_cast<const uint32_t*>(m_constBuffer), static_cast<uint8_t*>(other->m_buffer), m_w, m_h, m_stride);
+			activeKernelTable().load(memory_order_relaxed)->imageQuarterX888ToGray(static_cast<const uint32_t*>(m_constBuffer), static_cast<uint8_t*>(other->m_buffer), m_w, m_h, m_stride);
 			break;
 		default:
 			throw logic_error("unimplemented conversion");
 		}
 		break;
 	case Image::Format::G8:
+	case Image::Format::P8:
 		throw logic_error("unimplemented conversion");
 	}
 }
@@ -781,6 +1160,22 @@ void Image::quarterToInterlace(Image* other, const Image* old) {
 			throw logic_error("unimplemented conversion");
 		}
 		break;
+	case Image::Format::RGB1555:
+		switch (other->m_format) {
+		case Image::Format::G8: {
+			const uint16_t* oldin = static_cast<const uint16_t*>(old->m_constBuffer);
+			uint16_t* out = static_cast<uint16_t*>(other->m_buffer);
+			repack1555(m_constBuffer, m_w, m_h, m_stride, [&](const uint16_t* band, size_t rows, size_t stride) {
+				imageQuarter565ToGrayInterlace(band, oldin, out, m_w, rows, stride);
+				oldin += (m_w / 4) * (rows / 4);
+				out += (m_w / 4) * (rows / 4);
+			});
+			break;
+		}
+		default:
+			throw logic_error("unimplemented conversion");
+		}
+		break;
 	case Image::Format::RGB888:
 		throw logic_error("unimplemented conversion");
 	case Image::Format::RGBX888:
@@ -793,6 +1188,7 @@ void Image::quarterToInterlace(Image* other, const Image* old) {
 		}
 		break;
 	case Image::Format::G8:
+	case Image::Format::P8:
 		throw logic_error("unimplemented conversion");
 	}
 }
@@ -834,28 +1230,416 @@ void Image::divideToInterlace(int divisor, Image* other, const Image* old) {
 	}
 }
 
-void Image::copyDirectlyTo(Image* other) {
-	size_t depth = 1;
+/* Adds a source pixel covering part / total of an output pixel */
+static void addTap(Resampler::Taps* taps, size_t i, uint64_t part, uint64_t total) {
+	uint32_t fixed = (part << RESAMPLE_WEIGHT_BITS) / total;
+	taps->index.push_back(i);
+	taps->weight.push_back(fixed);
+}
+
+static void finishTaps(Resampler::Taps* taps) {
+	/* Rounding down loses a little of the total; give it to the heaviest tap
+	 * and drop taps that ended up with no weight */
+	size_t start = taps->first.back();
+	uint32_t sum = 0;
+	size_t heaviest = start;
+	for (size_t t = start; t < taps->index.size(); ++t) {
+		sum += taps->weight[t];
+		if (taps->weight[t] > taps->weight[heaviest]) {
+			heaviest = t;
+		}
+	}
+	taps->weight[heaviest] += (1 << RESAMPLE_WEIGHT_BITS) - sum;
+	size_t kept = start;
+	for (size_t t = start; t < taps->index.size(); ++t) {
+		if (taps->weight[t]) {
+			taps->index[kept] = taps->index[t];
+			taps->weight[kept] = taps->weight[t];
+			++kept;
+		}
+	}
+	taps->index.resize(kept);
+	taps->weight.resize(kept);
+}
+
+static void buildTaps(Resampler::Taps* taps, size_t in, size_t out, Image::Filter filter) {
+	taps->first.clear();
+	taps->index.clear();
+	taps->weight.clear();
+	if (filter == Image::Filter::AREA && in < out) {
+		filter = Image::Filter::BILINEAR;
+	}
+	/* Positions are kept as exact fractions to avoid drift over wide images */
+	for (size_t o = 0; o < out; ++o) {
+		taps->first.push_back(taps->index.size());
+		switch (filter) {
+		case Image::Filter::NEAREST:
+			addTap(taps, (2 * o + 1) * in / (2 * out), 1, 1);
+			break;
+		case Image::Filter::AREA: {
+			/* Output pixel o covers [o * in, (o + 1) * in) in units of 1 / out */
+			uint64_t start = o * in;
+			uint64_t end = start + in;
+			for (size_t i = start / out; i * out < end; ++i) {
+				uint64_t covered = min<uint64_t>(end, (i + 1) * out) - max<uint64_t>(start, i * out);
+				addTap(taps, i, covered, in);
+			}
+			break;
+		}
+		case Image::Filter::BILINEAR: {
+			/* Pixel centers line up, as in OpenCV: the source position is
+			 * (o + 0.5) * in / out - 0.5, here in units of 1 / (2 * out) */
+			int64_t position = int64_t(2 * o + 1) * in - out;
+			if (position < 0) {
+				position = 0;
+			}
+			size_t i = position / (2 * out);
+			uint64_t fraction = position % (2 * out);
+			if (i + 1 >= in) {
+				addTap(taps, in - 1, 1, 1);
+			} else {
+				addTap(taps, i, 2 * out - fraction, 2 * out);
+				addTap(taps, i + 1, fraction, 2 * out);
+			}
+			break;
+		}
+		}
+		finishTaps(taps);
+	}
+	taps->first.push_back(taps->index.size());
+}
+
+void Resampler::prepare(size_t inWidth, size_t inHeight, size_t outWidth, size_t outHeight, Image::Filter filter) {
+	if (inWidth == m_inWidth && inHeight == m_inHeight && outWidth == m_outWidth && outHeight == m_outHeight && filter == m_filter && !m_rows.first.empty()) {
+		return;
+	}
+	buildTaps(&m_columns, inWidth, outWidth, filter);
+	buildTaps(&m_rows, inHeight, outHeight, filter);
+	m_inWidth = inWidth;
+	m_inHeight = inHeight;
+	m_outWidth = outWidth;
+	m_outHeight = outHeight;
+	m_filter = filter;
+}
+
+/* Sums the column taps of each output pixel across the planes of a row. Both
+ * passes keep their fractional bits, so this is the only place that rounds */
+template<size_t Channels>
+static void resampleRow(const uint32_t* planes, const Resampler::Taps& columns, uint8_t* out, size_t w, size_t plane) {
+	const size_t* first = columns.first.data();
+	const size_t* index = columns.index.data();
+	const uint32_t* weight = columns.weight.data();
+	for (size_t x = 0; x < w; ++x) {
+		uint64_t sum[Channels] = {};
+		for (size_t t = first[x]; t < first[x + 1]; ++t) {
+			for (size_t c = 0; c < Channels; ++c) {
+				sum[c] += uint64_t(planes[index[t] + plane * c]) * weight[t];
+			}
+		}
+		for (size_t c = 0; c < Channels; ++c) {
+			out[c] = (sum[c] + (1ULL << (RESAMPLE_WEIGHT_BITS * 2 - 1))) >> (RESAMPLE_WEIGHT_BITS * 2);
+		}
+		out += Channels;
+	}
+}
+
+void Image::resizeTo(Image* other, Filter filter) {
+	Resampler resampler;
+	resizeTo(other, filter, &resampler);
+}
+
+void Image::resizeTo(Image* other, Filter filter, Resampler* resampler) {
+	if (!m_w || !m_h || !other->m_w || !other->m_h) {
+		throw invalid_argument("Cannot resize an empty image");
+	}
+	bool gray;
+	switch (other->m_format) {
+	case Image::Format::RGB888:
+		gray = false;
+		break;
+	case Image::Format::G8:
+		gray = true;
+		break;
+	default:
+		throw logic_error("unimplemented conversion");
+	}
+	if (m_format != Image::Format::RGB565 && m_format != Image::Format::RGB1555 && m_format != Image::Format::RGBX888) {
+		throw logic_error("unimplemented conversion");
+	}
+
+	/* Rows are summed into planes with the vector kernels, which leaves
+	 * only as many horizontal sums as there are output pixels */
+	resampler->prepare(m_w, m_h, other->m_w, other->m_h, filter);
+	const Resampler::Taps& columns = resampler->m_columns;
+	const Resampler::Taps& rows = resampler->m_rows;
+	size_t channels = gray ? 1 : 3;
+	vector<uint32_t>& planes = resampler->m_planes;
+	vector<uint16_t>& repacked = resampler->m_repacked;
+	planes.resize(m_w * channels);
+	repacked.resize(m_format == Image::Format::RGB1555 ? m_w : 0);
+	const ImageKernelTable* kernels = activeKernelTable().load(memory_order_relaxed);
+	const uint8_t* in = static_cast<const uint8_t*>(m_constBuffer);
+	for (size_t y = 0; y < other->m_h; ++y) {
+		fill(planes.begin(), planes.end(), 0);
+		for (size_t t = rows.first[y]; t < rows.first[y + 1]; ++t) {
+			const void* row = &in[m_stride * rows.index[t]];
+			if (m_format == Image::Format::RGB1555) {
+				repackRow1555(static_cast<const uint16_t*>(row), repacked.data(), m_w);
+				kernels->imageAccumulate565(repacked.data(), rows.weight[t], planes.data(), m_w, gray);
+			} else if (m_format == Image::Format::RGB565) {
+				kernels->imageAccumulate565(static_cast<const uint16_t*>(row), rows.weight[t], planes.data(), m_w, gray);
+			} else {
+				kernels->imageAccumulateX888(static_cast<const uint32_t*>(row), rows.weight[t], planes.data(), m_w, gray);
+			}
+		}
+		uint8_t* out = &static_cast<uint8_t*>(other->m_buffer)[other->m_stride * y];
+		if (gray) {
+			resampleRow<1>(planes.data(), columns, out, other->m_w, m_w);
+		} else {
+			resampleRow<3>(planes.data(), columns, out, other->m_w, m_w);
+		}
+	}
+}
+
+template<typename T, typename F>
+static void maxRowsToX888(const T* in, const T* old, uint32_t* out, size_t w, size_t h, size_t stride, size_t outStride, F expand) {
+	for (size_t y = 0; y < h; ++y) {
+		for (size_t x = 0; x < w; ++x) {
+			uint32_t a = expand(in[x]);
+			uint32_t b = expand(old[x]);
+			out[x] = 0xFF000000 | max(a & 0xFF0000, b & 0xFF0000) | max(a & 0xFF00, b & 0xFF00) | max(a & 0xFF, b & 0xFF);
+		}
+		in += stride / sizeof(T);
+		old += stride / sizeof(T);
+		out += outStride / 4;
+	}
+}
+
+template<typename T, typename F>
+static void meanRowsToX888(const T* in, const T* old, uint32_t* out, size_t w, size_t h, size_t stride, size_t outStride, F expand) {
+	for (size_t y = 0; y < h; ++y) {
+		for (size_t x = 0; x < w; ++x) {
+			uint32_t a = expand(in[x]);
+			uint32_t b = expand(old[x]);
+			/* Rounded average of every byte at once */
+			out[x] = 0xFF000000 | (((a | b) - (((a ^ b) & 0xFEFEFEFE) >> 1)) & 0xFFFFFF);
+		}
+		in += stride / sizeof(T);
+		old += stride / sizeof(T);
+		out += outStride / 4;
+	}
+}
+
+static inline uint32_t expand565(uint16_t rgb) {
+	return ((rgb & 0xF800) << 8) | ((rgb & 0x07E0) << 5) | ((rgb & 0x001F) << 3);
+}
+
+static inline uint32_t expand1555(uint16_t rgb) {
+	return ((rgb & 0x7C00) << 9) | ((rgb & 0x03E0) << 6) | ((rgb & 0x001F) << 3);
+}
+
+static inline uint32_t expandX888(uint32_t xrgb) {
+	return xrgb;
+}
+
+void Image::poolTo(Image* other, const Image* previous, Pool pool) {
+	if (m_w != other->m_w || m_h != other->m_h) {
+		throw invalid_argument("Image dimensions don't match");
+	}
+	if (previous->m_w != m_w || previous->m_h != m_h || previous->m_stride != m_stride || previous->m_format != m_format) {
+		throw invalid_argument("Previous image doesn't match");
+	}
+	bool mean = pool == Pool::MEAN;
+	switch (other->m_format) {
+	case Image::Format::RGB888: {
+		const ImageKernelTable* kernels = activeKernelTable().load(memory_order_relaxed);
+		switch (m_format) {
+		case Image::Format::RGB565:
+			kernels->imagePool565To888(static_cast<const uint16_t*>(m_constBuffer), static_cast<const uint16_t*>(previous->m_constBuffer), static_cast<uint8_t*>(other->m_buffer), m_w, m_h, m_stride, mean);
+			return;
+		case Image::Format::RGB1555: {
+			/* Both frames are repacked a band at a time to share the 565 kernel */
+			uint8_t* out = static_cast<uint8_t*>(other->m_buffer);
+			const uint8_t* old = static_cast<const uint8_t*>(previous->m_constBuffer);
+			vector<uint16_t> oldBand(m_w * min(m_h, REPACK_ROWS));
+			repack1555(m_constBuffer, m_w, m_h, m_stride, [&](const uint16_t* band, size_t rows, size_t stride) {
+				for (size_t row = 0; row < rows; ++row) {
+					repackRow1555(reinterpret_cast<const uint16_t*>(&old[m_stride * row]), &oldBand[m_w * row], m_w);
+				}
+				kernels->imagePool565To888(band, oldBand.data(), out, m_w, rows, stride, mean);
+				old += m_stride * rows;
+				out += m_w * rows * 3;
+			});
+			return;
+		}
+		case Image::Format::RGBX888:
+			kernels->imagePoolX888To888(static_cast<const uint32_t*>(m_constBuffer), static_cast<const uint32_t*>(previous->m_constBuffer), static_cast<uint8_t*>(other->m_buffer), m_w, m_h, m_stride, mean);
+			return;
+		default:
+			break;
+		}
+		break;
+	}
+	case Image::Format::RGBX888: {
+		/* Pooling into full width channels keeps the result exact for the
+		 * other conversions to take from there */
+		uint32_t* out = static_cast<uint32_t*>(other->m_buffer);
+		switch (m_format) {
+		case Image::Format::RGB565: {
+			const uint16_t* in = static_cast<const uint16_t*>(m_constBuffer);
+			const uint16_t* old = static_cast<const uint16_t*>(previous->m_constBuffer);
+			if (mean) {
+				meanRowsToX888(in, old, out, m_w, m_h, m_stride, other->m_stride, expand565);
+			} else {
+				maxRowsToX888(in, old, out, m_w, m_h, m_stride, other->m_stride, expand565);
+			}
+			return;
+		}
+		case Image::Format::RGB1555: {
+			const uint16_t* in = static_cast<const uint16_t*>(m_constBuffer);
+			const uint16_t* old = static_cast<const uint16_t*>(previous->m_constBuffer);
+			if (mean) {
+				meanRowsToX888(in, old, out, m_w, m_h, m_stride, other->m_stride, expand1555);
+			} else {
+				maxRowsToX888(in, old, out, m_w, m_h, m_stride, other->m_stride, expand1555);
+			}
+			return;
+		}
+		case Image::Format::RGBX888: {
+			const uint32_t* in = static_cast<const uint32_t*>(m_constBuffer);
+			const uint32_t* old = static_cast<const uint32_t*>(previous->m_constBuffer);
+			if (mean) {
+				meanRowsToX888(in, old, out, m_w, m_h, m_stride, other->m_stride, expandX888);
+			} else {
+				maxRowsToX888(in, old, out, m_w, m_h, m_stride, other->m_stride, expandX888);
+			}
+			return;
+		}
+		default:
+			break;
+		}
+		break;
+	}
+	default:
+		break;
+	}
+	throw logic_error("unimplemented conversion");
+}
+
+/* Finds where a run of the same pixel ends. Frames of older consoles are
+ * mostly long runs, which then need only one palette lookup each */
+static inline size_t runEnd(const uint16_t* in, size_t x, size_t w, uint16_t pixel) {
+#ifdef __SSSE3__
+	const __m128i run = _mm_set1_epi16(pixel);
+	for (; x + 7 < w; x += 8) {
+		__m128i pix = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&in[x]));
+		unsigned same = _mm_movemask_epi8(_mm_cmpeq_epi16(pix, run));
+		if (same != 0xFFFF) {
+			return x + __builtin_ctz(~same) / 2;
+		}
+	}
+#endif
+	while (x < w && in[x] == pixel) {
+		++x;
+	}
+	return x;
+}
+
+/* The unused byte of 0RGB888 is ignored */
+static inline size_t runEnd(const uint32_t* in, size_t x, size_t w, uint32_t pixel) {
+	pixel &= 0xFFFFFF;
+#ifdef __SSSE3__
+	const __m128i run = _mm_set1_epi32(pixel);
+	const __m128i mask = _mm_set1_epi32(0xFFFFFF);
+	for (; x + 3 < w; x += 4) {
+		__m128i pix = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&in[x])), mask);
+		unsigned same = _mm_movemask_epi8(_mm_cmpeq_epi32(pix, run));
+		if (same != 0xFFFF) {
+			return x + __builtin_ctz(~same) / 4;
+		}
+	}
+#endif
+	while (x < w && (in[x] & 0xFFFFFF) == pixel) {
+		++x;
+	}
+	return x;
+}
+
+template<typename T, typename F>
+static void indexRows(const T* in, uint8_t* out, size_t w, size_t h, size_t stride, size_t outStride, Palette* palette, F expand) {
+	for (size_t y = 0; y < h; ++y) {
+		for (size_t x = 0; x < w;) {
+			uint8_t index = palette->index(expand(in[x]) & 0xFFFFFF);
+			size_t end = runEnd(in, x + 1, w, in[x]);
+			for (; x < end; ++x) {
+				out[x] = index;
+			}
+		}
+		in += stride / sizeof(T);
+		out += outStride;
+	}
+}
+
+void Image::indexTo(Image* other, Palette* palette) {
+	if (m_w != other->m_w || m_h != other->m_h) {
+		throw invalid_argument("Image dimensions don't match");
+	}
+	if (other->m_format != Image::Format::P8) {
+		throw logic_error("unimplemented conversion");
+	}
+	uint8_t* out = static_cast<uint8_t*>(other->m_buffer);
 	switch (m_format) {
 	case Image::Format::RGB565:
-		depth = 2;
+		indexRows(static_cast<const uint16_t*>(m_constBuffer), out, m_w, m_h, m_stride, other->m_stride, palette, expand565);
 		break;
-	case Image::Format::RGB888:
-		depth = 3;
+	case Image::Format::RGB1555:
+		indexRows(static_cast<const uint16_t*>(m_constBuffer), out, m_w, m_h, m_stride, other->m_stride, palette, expand1555);
 		break;
 	case Image::Format::RGBX888:
-		depth = 4;
-		break;
-	case Image::Format::G8:
+		indexRows(static_cast<const uint32_t*>(m_constBuffer), out, m_w, m_h, m_stride, other->m_stride, palette, expandX888);
 		break;
+	default:
+		throw logic_error("unimplemented conversion");
 	}
-	if (m_stride == other->m_stride) {
-		memcpy(other->m_buffer, m_constBuffer, m_stride * m_h);
+}
+
+void Palette::clear() {
+	for (size_t i = 0; i < SLOTS; ++i) {
+		m_keys[i] = EMPTY;
+	}
+	m_size = 0;
+	m_lastColor = EMPTY;
+	m_lastIndex = 0;
+}
+
+uint8_t Palette::lookup(uint32_t rgb) {
+	size_t slot = (rgb * 0x9E3779B1U) >> 23;
+	while (m_keys[slot] != EMPTY) {
+		if (m_keys[slot] == rgb) {
+			return m_indices[slot];
+		}
+		slot = (slot + 1) % SLOTS;
+	}
+	if (m_size == 256) {
+		throw length_error("Palette has more than 256 colors");
+	}
+	m_keys[slot] = rgb;
+	m_indices[slot] = m_size;
+	m_colors[m_size * 3] = rgb >> 16;
+	m_colors[m_size * 3 + 1] = rgb >> 8;
+	m_colors[m_size * 3 + 2] = rgb;
+	return m_size++;
+}
+
+void Image::copyDirectlyTo(Image* other) {
+	size_t depth = Image::depth(m_format);
+	if (m_stride == other->m_stride && m_stride == depth * m_w) {
+		memcpy(other->m_buffer, m_constBuffer, depth * m_w * m_h);
 	} else {
 		const uint8_t* in = static_cast<const uint8_t*>(m_constBuffer);
 		uint8_t* out = static_cast<uint8_t*>(other->m_buffer);
 		for (size_t y = 0; y < m_h; ++y) {
-			memcpy(&out[other->m_stride * y], &in[m_stride * y], depth * y * m_w);
+			memcpy(&out[other->m_stride * y], &in[m_stride * y], depth * m_w);
 		}
 	}
 }
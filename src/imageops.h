@@ -2,23 +2,65 @@
 
 #include <cstdint>
 #include <cstddef>
+#include <vector>
 
 namespace Retro {
 
+class Palette;
+class Resampler;
+
 class Image {
 public:
 	enum class Format {
 		RGB565,
+		// 0RGB1555, libretro's default format
+		RGB1555,
 		RGB888,
 		RGBX888,
-		G8
+		G8,
+		// Indices into a Palette
+		P8
+	};
+
+	enum class Filter {
+		NEAREST,
+		AREA,
+		BILINEAR
+	};
+
+	enum class Pool {
+		MAX,
+		MEAN
+	};
+
+	enum class Kernels {
+		SCALAR,
+		SSSE3,
+		AVX2,
+		AVX512,
+		NEON
 	};
 
+	static bool supportsKernels(Kernels);
+	static Kernels bestKernels();
+	static void useKernels(Kernels);
+	static Kernels activeKernels();
+
 	Image() {}
 	Image(Format, const void* in, size_t w, size_t h, size_t stride);
 	Image(Format, void* in, size_t w, size_t h, size_t stride);
 	Image(const Image&) = default;
 
+	static size_t depth(Format);
+
+	Format format() const { return m_format; }
+	size_t width() const { return m_w; }
+	size_t height() const { return m_h; }
+	size_t stride() const { return m_stride; }
+	const void* data() const { return m_constBuffer; }
+
+	Image crop(size_t x, size_t y, size_t w, size_t h) const;
+
 	void copyTo(Image* other);
 	void halveTo(Image* other);
 	void halveToInterlace(Image* other, const Image* old);
@@ -27,6 +69,21 @@ public:
 	void divideTo(int divisor, Image* other);
 	void divideToInterlace(int divisor, Image* other, const Image* old);
 
+	// Resamples to the other image's size, which can be anything. Area
+	// averaging is meant for shrinking and is bilinear when enlarging
+	void resizeTo(Image* other, Filter = Filter::AREA);
+	// Reuses the weights of an earlier resize of the same sizes and filter
+	void resizeTo(Image* other, Filter, Resampler*);
+
+	// Combines each channel with the previous frame while converting to RGB888
+	// or RGBX888, which keeps sprites that flicker on alternate frames. The
+	// previous frame needs the same format, size and stride
+	void poolTo(Image* other, const Image* previous, Pool = Pool::MAX);
+
+	// Writes the index of each pixel's colour into a P8 image, adding colours
+	// the palette hasn't seen yet
+	void indexTo(Image* other, Palette*);
+
 private:
 	void copyDirectlyTo(Image* other);
 
@@ -37,4 +94,69 @@ private:
 	size_t m_stride;
 	Format m_format;
 };
+
+// Numbers each distinct colour in the order it's first seen, for up to 256
+// colours. Indices stay the same until the palette is cleared, so that one
+// palette can cover a whole episode
+class Palette {
+public:
+	Palette() { clear(); }
+
+	void clear();
+	size_t size() const { return m_size; }
+	// RGB888 colour of each index
+	const uint8_t* colors() const { return m_colors; }
+
+	// Takes a 0RGB888 colour. Throws length_error when a 257th colour is seen
+	uint8_t index(uint32_t rgb) {
+		if (rgb != m_lastColor || !m_size) {
+			m_lastIndex = lookup(rgb);
+			m_lastColor = rgb;
+		}
+		return m_lastIndex;
+	}
+
+private:
+	uint8_t lookup(uint32_t rgb);
+
+	static const size_t SLOTS = 512;
+	static const uint32_t EMPTY = 0xFFFFFFFF;
+
+	// Open addressing, at most half full
+	uint32_t m_keys[SLOTS];
+	uint8_t m_indices[SLOTS];
+	uint8_t m_colors[256 * 3];
+	size_t m_size;
+	uint32_t m_lastColor;
+	uint8_t m_lastIndex;
+};
+
+// Holds the source pixels and weights of a resize, with the rows it sums
+// into, so that resizing frames of one size only builds them once
+class Resampler {
+public:
+	// Source pixels and fixed point weights that make up each output pixel
+	// along one axis. The weights of each output pixel add up to exactly 1
+	struct Taps {
+		std::vector<size_t> first;
+		std::vector<size_t> index;
+		std::vector<uint32_t> weight;
+	};
+
+	// Rebuilds the taps unless they were made for the same sizes and filter
+	void prepare(size_t inWidth, size_t inHeight, size_t outWidth, size_t outHeight, Image::Filter);
+
+private:
+	friend class Image;
+
+	size_t m_inWidth = 0;
+	size_t m_inHeight = 0;
+	size_t m_outWidth = 0;
+	size_t m_outHeight = 0;
+	Image::Filter m_filter = Image::Filter::NEAREST;
+	Taps m_columns;
+	Taps m_rows;
+	std::vector<uint32_t> m_planes;
+	std::vector<uint16_t> m_repacked;
+};
 }
@@ -1,8 +1,17 @@
 #include "memory.h"
 
+#include <algorithm>
 #include <cstdlib>
+#include <cstring>
+#include <type_traits>
 #include <unordered_map>
 
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 using namespace Retro;
 using namespace std;
 
@@ -34,6 +43,7 @@ DataType::DataType(const char* type)
 		  type[0] == '=' ? Endian::NATIVE : type[0] == '>' ? (type[1] == '<' ? Endian::MIXED_BL : type[1] == '=' ? Endian::MIXED_BN : Endian::BIG) : type[0] == '<' ? (type[1] == '>' ? Endian::MIXED_LB : type[1] == '=' ? Endian::MIXED_LN : Endian::LITTLE) : Endian::UNDEF)
 	, repr(static_cast<Repr>(type[strlen(type) - 2]))
 	, type{ type[0], type[1], type[2], type[3] }
+	, m_codec(selectCodec(width, endian, repr))
 	, maskLo(repr == Repr::LN_BCD || repr == Repr::BCD ? 0xF : 0xFF)
 	, maskHi(repr == Repr::BCD ? 0xF0 : 0x0)
 	, cvt(repr == Repr::BCD || repr == Repr::LN_BCD ? 10 : 256) {
@@ -106,27 +116,280 @@ bool DataType::operator!=(const DataType& other) const {
 	return !(*this == other);
 }
 
-void DataType::encode(void* buffer, int64_t value) const {
-	for (size_t i = 0; i < width; ++i) {
-		uint64_t b = (uint64_t) value / shift[i];
-		b = b % cvt + b / cvt % cvt * (~maskHi + 1);
+namespace {
+
+template<typename T>
+inline T byteswap(T value) {
+	T out = 0;
+	for (size_t i = 0; i < sizeof(T); ++i) {
+		out = static_cast<T>(out << 8) | static_cast<uint8_t>(value >> (8 * i));
+	}
+	return out;
+}
+
+#ifdef __GNUC__
+template<>
+inline uint16_t byteswap(uint16_t value) {
+	return __builtin_bswap16(value);
+}
+
+template<>
+inline uint32_t byteswap(uint32_t value) {
+	return __builtin_bswap32(value);
+}
+
+template<>
+inline uint64_t byteswap(uint64_t value) {
+	return __builtin_bswap64(value);
+}
+#endif
+
+// Swaps the two halves of a word, as the mixed-endian types do
+template<typename T>
+inline T rotateHalves(T value) {
+	return sizeof(T) > 1 ? static_cast<T>(value >> (sizeof(T) * 4) | value << (sizeof(T) * 4)) : value;
+}
+
+template<typename T, Endian E>
+inline T toHost(T value) {
+	if (Endian::REAL_NATIVE != Endian::LITTLE) {
+		value = byteswap(value);
+	}
+	switch (E) {
+	case Endian::BIG:
+		return byteswap(value);
+	case Endian::MIXED_BL:
+		return rotateHalves(value);
+	case Endian::MIXED_LB:
+		return rotateHalves(byteswap(value));
+	default:
+		return value;
+	}
+}
+
+template<typename T, Endian E>
+inline T fromHost(T value) {
+	// Every conversion above is its own inverse
+	return toHost<T, E>(value);
+}
+
+/* Plain two's complement or unsigned integers of a power-of-two width are a
+ * single load plus a byte swap, so they skip the generic per-byte loop */
+template<typename T, Endian E, bool Signed>
+struct IntCodec {
+	static int64_t load(const uint8_t* buffer) {
+		T value;
+		memcpy(&value, buffer, sizeof(T));
+		value = toHost<T, E>(value);
+		if (Signed) {
+			return static_cast<typename make_signed<T>::type>(value);
+		}
+		return static_cast<int64_t>(value);
+	}
+
+	static int64_t decode(const DataType&, const void* buffer) {
+		return load(static_cast<const uint8_t*>(buffer));
+	}
+
+	static void encode(const DataType&, void* buffer, int64_t value) {
+		T out = fromHost<T, E>(static_cast<T>(value));
+		memcpy(buffer, &out, sizeof(T));
+	}
+
+	static void decodeMany(const DataType&, const uint8_t* base, const size_t* offsets, size_t count, int64_t* out) {
+		if (offsets) {
+			for (size_t i = 0; i < count; ++i) {
+				out[i] = load(&base[offsets[i]]);
+			}
+		} else {
+			for (size_t i = 0; i < count; ++i) {
+				out[i] = load(&base[i]);
+			}
+		}
+	}
+
+	static const DataType::Codec codec;
+};
+
+template<typename T, Endian E, bool Signed>
+const DataType::Codec IntCodec<T, E, Signed>::codec{ &IntCodec::decode, &IntCodec::encode, &IntCodec::decodeMany };
+
+// Which digit pair (or digit, for LN_BCD) byte i holds, mirroring the shift table
+constexpr size_t digitPosition(size_t width, Endian endian, size_t i) {
+	return endian == Endian::BIG ? width - 1 - i
+		: endian == Endian::MIXED_BL ? (i < width / 2 ? i + width - width / 2 : i - width / 2)
+		: endian == Endian::MIXED_LB ? (i < width / 2 ? width / 2 - 1 - i : width - 1 - i + width / 2)
+		: i;
+}
+
+constexpr int64_t digitShift(int64_t radix, size_t position) {
+	return position ? radix * digitShift(radix, position - 1) : 1;
+}
+
+/* BCD types keep their per-byte loop, but with a constant width, order and
+ * radix the compiler unrolls it and turns the divisions into multiplies */
+template<size_t Width, Endian E, Repr R>
+struct DigitCodec {
+	static int64_t load(const uint8_t* buffer) {
+		int64_t datum = 0;
+		for (size_t i = 0; i < Width; ++i) {
+			uint8_t b = buffer[i];
+			if (R == Repr::BCD) {
+				datum += ((b & 0xF) % 10 + (b >> 4) % 10 * 10) * digitShift(100, digitPosition(Width, E, i));
+			} else {
+				datum += (b & 0xF) % 10 * digitShift(10, digitPosition(Width, E, i));
+			}
+		}
+		return datum;
+	}
+
+	static int64_t decode(const DataType&, const void* buffer) {
+		return load(static_cast<const uint8_t*>(buffer));
+	}
+
+	static void encode(const DataType&, void* buffer, int64_t value) {
+		for (size_t i = 0; i < Width; ++i) {
+			uint64_t b = static_cast<uint64_t>(value) / (R == Repr::BCD ? digitShift(100, digitPosition(Width, E, i)) : digitShift(10, digitPosition(Width, E, i)));
+			static_cast<uint8_t*>(buffer)[i] = R == Repr::BCD ? b % 10 | b / 10 % 10 << 4 : b % 10;
+		}
+	}
+
+	static void decodeMany(const DataType&, const uint8_t* base, const size_t* offsets, size_t count, int64_t* out) {
+		if (offsets) {
+			for (size_t i = 0; i < count; ++i) {
+				out[i] = load(&base[offsets[i]]);
+			}
+		} else {
+			for (size_t i = 0; i < count; ++i) {
+				out[i] = load(&base[i]);
+			}
+		}
+	}
+
+	static const DataType::Codec codec;
+};
+
+template<size_t Width, Endian E, Repr R>
+const DataType::Codec DigitCodec<Width, E, R>::codec{ &DigitCodec::decode, &DigitCodec::encode, &DigitCodec::decodeMany };
+
+template<typename T, bool Signed>
+const DataType::Codec* selectIntCodec(Endian endian) {
+	switch (endian) {
+	case Endian::LITTLE:
+	default:
+		return &IntCodec<T, Endian::LITTLE, Signed>::codec;
+	case Endian::BIG:
+		return &IntCodec<T, Endian::BIG, Signed>::codec;
+	case Endian::MIXED_BL:
+		return &IntCodec<T, Endian::MIXED_BL, Signed>::codec;
+	case Endian::MIXED_LB:
+		return &IntCodec<T, Endian::MIXED_LB, Signed>::codec;
+	}
+}
+
+template<bool Signed>
+const DataType::Codec* selectIntCodec(size_t width, Endian endian) {
+	switch (width) {
+	case 1:
+		return selectIntCodec<uint8_t, Signed>(endian);
+	case 2:
+		return selectIntCodec<uint16_t, Signed>(endian);
+	case 4:
+		return selectIntCodec<uint32_t, Signed>(endian);
+	case 8:
+		return selectIntCodec<uint64_t, Signed>(endian);
+	default:
+		return nullptr;
+	}
+}
+
+template<size_t Width, Repr R>
+const DataType::Codec* selectDigitCodec(Endian endian) {
+	switch (endian) {
+	case Endian::LITTLE:
+	default:
+		return &DigitCodec<Width, Endian::LITTLE, R>::codec;
+	case Endian::BIG:
+		return &DigitCodec<Width, Endian::BIG, R>::codec;
+	case Endian::MIXED_BL:
+		return &DigitCodec<Width, Endian::MIXED_BL, R>::codec;
+	case Endian::MIXED_LB:
+		return &DigitCodec<Width, Endian::MIXED_LB, R>::codec;
+	}
+}
+
+template<Repr R>
+const DataType::Codec* selectDigitCodec(size_t width, Endian endian) {
+	switch (width) {
+	case 1:
+		return selectDigitCodec<1, R>(endian);
+	case 2:
+		return selectDigitCodec<2, R>(endian);
+	case 3:
+		return selectDigitCodec<3, R>(endian);
+	case 4:
+		return selectDigitCodec<4, R>(endian);
+	case 5:
+		return selectDigitCodec<5, R>(endian);
+	case 6:
+		return selectDigitCodec<6, R>(endian);
+	case 7:
+		return selectDigitCodec<7, R>(endian);
+	case 8:
+		return selectDigitCodec<8, R>(endian);
+	default:
+		return nullptr;
+	}
+}
+
+}
+
+const DataType::Codec* DataType::selectCodec(size_t width, Endian endian, Repr repr) {
+	static const Codec generic{ &DataType::decodeGeneric, &DataType::encodeGeneric, &DataType::decodeManyGeneric };
+	const Codec* codec = nullptr;
+	if (repr == Repr::SIGNED) {
+		codec = selectIntCodec<true>(width, reduce(endian));
+	} else if (repr == Repr::UNSIGNED) {
+		codec = selectIntCodec<false>(width, reduce(endian));
+	} else if (repr == Repr::BCD) {
+		codec = selectDigitCodec<Repr::BCD>(width, reduce(endian));
+	} else if (repr == Repr::LN_BCD) {
+		codec = selectDigitCodec<Repr::LN_BCD>(width, reduce(endian));
+	}
+	return codec ? codec : &generic;
+}
+
+void DataType::decodeMany(const void* base, const size_t* offsets, size_t count, int64_t* out) const {
+	m_codec->decodeMany(*this, static_cast<const uint8_t*>(base), offsets, count, out);
+}
+
+void DataType::encodeGeneric(const DataType& type, void* buffer, int64_t value) {
+	for (size_t i = 0; i < type.width; ++i) {
+		uint64_t b = (uint64_t) value / type.shift[i];
+		b = b % type.cvt + b / type.cvt % type.cvt * (~type.maskHi + 1);
 		static_cast<uint8_t*>(buffer)[i] = b;
 	}
 }
 
-int64_t DataType::decode(const void* buffer) const {
+int64_t DataType::decodeGeneric(const DataType& type, const void* buffer) {
 	int64_t datum = 0;
-	for (size_t i = 0; i < width; ++i) {
+	for (size_t i = 0; i < type.width; ++i) {
 		uint8_t b = static_cast<const uint8_t*>(buffer)[i];
-		datum += ((b & maskLo) % cvt + ((b & maskHi) >> 4) % cvt * 10) * shift[i];
+		datum += ((b & type.maskLo) % type.cvt + ((b & type.maskHi) >> 4) % type.cvt * 10) * type.shift[i];
 	}
-	if (repr == Repr::SIGNED) {
-		datum <<= 8 * (8 - width);
-		datum >>= 8 * (8 - width);
+	if (type.repr == Repr::SIGNED) {
+		datum <<= 8 * (8 - type.width);
+		datum >>= 8 * (8 - type.width);
 	}
 	return datum;
 }
 
+void DataType::decodeManyGeneric(const DataType& type, const uint8_t* base, const size_t* offsets, size_t count, int64_t* out) {
+	for (size_t i = 0; i < count; ++i) {
+		out[i] = decodeGeneric(type, &base[offsets ? offsets[i] : i]);
+	}
+}
+
 size_t hash<DataType>::operator()(const DataType& type) const {
 	return hash<uint32_t>()(*reinterpret_cast<const uint32_t*>(type.type));
 }
@@ -182,6 +445,49 @@ void MemoryOverlay::unparse(void* out, size_t offset, const void* in, size_t siz
 	}
 }
 
+void MemoryOverlay::parseBlock(const void* in, void* out, size_t size) const {
+	const uint8_t* src = static_cast<const uint8_t*>(in);
+	uint8_t* dst = static_cast<uint8_t*>(out);
+	Endian backing = reduce(m_backing.endian);
+	Endian real = reduce(m_real.endian);
+	if (width <= 1 || backing == real) {
+		memcpy(dst, src, size);
+		return;
+	}
+	size_t words = size - size % width;
+	size_t i = 0;
+	bool swap = (backing == Endian::LITTLE && real == Endian::BIG) || (backing == Endian::BIG && real == Endian::LITTLE);
+	if (swap && (width == 2 || width == 4 || width == 8)) {
+#ifdef __SSSE3__
+		uint8_t order[16];
+		for (size_t j = 0; j < sizeof(order); ++j) {
+			order[j] = j - j % width + width - 1 - j % width;
+		}
+		const __m128i shuffle = _mm_loadu_si128(reinterpret_cast<const __m128i*>(order));
+		for (; i + 16 <= words; i += 16) {
+			__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&src[i]));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(&dst[i]), _mm_shuffle_epi8(v, shuffle));
+		}
+#elif defined(__ARM_NEON)
+		for (; i + 16 <= words; i += 16) {
+			uint8x16_t v = vld1q_u8(&src[i]);
+			v = width == 2 ? vrev16q_u8(v) : width == 4 ? vrev32q_u8(v) : vrev64q_u8(v);
+			vst1q_u8(&dst[i], v);
+		}
+#endif
+		for (; i < words; i += width) {
+			for (size_t j = 0; j < width; ++j) {
+				dst[i + j] = src[i + width - 1 - j];
+			}
+		}
+	} else {
+		for (; i < words; i += width) {
+			m_real.encode(&dst[i], m_backing.decode(&src[i]));
+		}
+	}
+	memcpy(&dst[words], &src[words], size - words);
+}
+
 Variant::Variant(int64_t i)
 	: m_type(Type::INT)
 	, m_vi(i) {
@@ -244,19 +550,21 @@ Datum::Datum(void* base, const DataType& type)
 	, m_type(type) {
 }
 
-Datum::Datum(void* base, size_t offset, const DataType& type, const MemoryOverlay& overlay)
+Datum::Datum(void* base, size_t offset, const DataType& type, const MemoryOverlay& overlay, bool* written)
 	: m_base(base)
 	, m_offset(offset)
 	, m_type(type)
-	, m_overlay(overlay) {
+	, m_overlay(overlay)
+	, m_written(written) {
 }
 
-Datum::Datum(void* base, const Variable& var, const MemoryOverlay& overlay)
+Datum::Datum(void* base, const Variable& var, const MemoryOverlay& overlay, bool* written)
 	: m_base(base)
 	, m_offset(var.address)
 	, m_type(var.type)
 	, m_mask(var.mask)
-	, m_overlay(overlay) {
+	, m_overlay(overlay)
+	, m_written(written) {
 }
 
 Datum::Datum(Variant* variant)
@@ -273,6 +581,9 @@ Datum& Datum::operator=(int64_t value) {
 		} else {
 			m_type.encode(m_base, value);
 		}
+		if (m_written) {
+			*m_written = true;
+		}
 	} else if (m_variant) {
 		*m_variant = value;
 	}
@@ -329,6 +640,7 @@ void AddressSpace::addBlock(size_t offset, size_t size, void* data) {
 	} else {
 		m_blocks[offset].open(size);
 	}
+	reindex();
 }
 
 void AddressSpace::addBlock(size_t offset, size_t size, const void* data) {
@@ -337,58 +649,110 @@ void AddressSpace::addBlock(size_t offset, size_t size, const void* data) {
 	} else {
 		m_blocks[offset].open(size);
 	}
+	reindex();
 }
 
 void AddressSpace::addBlock(size_t offset, const MemoryView<>& base) {
 	m_blocks[offset].clone(base);
+	reindex();
 }
 
 void AddressSpace::updateBlock(size_t offset, void* data) {
 	m_blocks[offset].open(data, m_blocks[offset].size());
+	reindex();
 }
 
 void AddressSpace::updateBlock(size_t offset, const void* data) {
 	m_blocks[offset].clone(data, m_blocks[offset].size());
+	reindex();
 }
 
 void AddressSpace::updateBlock(size_t offset, const MemoryView<>& base) {
 	m_blocks[offset].clone(base);
+	reindex();
 }
 
-bool AddressSpace::hasBlock(size_t offset) const {
-	for (const auto& block : m_blocks) {
-		if (offset < block.first) {
+void AddressSpace::reindex() {
+	++m_generation;
+	m_index.clear();
+	size_t end = 0;
+	for (auto& kv : m_blocks) {
+		// Where blocks overlap the lower one wins, matching the old linear walk
+		size_t begin = max(kv.first, end);
+		if (kv.first + kv.second.size() <= begin) {
 			continue;
 		}
-		if (offset < block.first + block.second.size()) {
-			return true;
-		}
+		end = kv.first + kv.second.size();
+		m_index.push_back({ begin, end, kv.first, &kv.second });
 	}
-	return false;
 }
 
-const MemoryView<>& AddressSpace::block(size_t offset) const {
-	for (const auto& block : m_blocks) {
-		if (offset < block.first) {
-			continue;
+const AddressSpace::Range* AddressSpace::find(size_t offset) const {
+	auto iter = upper_bound(m_index.begin(), m_index.end(), offset, [](size_t offset, const Range& range) {
+		return offset < range.begin;
+	});
+	if (iter == m_index.begin()) {
+		return nullptr;
+	}
+	--iter;
+	if (offset >= iter->end) {
+		return nullptr;
+	}
+	return &*iter;
+}
+
+const void* AddressSpace::resolve(size_t address, size_t* offset) const {
+	const Range* range = find(address);
+	if (!range) {
+		return nullptr;
+	}
+	*offset = address - range->base;
+	return range->view->offset(0);
+}
+
+const AddressSpace& AddressSpace::shadow() const {
+	if (m_overlay->width <= 1) {
+		return *this;
+	}
+	if (!m_shadow || m_shadowGeneration != m_generation) {
+		if (!m_shadow) {
+			m_shadow = make_unique<AddressSpace>();
 		}
-		if (offset < block.first + block.second.size()) {
-			return block.second;
+		m_shadow->reset();
+		for (const auto& kv : m_blocks) {
+			m_shadow->addBlock(kv.first, kv.second.size());
 		}
+		m_shadowGeneration = m_generation;
+		m_shadowDirty = true;
+	}
+	if (m_shadowDirty) {
+		for (const auto& kv : m_blocks) {
+			m_overlay->parseBlock(kv.second.offset(0), m_shadow->m_blocks[kv.first].offset(0), kv.second.size());
+		}
+		m_shadowDirty = false;
+	}
+	return *m_shadow;
+}
+
+bool AddressSpace::hasBlock(size_t offset) const {
+	return find(offset);
+}
+
+const MemoryView<>& AddressSpace::block(size_t offset) const {
+	const Range* range = find(offset);
+	if (!range) {
+		throw std::out_of_range("No known mapping");
 	}
-	throw std::out_of_range("No known mapping");
+	return *range->view;
 }
 
 MemoryView<>& AddressSpace::block(size_t offset) {
-	for (auto& block : m_blocks) {
-		if (offset < block.first) {
-			continue;
-		}
-		if (offset < block.first + block.second.size()) {
-			return block.second;
-		}
+	m_shadowDirty = true;
+	const Range* range = find(offset);
+	if (!range) {
+		throw std::out_of_range("No known mapping");
 	}
-	throw std::out_of_range("No known mapping");
+	return *range->view;
 }
 
 bool AddressSpace::ok() const {
@@ -397,6 +761,7 @@ bool AddressSpace::ok() const {
 
 void AddressSpace::reset() {
 	m_blocks.clear();
+	reindex();
 }
 
 void AddressSpace::clone(const AddressSpace& as) {
@@ -405,77 +770,61 @@ void AddressSpace::clone(const AddressSpace& as) {
 	for (auto& kv : as.m_blocks) {
 		m_blocks[kv.first].clone(kv.second);
 	}
+	reindex();
 }
 
 void AddressSpace::clone() {
 	for (auto& kv : m_blocks) {
 		kv.second.clone();
 	}
+	++m_generation;
 }
 
 void AddressSpace::setOverlay(const MemoryOverlay& overlay) {
 	m_overlay = make_unique<MemoryOverlay>(overlay);
+	m_shadowDirty = true;
 }
 
 Datum AddressSpace::operator[](size_t offset) {
-	for (auto& kv : m_blocks) {
-		if (offset < kv.first) {
-			throw std::out_of_range("No known mapping");
-		}
-		if (offset - kv.first >= kv.second.size()) {
-			continue;
-		}
-		return Datum(kv.second.offset(0), offset - kv.first, s_type, *m_overlay);
+	const Range* range = find(offset);
+	if (!range) {
+		throw std::out_of_range("No known mapping");
 	}
-	throw std::out_of_range("No known mapping");
+	// Only writes through the datum make the shadow stale
+	return Datum(range->view->offset(0), offset - range->base, s_type, *m_overlay, &m_shadowDirty);
 }
 
 Datum AddressSpace::operator[](const Variable& var) {
-	for (auto& kv : m_blocks) {
-		if (var.address < kv.first) {
-			throw std::out_of_range("No known mapping");
-		}
-		if (var.address - kv.first >= kv.second.size()) {
-			continue;
-		}
-		return Datum(kv.second.offset(0), Variable{ var.type, var.address - kv.first, var.mask }, *m_overlay);
+	const Range* range = find(var.address);
+	if (!range) {
+		throw std::out_of_range("No known mapping");
 	}
-	throw std::out_of_range("No known mapping");
+	return Datum(range->view->offset(0), Variable{ var.type, var.address - range->base, var.mask }, *m_overlay, &m_shadowDirty);
 }
 
 uint8_t AddressSpace::operator[](size_t offset) const {
-	for (const auto& kv : m_blocks) {
-		if (offset < kv.first) {
-			throw std::out_of_range("No known mapping");
-		}
-		if (offset - kv.first >= kv.second.size()) {
-			continue;
-		}
-		uint8_t fakeBase[16]{};
-		return s_type.decode(m_overlay->parse(kv.second.offset(0), offset - kv.first, reinterpret_cast<void*>(fakeBase), s_type.width));
+	const Range* range = find(offset);
+	if (!range) {
+		throw std::out_of_range("No known mapping");
 	}
-	throw std::out_of_range("No known mapping");
+	uint8_t fakeBase[16]{};
+	return s_type.decode(m_overlay->parse(range->view->offset(0), offset - range->base, reinterpret_cast<void*>(fakeBase), s_type.width));
 }
 
 int64_t AddressSpace::operator[](const Variable& var) const {
-	for (const auto& kv : m_blocks) {
-		if (var.address < kv.first) {
-			throw std::out_of_range("No known mapping");
-		}
-		if (var.address - kv.first >= kv.second.size()) {
-			continue;
-		}
-		int64_t value;
-		if (m_overlay->width > 1) {
-			uint8_t fakeBase[16];
-			value = var.type.decode(m_overlay->parse(kv.second.offset(0), var.address - kv.first, reinterpret_cast<void*>(fakeBase), var.type.width));
-		} else {
-			value = var.type.decode(kv.second.offset(var.address - kv.first));
-		}
-		value &= var.mask;
-		return value;
+	const Range* range = find(var.address);
+	if (!range) {
+		throw std::out_of_range("No known mapping");
+	}
+	int64_t value;
+	if (m_overlay->width > 1) {
+		uint8_t fakeBase[16];
+		value = var.type.decode(m_overlay->parse(range->view->offset(0), var.address - range->base, reinterpret_cast<void*>(fakeBase), var.type.width));
+	} else {
+		value = var.type.decode(range->view->offset(var.address - range->base));
 	}
-	throw std::out_of_range("No known mapping");
+	value &= var.mask;
+	return value;
 }
 
 AddressSpace& AddressSpace::operator=(AddressSpace&& as) {
@@ -485,6 +834,8 @@ AddressSpace& AddressSpace::operator=(AddressSpace&& as) {
 		m_blocks[kv.first] = move(as.m_blocks[kv.first]);
 	}
 	as.m_blocks.clear();
+	as.reindex();
+	reindex();
 	return *this;
 }
 
@@ -6,6 +6,7 @@
 #include <map>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include <fcntl.h>
 #ifndef _WIN32
@@ -277,8 +278,18 @@ public:
 	bool operator==(const DataType&) const;
 	bool operator!=(const DataType&) const;
 
-	void encode(void* buffer, int64_t value) const;
-	int64_t decode(const void* buffer) const;
+	void encode(void* buffer, int64_t value) const { m_codec->encode(*this, buffer, value); }
+	int64_t decode(const void* buffer) const { return m_codec->decode(*this, buffer); }
+
+	/* Decodes base + offsets[i] into out[i] for count values, or every byte offset
+	 * in [0, count) when offsets is null */
+	void decodeMany(const void* base, const size_t* offsets, size_t count, int64_t* out) const;
+
+	struct Codec {
+		int64_t (*decode)(const DataType&, const void*);
+		void (*encode)(const DataType&, void*, int64_t);
+		void (*decodeMany)(const DataType&, const uint8_t*, const size_t*, size_t, int64_t*);
+	};
 
 	const size_t width;
 	const Endian endian;
@@ -295,7 +306,15 @@ private:
 	FRIEND_TEST(DataTypeShift, 6);
 	FRIEND_TEST(DataTypeShift, 7);
 	FRIEND_TEST(DataTypeShift, 8);
+	FRIEND_TEST(DataTypeCodec, Generic);
+	FRIEND_TEST(DataTypeCodec, DISABLED_Benchmark);
 
+	static const Codec* selectCodec(size_t width, Endian, Repr);
+	static int64_t decodeGeneric(const DataType&, const void*);
+	static void encodeGeneric(const DataType&, void*, int64_t);
+	static void decodeManyGeneric(const DataType&, const uint8_t*, const size_t*, size_t, int64_t*);
+
+	const Codec* m_codec;
 	const uint8_t maskLo;
 	const uint8_t maskHi;
 	const unsigned cvt;
@@ -320,6 +339,9 @@ public:
 	void* parse(const void* in, size_t offset, void* out, size_t size) const;
 	void unparse(void* out, size_t offset, const void* in, size_t size) const;
 
+	// Parses a whole buffer at once, copying any trailing partial word as is
+	void parseBlock(const void* in, void* out, size_t size) const;
+
 	const size_t width;
 
 private:
@@ -382,8 +404,9 @@ class Datum {
 public:
 	Datum() {}
 	Datum(void*, const DataType&);
-	Datum(void* base, const Variable&, const MemoryOverlay& overlay = {});
-	Datum(void* base, size_t offset, const DataType&, const MemoryOverlay& overlay = {});
+	/* written, if given, is set whenever a value is assigned through the datum */
+	Datum(void* base, const Variable&, const MemoryOverlay& overlay = {}, bool* written = nullptr);
+	Datum(void* base, size_t offset, const DataType&, const MemoryOverlay& overlay = {}, bool* written = nullptr);
 	Datum(Variant*);
 
 	Datum& operator=(int64_t);
@@ -398,6 +421,7 @@ private:
 	const uint64_t m_mask = UINT64_MAX;
 	const MemoryOverlay m_overlay{};
 	Variant* m_variant = nullptr;
+	bool* m_written = nullptr;
 };
 
 class DynamicMemoryView {
@@ -428,7 +452,18 @@ public:
 	MemoryView<>& block(size_t offset);
 
 	const std::map<size_t, MemoryView<>>& blocks() const { return m_blocks; }
-	std::map<size_t, MemoryView<>>& blocks() { return m_blocks; }
+
+	/* Returns the base of the block containing address, or nullptr if unmapped.
+	 * The pointer stays valid until generation() changes. */
+	const void* resolve(size_t address, size_t* offset) const;
+	uint64_t generation() const { return m_generation; }
+
+	/* A copy of this space with every block parsed through the overlay, so reads
+	 * are plain loads. A space without an overlay is its own shadow. The copy is
+	 * refreshed on first use after invalidateShadow(), a write through a Datum,
+	 * a mutable block() access or a layout change. */
+	const AddressSpace& shadow() const;
+	void invalidateShadow() { m_shadowDirty = true; }
 
 	bool ok() const;
 	void reset();
@@ -446,9 +481,25 @@ public:
 	AddressSpace& operator=(AddressSpace&&);
 
 private:
+	/* Sorted, non-overlapping [begin, end) spans into m_blocks, rebuilt whenever the block layout changes */
+	struct Range {
+		size_t begin;
+		size_t end;
+		size_t base;
+		MemoryView<>* view;
+	};
+
+	void reindex();
+	const Range* find(size_t offset) const;
+
 	static const DataType s_type;
-	;
 	std::map<size_t, MemoryView<>> m_blocks;
+	std::vector<Range> m_index;
+	uint64_t m_generation = 0;
+
+	mutable std::unique_ptr<AddressSpace> m_shadow;
+	mutable uint64_t m_shadowGeneration = 0;
+	mutable bool m_shadowDirty = true;
 	std::unique_ptr<MemoryOverlay> m_overlay = std::make_unique<MemoryOverlay>();
 };
 
@@ -0,0 +1,428 @@
+#include "observation.h"
+#include "imageops-kernels.h"
+
+#include <cstring>
+#include <stdexcept>
+
+using namespace Retro;
+using namespace std;
+
+namespace {
+
+struct Pixel565 {
+	typedef uint16_t Type;
+	static inline void decode(uint16_t rgb, uint8_t* out) {
+		out[0] = (rgb & 0xF800) >> 8;
+		out[1] = (rgb & 0x07E0) >> 3;
+		out[2] = (rgb & 0x001F) << 3;
+	}
+};
+
+struct Pixel1555 {
+	typedef uint16_t Type;
+	static inline void decode(uint16_t rgb, uint8_t* out) {
+		out[0] = (rgb & 0x7C00) >> 7;
+		out[1] = (rgb & 0x03E0) >> 2;
+		out[2] = (rgb & 0x001F) << 3;
+	}
+};
+
+struct PixelX888 {
+	typedef uint32_t Type;
+	static inline void decode(uint32_t xrgb, uint8_t* out) {
+		out[0] = xrgb >> 16;
+		out[1] = xrgb >> 8;
+		out[2] = xrgb;
+	}
+};
+
+/* Every uint8 value as an output element */
+template<typename T>
+struct OutputValues {
+	T values[256];
+};
+
+}
+
+/* Rounds a float in [0, 1] to the nearest half precision value */
+static uint16_t toHalf(float value) {
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	if (!bits) {
+		return 0;
+	}
+	uint16_t half = ((((bits >> 23) & 0xFF) - 127 + 15) << 10) | ((bits & 0x7FFFFF) >> 13);
+	uint32_t rest = bits & 0x1FFF;
+	if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) {
+		++half;
+	}
+	return half;
+}
+
+static const OutputValues<uint8_t>& uint8Values() {
+	static const OutputValues<uint8_t> table = [] {
+		OutputValues<uint8_t> table;
+		for (unsigned i = 0; i < 256; ++i) {
+			table.values[i] = i;
+		}
+		return table;
+	}();
+	return table;
+}
+
+static const OutputValues<uint16_t>& float16Values() {
+	static const OutputValues<uint16_t> table = [] {
+		OutputValues<uint16_t> table;
+		for (unsigned i = 0; i < 256; ++i) {
+			table.values[i] = toHalf(i / 255.f);
+		}
+		return table;
+	}();
+	return table;
+}
+
+static const OutputValues<float>& float32Values() {
+	static const OutputValues<float> table = [] {
+		OutputValues<float> table;
+		for (unsigned i = 0; i < 256; ++i) {
+			table.values[i] = i / 255.f;
+		}
+		return table;
+	}();
+	return table;
+}
+
+/* Converts a stack of (pixels, channels) to the output type, transposing it
+ * to (channels, pixels) if it's planar */
+template<typename T>
+static void writeValues(const uint8_t* in, T* out, size_t pixels, size_t channels, bool planar, const OutputValues<T>& table) {
+	if (!planar) {
+		for (size_t i = 0; i < pixels * channels; ++i) {
+			out[i] = table.values[in[i]];
+		}
+		return;
+	}
+	for (size_t c = 0; c < channels; ++c) {
+		T* plane = &out[pixels * c];
+		for (size_t i = 0; i < pixels; ++i) {
+			plane[i] = table.values[in[i * channels + c]];
+		}
+	}
+}
+
+/* Drops the oldest frame of a stacked pixel and appends the new one, or fills
+ * every frame with it after a reset */
+template<unsigned Channels>
+static inline void stackPixel(uint8_t* out, const uint8_t* pixel, size_t newest, bool fill) {
+	if (fill) {
+		for (size_t slot = 0; slot <= newest; slot += Channels) {
+			for (unsigned c = 0; c < Channels; ++c) {
+				out[slot + c] = pixel[c];
+			}
+		}
+	} else {
+		for (size_t i = 0; i < newest; ++i) {
+			out[i] = out[i + Channels];
+		}
+		for (unsigned c = 0; c < Channels; ++c) {
+			out[newest + c] = pixel[c];
+		}
+	}
+}
+
+Observation::Observation(size_t width, size_t height, bool grayscale, unsigned stack, Image::Filter filter)
+	: m_width(width)
+	, m_height(height)
+	, m_color(grayscale ? Color::GRAY : Color::RGB)
+	, m_stack(stack)
+	, m_filter(filter) {
+	if (!stack) {
+		throw invalid_argument("Observations need at least one frame");
+	}
+}
+
+void Observation::setOutput(Layout layout, Type type) {
+	if (layout == m_layout && type == m_type) {
+		return;
+	}
+	m_layout = layout;
+	m_type = type;
+	m_frameWidth = 0;
+	m_frameHeight = 0;
+	m_outWidth = 0;
+	m_outHeight = 0;
+}
+
+size_t Observation::elementSize() const {
+	if (m_color == Color::RGB565) {
+		return 2;
+	}
+	switch (m_type) {
+	case Type::UINT8:
+		return 1;
+	case Type::FLOAT16:
+		return 2;
+	case Type::FLOAT32:
+		return 4;
+	}
+	return 0;
+}
+
+void Observation::setColor(Color color) {
+	if (color == m_color) {
+		return;
+	}
+	m_color = color;
+	m_frameWidth = 0;
+	m_frameHeight = 0;
+	m_outWidth = 0;
+	m_outHeight = 0;
+}
+
+void Observation::setCrop(size_t x, size_t y, size_t width, size_t height) {
+	if (x == m_cropX && y == m_cropY && width == m_cropWidth && height == m_cropHeight) {
+		return;
+	}
+	m_cropX = x;
+	m_cropY = y;
+	m_cropWidth = width;
+	m_cropHeight = height;
+	m_frameWidth = 0;
+	m_frameHeight = 0;
+}
+
+void Observation::reset() {
+	m_fill = true;
+	if (m_color == Color::INDEXED) {
+		/* The last frame's indices refer to the old palette */
+		m_palette.clear();
+		m_converted = false;
+	}
+}
+
+bool Observation::setFrameSize(size_t width, size_t height) {
+	if (width == m_frameWidth && height == m_frameHeight) {
+		return false;
+	}
+	if (m_cropX >= width || m_cropY >= height) {
+		throw invalid_argument("Crop is out of bounds");
+	}
+	size_t cropWidth = !m_cropWidth || m_cropX + m_cropWidth > width ? width - m_cropX : m_cropWidth;
+	size_t cropHeight = !m_cropHeight || m_cropY + m_cropHeight > height ? height - m_cropY : m_cropHeight;
+	size_t outWidth = m_width ? m_width : cropWidth;
+	size_t outHeight = m_height ? m_height : cropHeight;
+	bool resized = outWidth != cropWidth || outHeight != cropHeight;
+	if (m_color == Color::INDEXED || m_color == Color::RGB565) {
+		if (resized && m_filter != Image::Filter::NEAREST) {
+			throw invalid_argument("Only nearest sampling keeps colors exact");
+		}
+		if (m_type != Type::UINT8) {
+			throw invalid_argument("Exact colors can't be converted to floats");
+		}
+		if (m_color == Color::RGB565 && m_layout != Layout::HWC) {
+			throw invalid_argument("RGB565 observations have one channel per frame");
+		}
+	}
+
+	/* Sample the source pixel under the center of each output pixel */
+	m_columns.resize(outWidth);
+	for (size_t x = 0; x < outWidth; ++x) {
+		m_columns[x] = m_cropX + (2 * x + 1) * cropWidth / (2 * outWidth);
+	}
+	m_rows.resize(outHeight);
+	for (size_t y = 0; y < outHeight; ++y) {
+		m_rows[y] = m_cropY + (2 * y + 1) * cropHeight / (2 * outHeight);
+	}
+	m_sourceWidth = cropWidth;
+	m_sourceHeight = cropHeight;
+	m_direct = !resized && m_color != Color::GRAY && m_stack == 1;
+	m_resample = resized && m_filter != Image::Filter::NEAREST;
+	m_resampled.resize(m_resample && m_stack > 1 ? outWidth * outHeight * frameChannels() : 0);
+
+	m_frameWidth = width;
+	m_frameHeight = height;
+	m_converted = false;
+	if (outWidth == m_outWidth && outHeight == m_outHeight) {
+		return false;
+	}
+	m_outWidth = outWidth;
+	m_outHeight = outHeight;
+	m_stacked.resize(converts() ? size() : 0);
+	m_fill = true;
+	return true;
+}
+
+void Observation::update(const Image& frame, void* out, const Image* previous, Image::Pool pool) {
+	if (frame.width() != m_frameWidth || frame.height() != m_frameHeight) {
+		throw invalid_argument("Image dimensions don't match");
+	}
+	/* Indexing throws once the palette overflows; don't repeat a partial frame */
+	m_converted = false;
+	if (converts()) {
+		stack(frame, m_stacked.data(), previous, pool);
+		write(out);
+	} else {
+		stack(frame, static_cast<uint8_t*>(out), previous, pool);
+	}
+	m_converted = true;
+}
+
+bool Observation::repeat(void* out) {
+	if (!m_converted) {
+		return false;
+	}
+	uint8_t* stacked = converts() ? m_stacked.data() : static_cast<uint8_t*>(out);
+	if (m_stack > 1) {
+		push(nullptr, stacked);
+	}
+	m_fill = false;
+	if (converts()) {
+		write(out);
+	}
+	return true;
+}
+
+void Observation::write(void* out) const {
+	size_t pixels = m_outWidth * m_outHeight;
+	bool planar = m_layout == Layout::CHW;
+	switch (m_type) {
+	case Type::UINT8:
+		writeValues(m_stacked.data(), static_cast<uint8_t*>(out), pixels, channels(), planar, uint8Values());
+		break;
+	case Type::FLOAT16:
+		writeValues(m_stacked.data(), static_cast<uint16_t*>(out), pixels, channels(), planar, float16Values());
+		break;
+	case Type::FLOAT32:
+		writeValues(m_stacked.data(), static_cast<float*>(out), pixels, channels(), planar, float32Values());
+		break;
+	}
+}
+
+void Observation::stack(const Image& frame, uint8_t* out, const Image* previous, Image::Pool pool) {
+	if (m_direct && (!previous || m_color == Color::RGB)) {
+		/* A plain crop can use the vectorized conversions */
+		Image crop = frame.crop(m_cropX, m_cropY, m_sourceWidth, m_sourceHeight);
+		if (m_color == Color::INDEXED) {
+			Image image(Image::Format::P8, static_cast<void*>(out), m_outWidth, m_outHeight, m_outWidth);
+			crop.indexTo(&image, &m_palette);
+		} else if (m_color == Color::RGB565) {
+			Image image(Image::Format::RGB565, static_cast<void*>(out), m_outWidth, m_outHeight, m_outWidth * 2);
+			crop.copyTo(&image);
+		} else if (previous) {
+			Image image(Image::Format::RGB888, static_cast<void*>(out), m_outWidth, m_outHeight, m_outWidth * 3);
+			Image previousCrop = previous->crop(m_cropX, m_cropY, m_sourceWidth, m_sourceHeight);
+			crop.poolTo(&image, &previousCrop, pool);
+		} else {
+			Image image(Image::Format::RGB888, static_cast<void*>(out), m_outWidth, m_outHeight, m_outWidth * 3);
+			crop.copyTo(&image);
+		}
+		m_fill = false;
+		return;
+	}
+	if (previous) {
+		/* The other paths take the pooled frame at full precision */
+		m_pooled.resize(frame.width() * frame.height());
+		Image pooled(Image::Format::RGBX888, static_cast<void*>(m_pooled.data()), frame.width(), frame.height(), frame.width() * 4);
+		Image(frame).poolTo(&pooled, previous, pool);
+		stack(pooled, out, nullptr, pool);
+		return;
+	}
+	if (m_resample) {
+		/* Filters other than nearest resize the crop first; a single frame
+		 * needs no stacking and can be resized in place */
+		Image crop = frame.crop(m_cropX, m_cropY, m_sourceWidth, m_sourceHeight);
+		uint8_t* resampled = m_stack > 1 ? m_resampled.data() : out;
+		Image image(m_color == Color::GRAY ? Image::Format::G8 : Image::Format::RGB888, static_cast<void*>(resampled), m_outWidth, m_outHeight, m_outWidth * frameChannels());
+		crop.resizeTo(&image, m_filter, &m_resampler);
+		if (m_stack > 1) {
+			push(resampled, out);
+		}
+		m_fill = false;
+		return;
+	}
+	switch (frame.format()) {
+	case Image::Format::RGB565:
+		sample<Pixel565>(frame, out);
+		break;
+	case Image::Format::RGB1555:
+		sample<Pixel1555>(frame, out);
+		break;
+	case Image::Format::RGBX888:
+		sample<PixelX888>(frame, out);
+		break;
+	default:
+		throw logic_error("unimplemented conversion");
+	}
+	m_fill = false;
+}
+
+template<typename Pixel>
+void Observation::sample(const Image& frame, uint8_t* out) {
+	switch (m_color) {
+	case Color::RGB:
+		sample<Pixel, Color::RGB>(frame, out);
+		break;
+	case Color::GRAY:
+		sample<Pixel, Color::GRAY>(frame, out);
+		break;
+	case Color::INDEXED:
+		sample<Pixel, Color::INDEXED>(frame, out);
+		break;
+	case Color::RGB565:
+		sample<Pixel, Color::RGB565>(frame, out);
+		break;
+	}
+}
+
+template<typename Pixel, Observation::Color C>
+void Observation::sample(const Image& frame, uint8_t* out) {
+	const unsigned Bytes = C == Color::RGB ? 3 : C == Color::RGB565 ? 2 : 1;
+	const uint8_t* in = static_cast<const uint8_t*>(frame.data());
+	size_t newest = Bytes * (m_stack - 1);
+	for (size_t y = 0; y < m_outHeight; ++y) {
+		const typename Pixel::Type* row = reinterpret_cast<const typename Pixel::Type*>(&in[frame.stride() * m_rows[y]]);
+		for (size_t x = 0; x < m_outWidth; ++x) {
+			uint8_t pixel[3];
+			Pixel::decode(row[m_columns[x]], pixel);
+			if (C == Color::GRAY) {
+				pixel[0] = luma(pixel[0], pixel[1], pixel[2]);
+			} else if (C == Color::INDEXED) {
+				pixel[0] = m_palette.index((pixel[0] << 16) | (pixel[1] << 8) | pixel[2]);
+			} else if (C == Color::RGB565) {
+				uint16_t rgb = ((pixel[0] & 0xF8) << 8) | ((pixel[1] & 0xFC) << 3) | (pixel[2] >> 3);
+				memcpy(pixel, &rgb, sizeof(rgb));
+			}
+			stackPixel<Bytes>(out, pixel, newest, m_fill);
+			out += newest + Bytes;
+		}
+	}
+}
+
+void Observation::push(const uint8_t* frame, uint8_t* out) {
+	switch (frameBytes()) {
+	case 1:
+		push<1>(frame, out);
+		break;
+	case 2:
+		push<2>(frame, out);
+		break;
+	default:
+		push<3>(frame, out);
+		break;
+	}
+}
+
+/* Without a frame, the newest slot of each pixel is pushed again */
+template<unsigned Bytes>
+void Observation::push(const uint8_t* frame, uint8_t* out) {
+	size_t newest = Bytes * (m_stack - 1);
+	for (size_t i = 0; i < m_outWidth * m_outHeight; ++i) {
+		uint8_t pixel[Bytes];
+		memcpy(pixel, frame ? frame : &out[newest], Bytes);
+		stackPixel<Bytes>(out, pixel, newest, m_fill);
+		if (frame) {
+			frame += Bytes;
+		}
+		out += newest + Bytes;
+	}
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include "imageops.h"
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+namespace Retro {
+
+// Turns emulator frames into agent observations in one pass over the frame:
+// the frame is cropped, resized and optionally converted to grayscale, then
+// written into the newest slot of a stack of recent frames. Observations are
+// laid out as (height, width, channels * stack), oldest frame first, in a
+// buffer that the caller keeps between updates. Nearest sampling is fused
+// with the stacking; other filters resize with Image::resizeTo first
+class Observation {
+public:
+	// Observations can instead be written channel first, as (channels * stack,
+	// height, width), and as floats normalised to [0, 1]. Float16 values are
+	// IEEE half precision bit patterns
+	enum class Layout {
+		HWC,
+		CHW,
+	};
+	enum class Type {
+		UINT8,
+		FLOAT16,
+		FLOAT32,
+	};
+
+	// Frames can also be kept as indices into a palette that grows until the
+	// next reset, or as RGB565 in a single uint16 element. Both are lossless
+	// for 16-bit sources, so they only work with nearest sampling, and they
+	// aren't converted to floats
+	enum class Color {
+		RGB,
+		GRAY,
+		INDEXED,
+		RGB565,
+	};
+
+	// A width or height of 0 keeps the size of the crop
+	Observation(size_t width = 0, size_t height = 0, bool grayscale = false, unsigned stack = 1, Image::Filter = Image::Filter::NEAREST);
+
+	// Changing the output resets the stack and the shape
+	void setOutput(Layout, Type);
+	Layout layout() const { return m_layout; }
+	Type type() const { return m_type; }
+	size_t elementSize() const;
+
+	// Changing the color resets the stack and the shape
+	void setColor(Color);
+	Color color() const { return m_color; }
+	const Palette& palette() const { return m_palette; }
+
+	// A crop width or height of 0 extends to the edge of the frame
+	void setCrop(size_t x, size_t y, size_t width, size_t height);
+
+	// The next update fills every slot of the stack, and starts a new palette
+	void reset();
+
+	// Computes the output shape for frames of the given size. Returns true if
+	// the shape changed, which also resets the stack
+	bool setFrameSize(size_t width, size_t height);
+
+	size_t width() const { return m_outWidth; }
+	size_t height() const { return m_outHeight; }
+	size_t frameChannels() const { return m_color == Color::RGB ? 3 : 1; }
+	size_t channels() const { return frameChannels() * m_stack; }
+	size_t size() const { return m_outWidth * m_outHeight * channels(); }
+
+	// out must hold size() elements. Unless the output is converted, it also
+	// keeps the previous observation. With a previous frame the two are pooled
+	// before anything else
+	void update(const Image& frame, void* out, const Image* previous = nullptr, Image::Pool = Image::Pool::MAX);
+
+	// Pushes the newest frame again without converting anything, for a frame
+	// known to be the same as the last one. Returns false if there is no
+	// converted frame of the current shape to repeat
+	bool repeat(void* out);
+
+private:
+	bool converts() const { return m_layout != Layout::HWC || m_type != Type::UINT8; }
+	void stack(const Image& frame, uint8_t* out, const Image* previous, Image::Pool);
+	void write(void* out) const;
+	size_t frameBytes() const { return m_color == Color::RGB565 ? 2 : frameChannels(); }
+	template<typename Pixel>
+	void sample(const Image& frame, uint8_t* out);
+	template<typename Pixel, Color>
+	void sample(const Image& frame, uint8_t* out);
+	void push(const uint8_t* frame, uint8_t* out);
+	template<unsigned Bytes>
+	void push(const uint8_t* frame, uint8_t* out);
+
+	size_t m_width;
+	size_t m_height;
+	Color m_color;
+	unsigned m_stack;
+	Image::Filter m_filter;
+	Layout m_layout = Layout::HWC;
+	Type m_type = Type::UINT8;
+
+	size_t m_cropX = 0;
+	size_t m_cropY = 0;
+	size_t m_cropWidth = 0;
+	size_t m_cropHeight = 0;
+
+	size_t m_frameWidth = 0;
+	size_t m_frameHeight = 0;
+	size_t m_sourceWidth = 0;
+	size_t m_sourceHeight = 0;
+	size_t m_outWidth = 0;
+	size_t m_outHeight = 0;
+	bool m_fill = true;
+	bool m_converted = false;
+	bool m_direct = false;
+	bool m_resample = false;
+	Resampler m_resampler;
+	std::vector<uint8_t> m_resampled;
+	std::vector<uint32_t> m_pooled;
+	Palette m_palette;
+	// The stack in (height, width, channels * stack) order, when the output
+	// is converted from it
+	std::vector<uint8_t> m_stacked;
+
+	// Source column and row of every output pixel
+	std::vector<size_t> m_columns;
+	std::vector<size_t> m_rows;
+};
+}
@@ -20,8 +20,14 @@ static inline T _hypot(T x, T y) {
 #include "script.h"
 #include "movie.h"
 #include "movie-bk2.h"
+#include "observation.h"
 
+#include <algorithm>
+#include <atomic>
+#include <exception>
 #include <map>
+#include <sstream>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
 
@@ -30,13 +36,95 @@ namespace py = pybind11;
 using std::string;
 using namespace Retro;
 
+// Mirrors retro.Actions
+enum class ActionType {
+	ALL = 0,
+	FILTERED = 1,
+	DISCRETE = 2,
+	MULTI_DISCRETE = 3
+};
+
+// Mirrors retro.Observations
+enum class ObservationType {
+	IMAGE = 0,
+	RAM = 1
+};
+
+// Wraps the emulator's frame without copying it
+static Image screenImage(Retro::Emulator& re) {
+	long w = re.getImageWidth();
+	long h = re.getImageHeight();
+	if (re.getImageDepth() == 16) {
+		return Image(Image::Format::RGB565, re.getImageData(), w, h, re.getImagePitch());
+	} else if (re.getImageDepth() == 15) {
+		return Image(Image::Format::RGB1555, re.getImageData(), w, h, re.getImagePitch());
+	} else if (re.getImageDepth() == 32) {
+		return Image(Image::Format::RGBX888, re.getImageData(), w, h, re.getImagePitch());
+	}
+	throw std::runtime_error("Unsupported image depth");
+}
+
+// Wraps the frame from before the emulator's current one, if it kept one
+static bool previousScreenImage(Retro::Emulator& re, Image* image) {
+	const void* data = re.getPreviousImageData();
+	if (!data) {
+		return false;
+	}
+	Image screen = screenImage(re);
+	*image = Image(screen.format(), data, screen.width(), screen.height(), screen.stride());
+	return true;
+}
+
+// Converts the emulator's frame to packed RGB888, pooled with the previous
+// frame if the emulator keeps it
+static void copyScreen(Retro::Emulator& re, uint8_t* data, Image::Pool pool = Image::Pool::MAX) {
+	long w = re.getImageWidth();
+	long h = re.getImageHeight();
+	Image out(Image::Format::RGB888, data, w, h, w);
+	Image previous;
+	if (previousScreenImage(re, &previous)) {
+		screenImage(re).poolTo(&out, &previous, pool);
+	} else {
+		screenImage(re).copyTo(&out);
+	}
+}
+
+// Concatenates every block of the address space
+static void copyRam(const Retro::AddressSpace& mem, std::vector<uint8_t>* out) {
+	out->clear();
+	for (const auto& block : mem.blocks()) {
+		const uint8_t* data = static_cast<const uint8_t*>(block.second.offset(0));
+		out->insert(out->end(), data, data + block.second.size());
+	}
+}
+
+// Holds a contiguous view of any object that supports the buffer protocol
+struct BufferView {
+	Py_buffer view;
+	BufferView(py::handle obj, bool writable) {
+		if (PyObject_GetBuffer(obj.ptr(), &view, PyBUF_C_CONTIGUOUS | (writable ? PyBUF_WRITABLE : 0)) != 0) {
+			throw py::error_already_set();
+		}
+	}
+	BufferView(const BufferView&) = delete;
+	~BufferView() {
+		PyBuffer_Release(&view);
+	}
+};
+
 struct PyGameData;
 struct PyRetroEmulator {
 	Retro::Emulator m_re;
 	int m_cheats = 0;
-	PyRetroEmulator(const string& rom_path) {
-		if (Emulator::isLoaded()) {
-			throw std::runtime_error("Cannot create multiple emulator instances per process, make sure to call env.close() on each environment before creating a new one");
+	Image::Pool m_pool = Image::Pool::MAX;
+	size_t m_audioViews = 0;
+	PyRetroEmulator(const string& rom_path, py::object profile = py::none(), py::dict options = py::dict()) {
+		if (!profile.is_none()) {
+			checkCoreProfile(Retro::coreForRom(rom_path), profile.cast<string>());
+			m_re.setCoreProfile(profile.cast<string>());
+		}
+		for (const auto& option : options) {
+			m_re.setCoreOption(py::str(option.first), py::str(option.second));
 		}
 		if (!m_re.loadRom(rom_path.c_str())) {
 			throw std::runtime_error("Could not load ROM");
@@ -44,8 +132,12 @@ struct PyRetroEmulator {
 		m_re.run(); // otherwise you get a segfault when you try to get screen for the first time
 	}
 
-	void step() {
-		m_re.run();
+	void step(bool render) {
+		m_re.run(render);
+	}
+
+	void setButtons(uint16_t mask, unsigned player) {
+		m_re.setButtonMask(player, mask);
 	}
 
 	py::bytes getState() {
@@ -55,23 +147,34 @@ struct PyRetroEmulator {
 		return bytes;
 	}
 
-	bool setState(py::bytes o) {
-		return m_re.unserialize(PyBytes_AsString(o.ptr()), PyBytes_Size(o.ptr()));
+	size_t getStateInto(py::handle out) {
+		BufferView buffer(out, true);
+		size_t size = m_re.serializeSize();
+		if (static_cast<size_t>(buffer.view.len) < size) {
+			throw std::invalid_argument("buffer is smaller than the state (" + std::to_string(size) + " bytes)");
+		}
+		py::gil_scoped_release release;
+		if (!m_re.serialize(buffer.view.buf, size)) {
+			throw std::runtime_error("Could not save state");
+		}
+		return size;
+	}
+
+	bool setState(py::handle state) {
+		BufferView buffer(state, false);
+		py::gil_scoped_release release;
+		return m_re.unserialize(buffer.view.buf, buffer.view.len);
+	}
+
+	size_t stateSize() {
+		return m_re.serializeSize();
 	}
 
 	py::array_t<uint8_t> getScreen() {
 		long w = m_re.getImageWidth();
 		long h = m_re.getImageHeight();
 		py::array_t<uint8_t> arr({ { h, w, 3 } });
-		uint8_t* data = arr.mutable_data();
-		Image out(Image::Format::RGB888, data, w, h, w);
-		Image in;
-		if (m_re.getImageDepth() == 16) {
-			in = Image(Image::Format::RGB565, m_re.getImageData(), w, h, m_re.getImagePitch());
-		} else if (m_re.getImageDepth() == 32) {
-			in = Image(Image::Format::RGBX888, m_re.getImageData(), w, h, m_re.getImagePitch());
-		}
-		in.copyTo(&out);
+		copyScreen(m_re, arr.mutable_data(), m_pool);
 		return arr;
 	}
 
@@ -86,10 +189,113 @@ struct PyRetroEmulator {
 		return arr;
 	}
 
+	py::array_t<int16_t> getAudioView() {
+		// Shares the emulator's ring buffer; valid until the next step or consume.
+		// Views are read-only and counted, so the ring can't be reallocated under
+		// one by set_audio_buffer
+		struct Owner {
+			py::object emulator;
+			size_t* views;
+		};
+		py::capsule owner(new Owner{ py::cast(this), &m_audioViews }, [](void* ptr) {
+			Owner* view = static_cast<Owner*>(ptr);
+			--*view->views;
+			delete view;
+		});
+		++m_audioViews;
+		py::array_t<int16_t> arr({ m_re.getAudioSamples(), 2 }, m_re.getAudioData(), owner);
+		arr.attr("flags").attr("writeable") = false;
+		return arr;
+	}
+
+	void consumeAudio(size_t frames) {
+		m_re.consumeAudio(frames);
+	}
+
+	void setAudioBuffer(size_t capacity, bool accumulate) {
+		if (m_audioViews) {
+			throw std::runtime_error("Audio views are still referenced");
+		}
+		m_re.setAudioCapacity(capacity);
+		m_re.setAudioAccumulate(accumulate);
+	}
+
+	void setAudioResampleRate(double rate) {
+		m_re.setAudioResampleRate(rate);
+	}
+
 	double getAudioRate() {
 		return m_re.getAudioRate();
 	}
 
+	void setAudioEnabled(bool enabled) {
+		m_re.setAudioEnabled(enabled);
+	}
+
+	void setVideoEnabled(bool enabled) {
+		m_re.setVideoEnabled(enabled);
+	}
+
+	void setTrackChanges(bool track) {
+		m_re.setTrackChanges(track);
+	}
+
+	bool frameChanged() {
+		return m_re.frameChanged();
+	}
+
+	uint64_t imageVersion() {
+		return m_re.imageVersion();
+	}
+
+	py::tuple changedRows() {
+		unsigned begin, end;
+		m_re.getChangedRows(&begin, &end);
+		return py::make_tuple(begin, end);
+	}
+
+	// Screens and observations take the maximum or mean of the last two
+	// frames, or just the last one with None
+	void setScreenPool(py::object mode) {
+		if (mode.is_none()) {
+			m_re.setKeepPreviousImage(false);
+			return;
+		}
+		string name = mode.cast<string>();
+		if (name == "max") {
+			m_pool = Image::Pool::MAX;
+		} else if (name == "mean") {
+			m_pool = Image::Pool::MEAN;
+		} else {
+			throw std::invalid_argument("unknown screen pool: " + name);
+		}
+		m_re.setKeepPreviousImage(true);
+	}
+
+	static void checkCoreProfile(const string& core, const string& profile) {
+		const auto profiles = Retro::coreProfiles(core);
+		if (std::find(profiles.begin(), profiles.end(), profile) == profiles.end()) {
+			throw std::invalid_argument("Unknown core profile: " + profile);
+		}
+	}
+
+	void setCoreProfile(const string& profile) {
+		checkCoreProfile(m_re.core(), profile);
+		m_re.setCoreProfile(profile);
+	}
+
+	void setCoreOption(const string& key, const string& value) {
+		m_re.setCoreOption(key, value);
+	}
+
+	py::dict getCoreOptions() const {
+		py::dict options;
+		for (const auto& option : m_re.coreOptions()) {
+			options[py::str(option.first)] = option.second;
+		}
+		return options;
+	}
+
 	py::tuple getResolution() {
 		return py::make_tuple(m_re.getImageWidth(), m_re.getImageHeight());
 	}
@@ -117,11 +323,84 @@ struct PyRetroEmulator {
 	}
 
 	void configureData(PyGameData& data);
+	// With skip_video, a sequence the scenario ends early keeps the screen of
+	// the last frame drawn; it is current again after one more step()
+	size_t runSequence(py::array_t<uint16_t, py::array::c_style | py::array::forcecast> masks, py::object data, py::object rewards, py::object variables, py::object trace, bool skipVideo);
 	static bool loadCoreInfo(const string& json) {
 		return Retro::loadCoreInfo(json);
 	}
 };
 
+// Savestate buffers returned to a pool when the last reference goes away, so
+// that steady-state snapshotting doesn't allocate
+struct StateBuffers {
+	std::vector<std::vector<uint8_t>> free;
+	size_t capacity;
+};
+
+struct PyStateBuffer {
+	std::vector<uint8_t> m_data;
+	std::shared_ptr<StateBuffers> m_pool;
+
+	PyStateBuffer(std::vector<uint8_t>&& data, std::shared_ptr<StateBuffers> pool)
+		: m_data(std::move(data))
+		, m_pool(std::move(pool)) {
+	}
+	PyStateBuffer(const PyStateBuffer&) = delete;
+	~PyStateBuffer() {
+		if (m_pool && m_pool->free.size() < m_pool->capacity) {
+			m_pool->free.emplace_back(std::move(m_data));
+		}
+	}
+
+	size_t size() const {
+		return m_data.size();
+	}
+
+	py::bytes bytes() const {
+		return py::bytes(reinterpret_cast<const char*>(m_data.data()), m_data.size());
+	}
+};
+
+struct PyStatePool {
+	py::object m_emulator;
+	std::shared_ptr<StateBuffers> m_buffers;
+
+	PyStatePool(py::object emulator, size_t capacity)
+		: m_emulator(emulator)
+		, m_buffers(std::make_shared<StateBuffers>()) {
+		m_emulator.cast<PyRetroEmulator&>();
+		m_buffers->capacity = capacity;
+	}
+
+	std::unique_ptr<PyStateBuffer> save() {
+		Retro::Emulator& emu = m_emulator.cast<PyRetroEmulator&>().m_re;
+		std::vector<uint8_t> data;
+		if (!m_buffers->free.empty()) {
+			data = std::move(m_buffers->free.back());
+			m_buffers->free.pop_back();
+		}
+		data.resize(emu.serializeSize());
+		{
+			py::gil_scoped_release release;
+			if (!emu.serialize(data.data(), data.size())) {
+				throw std::runtime_error("Could not save state");
+			}
+		}
+		return std::make_unique<PyStateBuffer>(std::move(data), m_buffers);
+	}
+
+	bool load(const PyStateBuffer& state) {
+		Retro::Emulator& emu = m_emulator.cast<PyRetroEmulator&>().m_re;
+		py::gil_scoped_release release;
+		return emu.unserialize(state.m_data.data(), state.m_data.size());
+	}
+
+	size_t available() const {
+		return m_buffers->free.size();
+	}
+};
+
 struct PyMemoryView {
 	Retro::AddressSpace& m_mem;
 	PyMemoryView(Retro::AddressSpace& mem)
@@ -216,9 +495,139 @@ struct PySearch {
 	}
 };
 
+// Owns the persistent output of an observation pipeline. The same array is
+// returned by every update until the frame size changes
+struct PyObservation {
+	Retro::Observation m_obs;
+	py::array m_out;
+	// Image version of the last unpooled conversion, if any
+	uint64_t m_version = 0;
+	bool m_cached = false;
+
+	PyObservation(size_t width, size_t height, bool grayscale, unsigned stack, const string& filter, const string& layout, const string& dtype, const string& color)
+		: m_obs(width, height, grayscale, stack, resizeFilter(filter)) {
+		m_obs.setOutput(outputLayout(layout), outputType(dtype));
+		if (!grayscale) {
+			m_obs.setColor(outputColor(color));
+		}
+	}
+
+	static Retro::Observation::Color outputColor(const string& name) {
+		if (name == "rgb") {
+			return Retro::Observation::Color::RGB;
+		} else if (name == "indexed") {
+			return Retro::Observation::Color::INDEXED;
+		} else if (name == "rgb565") {
+			return Retro::Observation::Color::RGB565;
+		}
+		throw std::invalid_argument("unknown color: " + name);
+	}
+
+	static Retro::Observation::Layout outputLayout(const string& name) {
+		if (name == "hwc") {
+			return Retro::Observation::Layout::HWC;
+		} else if (name == "chw") {
+			return Retro::Observation::Layout::CHW;
+		}
+		throw std::invalid_argument("unknown layout: " + name);
+	}
+
+	static Retro::Observation::Type outputType(const string& name) {
+		if (name == "uint8") {
+			return Retro::Observation::Type::UINT8;
+		} else if (name == "float16") {
+			return Retro::Observation::Type::FLOAT16;
+		} else if (name == "float32") {
+			return Retro::Observation::Type::FLOAT32;
+		}
+		throw std::invalid_argument("unknown dtype: " + name);
+	}
+
+	static Image::Filter resizeFilter(const string& name) {
+		if (name == "nearest") {
+			return Image::Filter::NEAREST;
+		} else if (name == "area") {
+			return Image::Filter::AREA;
+		} else if (name == "bilinear") {
+			return Image::Filter::BILINEAR;
+		}
+		throw std::invalid_argument("unknown resize filter: " + name);
+	}
+
+	void setCrop(size_t x, size_t y, size_t width, size_t height) {
+		m_obs.setCrop(x, y, width, height);
+	}
+
+	void reset() {
+		m_obs.reset();
+	}
+
+	// Colors of the indices seen since the last reset, as (colors, 3)
+	py::array_t<uint8_t> palette() const {
+		const Retro::Palette& palette = m_obs.palette();
+		py::array_t<uint8_t> arr({ static_cast<py::ssize_t>(palette.size()), py::ssize_t(3) });
+		memcpy(arr.mutable_data(), palette.colors(), palette.size() * 3);
+		return arr;
+	}
+
+	// Uses player 0's crop from the scenario, if there is one. Arrays support
+	// the buffer protocol and DLPack, so frameworks can wrap them without a copy
+	py::array observe(PyRetroEmulator& emu, const Retro::Scenario* scen) {
+		if (scen) {
+			size_t x, y, width, height;
+			scen->getCrop(&x, &y, &width, &height, 0);
+			m_obs.setCrop(x, y, width, height);
+		}
+		Image frame = screenImage(emu.m_re);
+		Image previous;
+		bool pooled = previousScreenImage(emu.m_re, &previous);
+		if (m_obs.setFrameSize(frame.width(), frame.height()) || !m_out.size()) {
+			std::vector<py::ssize_t> shape{ static_cast<py::ssize_t>(m_obs.height()), static_cast<py::ssize_t>(m_obs.width()), static_cast<py::ssize_t>(m_obs.channels()) };
+			if (m_obs.layout() == Retro::Observation::Layout::CHW) {
+				std::rotate(shape.begin(), shape.begin() + 2, shape.end());
+			}
+			// Strides are given since older pybind11 can't read the item size
+			// of NumPy 2 dtypes
+			std::vector<py::ssize_t> strides(3, m_obs.elementSize());
+			strides[1] = strides[2] * shape[2];
+			strides[0] = strides[1] * shape[1];
+			m_out = py::array(outputDtype(), py::array::ShapeContainer(shape), py::array::StridesContainer(strides));
+		}
+		void* out = m_out.mutable_data();
+		{
+			py::gil_scoped_release release;
+			// An unchanged image only needs its last conversion pushed again
+			uint64_t version = emu.m_re.imageVersion();
+			if (pooled || !m_cached || version != m_version || !m_obs.repeat(out)) {
+				m_obs.update(frame, out, pooled ? &previous : nullptr, emu.m_pool);
+			}
+			m_version = version;
+			m_cached = !pooled;
+		}
+		return m_out;
+	}
+
+	py::dtype outputDtype() const {
+		if (m_obs.color() == Retro::Observation::Color::RGB565) {
+			return py::dtype::of<uint16_t>();
+		}
+		switch (m_obs.type()) {
+		case Retro::Observation::Type::FLOAT16:
+			return py::dtype("float16");
+		case Retro::Observation::Type::FLOAT32:
+			return py::dtype::of<float>();
+		default:
+			return py::dtype::of<uint8_t>();
+		}
+	}
+
+	py::array update(PyRetroEmulator& emu, py::object data);
+};
+
 struct PyGameData {
 	Retro::GameData m_data;
 	Retro::Scenario m_scen{ m_data };
+	py::array_t<int64_t> m_values;
 
 	bool load(py::handle data = py::none(), py::handle scen = py::none()) {
 		ScriptContext::reset();
@@ -270,6 +679,14 @@ struct PyGameData {
 		m_scen.update();
 	}
 
+	void setShadowRam(bool shadow) {
+		m_data.setShadowRam(shadow);
+	}
+
+	bool shadowRam() const {
+		return m_data.shadowRam();
+	}
+
 	py::object lookupValue(py::str name) const {
 		try {
 			Variant data = m_data.lookupValue(name);
@@ -312,6 +729,164 @@ struct PyGameData {
 		return data;
 	}
 
+	const std::map<int, std::set<int>>& validCombos() const {
+		const auto& combos = m_scen.validActions();
+		for (const auto& combo : combos) {
+			if (combo.second.empty()) {
+				throw std::invalid_argument("action group has no valid combos");
+			}
+		}
+		return combos;
+	}
+
+	std::vector<uint16_t> decodeAction(py::handle action, ActionType type, unsigned players) const {
+		auto arr = py::array_t<int64_t, py::array::forcecast>::ensure(action);
+		if (!arr) {
+			throw std::invalid_argument("action must be convertible to an integer array");
+		}
+		const int64_t* a = arr.data();
+		size_t size = arr.size();
+		std::vector<uint16_t> masks(players);
+
+		if (type == ActionType::DISCRETE) {
+			if (!size) {
+				throw std::invalid_argument("action is empty");
+			}
+			const auto& combos = validCombos();
+			if (a[0] < 0) {
+				throw std::invalid_argument("action out of range");
+			}
+			uint64_t value = a[0];
+			for (unsigned p = 0; p < players; ++p) {
+				for (const auto& combo : combos) {
+					auto iter = combo.second.begin();
+					std::advance(iter, value % combo.second.size());
+					value /= combo.second.size();
+					masks[p] |= *iter;
+				}
+			}
+			// Anything left over didn't fit in the combos of every player
+			if (value) {
+				throw std::invalid_argument("action out of range");
+			}
+		} else if (type == ActionType::MULTI_DISCRETE) {
+			const auto& combos = validCombos();
+			if (size < combos.size() * players) {
+				throw std::invalid_argument("action is too short");
+			}
+			for (unsigned p = 0; p < players; ++p) {
+				size_t i = combos.size() * p;
+				for (const auto& combo : combos) {
+					if (a[i] < 0 || static_cast<uint64_t>(a[i]) >= combo.second.size()) {
+						throw std::invalid_argument("action out of range");
+					}
+					auto iter = combo.second.begin();
+					std::advance(iter, a[i]);
+					masks[p] |= *iter;
+					++i;
+				}
+			}
+		} else {
+			size_t buttons = m_data.buttons().size();
+			if (size < buttons * players) {
+				throw std::invalid_argument("action is too short");
+			}
+			for (unsigned p = 0; p < players; ++p) {
+				for (size_t i = 0; i < buttons; ++i) {
+					masks[p] |= (a[buttons * p + i] ? 1 : 0) << i;
+				}
+				if (type == ActionType::FILTERED) {
+					masks[p] = m_scen.filterAction(masks[p]);
+				}
+			}
+		}
+		return masks;
+	}
+
+	py::array_t<uint8_t> getRam() const {
+		size_t size = 0;
+		for (const auto& block : m_data.addressSpace().blocks()) {
+			size += block.second.size();
+		}
+		py::array_t<uint8_t> arr(size);
+		uint8_t* data = arr.mutable_data();
+		for (const auto& block : m_data.addressSpace().blocks()) {
+			memcpy(data, block.second.offset(0), block.second.size());
+			data += block.second.size();
+		}
+		return arr;
+	}
+
+	py::tuple step(PyRetroEmulator& emu, py::handle action, int actionType, unsigned players, unsigned frameskip, int obsType, bool skipVideo, PyObservation* observation) {
+		if (players < 1 || players > MAX_PLAYERS) {
+			throw std::runtime_error("players out of range");
+		}
+		std::vector<uint16_t> masks = decodeAction(action, static_cast<ActionType>(actionType), players);
+		std::vector<double> rewards(players);
+		bool done = false;
+		{
+			py::gil_scoped_release release;
+			for (unsigned p = 0; p < players; ++p) {
+				emu.setButtons(masks[p], p);
+			}
+			unsigned frames = std::max(frameskip, 1U);
+			// Only the last frame is observed, or the last two when pooling
+			unsigned observed = emu.m_re.keepPreviousImage() ? 2 : 1;
+			bool image = static_cast<ObservationType>(obsType) == ObservationType::IMAGE;
+			unsigned frame = 0;
+			bool rendered = false;
+			for (; frame < frames; ++frame) {
+				rendered = !skipVideo || (frame + observed >= frames && image);
+				emu.m_re.run(rendered);
+				m_data.updateRam();
+				m_scen.update();
+				for (unsigned p = 0; p < players; ++p) {
+					rewards[p] += m_scen.currentReward(p);
+				}
+				done = m_scen.isDone();
+				if (done) {
+					break;
+				}
+			}
+			// An episode that ends on a skipped frame would leave the screen of
+			// the previous step, so one more frame is run and drawn. It isn't
+			// scored, but RAM read afterwards reflects it
+			if (done && image && !rendered) {
+				emu.m_re.run(true);
+				m_data.updateRam();
+			}
+		}
+
+		py::object obs;
+		if (static_cast<ObservationType>(obsType) == ObservationType::RAM) {
+			obs = getRam();
+		} else if (observation) {
+			obs = observation->observe(emu, &m_scen);
+		} else {
+			obs = cropScreen(emu.getScreen());
+		}
+
+		py::list rewardList;
+		for (double reward : rewards) {
+			rewardList.append(reward);
+		}
+		return py::make_tuple(obs, rewardList, done, lookupAll());
+	}
+
+	// Applies player 0's crop to an (h, w, 3) screen
+	py::object cropScreen(py::array_t<uint8_t> screen) const {
+		size_t x, y, w, h;
+		m_scen.getCrop(&x, &y, &w, &h, 0);
+		size_t width = screen.shape(1);
+		size_t height = screen.shape(0);
+		w = !w || x + w > width ? width : x + w;
+		h = !h || y + h > height ? height : y + h;
+		if (x || y || w != width || h != height) {
+			return screen[py::make_tuple(py::slice(y, h, 1), py::slice(x, w, 1))];
+		}
+		return std::move(screen);
+	}
+
 	py::dict getVariable(py::str name) const {
 		py::dict obj;
 		Retro::Variable var = m_data.getVariable(name);
@@ -329,6 +904,24 @@ struct PyGameData {
 		m_data.removeVariable(name);
 	}
 
+	py::list variableNames() {
+		py::list names;
+		for (const auto& name : m_data.variableNames()) {
+			names.append(py::str(name));
+		}
+		return names;
+	}
+
+	// Refreshes and returns the same array until the set of variables changes size
+	py::array_t<int64_t> lookupArray() {
+		size_t size = m_data.variableNames().size();
+		if (static_cast<size_t>(m_values.size()) != size) {
+			m_values = py::array_t<int64_t>(py::array::ShapeContainer({ static_cast<py::ssize_t>(size) }), py::array::StridesContainer({ static_cast<py::ssize_t>(sizeof(int64_t)) }));
+		}
+		m_data.lookupVariables(m_values.mutable_data());
+		return m_values;
+	}
+
 	py::dict listVariables() {
 		const auto& vars = m_data.listVariables();
 		py::dict vdict;
@@ -390,10 +983,286 @@ struct PyGameData {
 	}
 };
 
+py::array PyObservation::update(PyRetroEmulator& emu, py::object data) {
+	return observe(emu, data.is_none() ? nullptr : &data.cast<PyGameData&>().m_scen);
+}
+
 void PyRetroEmulator::configureData(PyGameData& data) {
 	m_re.configureData(&data.m_data);
 }
 
+// Checks that a caller-provided output array can be written in place
+template<typename T>
+static T* outputArray(py::handle array, size_t rows, size_t columns, const char* name) {
+	if (!py::isinstance<py::array_t<T, py::array::c_style>>(array)) {
+		throw std::invalid_argument(std::string(name) + " must be a C-contiguous " + py::str(py::dtype::of<T>()).cast<string>() + " array");
+	}
+	auto arr = py::reinterpret_borrow<py::array_t<T, py::array::c_style>>(array);
+	if (arr.ndim() != 2 || static_cast<size_t>(arr.shape(0)) < rows || static_cast<size_t>(arr.shape(1)) != columns) {
+		throw std::invalid_argument(std::string(name) + " must have at least " + std::to_string(rows) + " rows of " + std::to_string(columns));
+	}
+	return arr.mutable_data();
+}
+
+size_t PyRetroEmulator::runSequence(py::array_t<uint16_t, py::array::c_style | py::array::forcecast> masks, py::object data, py::object rewards, py::object variables, py::object trace, bool skipVideo) {
+	if (masks.ndim() != 1 && masks.ndim() != 2) {
+		throw std::invalid_argument("masks must have shape (frames, players)");
+	}
+	size_t frames = masks.shape(0);
+	unsigned players = masks.ndim() == 2 ? masks.shape(1) : 1;
+	if (players < 1 || players > MAX_PLAYERS) {
+		throw std::runtime_error("players out of range");
+	}
+
+	PyGameData* game = data.is_none() ? nullptr : &data.cast<PyGameData&>();
+	if (!game && (!rewards.is_none() || !variables.is_none())) {
+		throw std::invalid_argument("data is required to record rewards or variables");
+	}
+	float* rewardTrace = rewards.is_none() ? nullptr : outputArray<float>(rewards, frames, players, "rewards");
+	std::vector<string> names;
+	if (!variables.is_none()) {
+		for (const auto& name : variables) {
+			names.emplace_back(py::str(name));
+			// Unknown names throw here rather than with the GIL released
+			static_cast<const Retro::GameData&>(game->m_data).lookupValue(names.back());
+		}
+	}
+	int64_t* valueTrace = nullptr;
+	if (!names.empty()) {
+		if (trace.is_none()) {
+			throw std::invalid_argument("trace is required to record variables");
+		}
+		valueTrace = outputArray<int64_t>(trace, frames, names.size(), "trace");
+	}
+
+	py::gil_scoped_release release;
+	std::function<bool(size_t)> afterFrame;
+	if (game) {
+		afterFrame = [&](size_t frame) {
+			game->m_data.updateRam();
+			game->m_scen.update();
+			if (rewardTrace) {
+				for (unsigned p = 0; p < players; ++p) {
+					rewardTrace[frame * players + p] = game->m_scen.currentReward(p);
+				}
+			}
+			for (size_t i = 0; i < names.size(); ++i) {
+				valueTrace[frame * names.size() + i] = static_cast<const Retro::GameData&>(game->m_data).lookupValue(names[i]);
+			}
+			return !game->m_scen.isDone();
+		};
+	}
+	return m_re.runSequence(masks.data(), frames, players, afterFrame, !skipVideo);
+}
+
+// Plays several action sequences from one state at once, each on its own
+// copy of the game
+struct PyBranchEvaluator {
+	struct Worker {
+		Retro::Emulator emulator;
+		Retro::GameData data;
+		Retro::Scenario scen{ data };
+	};
+
+	struct Branch {
+		std::vector<std::vector<uint16_t>> actions;
+		std::vector<double> rewards;
+		bool done = false;
+		std::vector<uint8_t> state;
+		std::vector<uint8_t> obs;
+		py::ssize_t width = 0;
+		py::ssize_t height = 0;
+	};
+
+	py::object m_emuObject;
+	const PyRetroEmulator& m_emu;
+	py::object m_gameObject;
+	PyGameData& m_game;
+	std::string m_data;
+	std::string m_scen;
+	std::vector<std::unique_ptr<Worker>> m_workers;
+
+	PyBranchEvaluator(py::object emu, py::object game, unsigned workers)
+		: m_emuObject(emu)
+		, m_emu(emu.cast<const PyRetroEmulator&>())
+		, m_gameObject(game)
+		, m_game(game.cast<PyGameData&>()) {
+		for (unsigned i = 0; i < std::max(workers, 1U); ++i) {
+			auto worker = std::make_unique<Worker>();
+			// Some options are only read when the game loads
+			for (const auto& option : m_emu.m_re.coreOptions()) {
+				worker->emulator.setCoreOption(option.first, option.second);
+			}
+			if (!worker->emulator.loadRom(m_emu.m_re.romPath())) {
+				throw std::runtime_error("Could not load ROM");
+			}
+			worker->emulator.configureData(&worker->data);
+			m_workers.emplace_back(std::move(worker));
+		}
+		sync();
+	}
+
+	// Workers play copies of the game data, scenario and core options, which
+	// are refreshed whenever the originals have changed since the last batch
+	void sync() {
+		if (!m_game.m_scen.scripts().empty()) {
+			// Lua contexts are global to the process and bound to one scenario
+			throw std::runtime_error("Branch evaluation does not support scenarios with scripts");
+		}
+		std::stringstream data;
+		std::stringstream scen;
+		if (!m_game.m_data.save(&data) || !m_game.m_scen.save(&scen)) {
+			throw std::runtime_error("Could not copy game data");
+		}
+		bool changed = data.str() != m_data || scen.str() != m_scen;
+		for (auto& worker : m_workers) {
+			for (const auto& option : m_emu.m_re.coreOptions()) {
+				worker->emulator.setCoreOption(option.first, option.second);
+			}
+			if (!changed) {
+				continue;
+			}
+			data.clear();
+			data.seekg(0);
+			scen.clear();
+			scen.seekg(0);
+			if (!worker->data.load(&data) || !worker->scen.load(&scen)) {
+				m_data.clear();
+				throw std::runtime_error("Could not copy game data");
+			}
+		}
+		m_data = data.str();
+		m_scen = scen.str();
+	}
+
+	size_t workers() const {
+		return m_workers.size();
+	}
+
+	py::tuple evaluate(py::bytes state, py::iterable branches, int actionType, unsigned players, unsigned frameskip, py::object obsType) {
+		if (players < 1 || players > MAX_PLAYERS) {
+			throw std::runtime_error("players out of range");
+		}
+		std::vector<Branch> results;
+		for (const auto& sequence : branches) {
+			Branch branch;
+			for (const auto& action : py::reinterpret_borrow<py::iterable>(sequence)) {
+				branch.actions.emplace_back(m_game.decodeAction(action, static_cast<ActionType>(actionType), players));
+			}
+			branch.rewards.resize(players);
+			results.emplace_back(std::move(branch));
+		}
+		sync();
+		bool observe = !obsType.is_none();
+		bool ram = observe && static_cast<ObservationType>(obsType.cast<int>()) == ObservationType::RAM;
+
+		std::string base = state;
+		// Exceptions can't cross a std::thread, so each worker keeps its own
+		// and the first one is rethrown once every thread is joined
+		std::vector<std::exception_ptr> errors(m_workers.size());
+		{
+			py::gil_scoped_release release;
+			std::atomic<size_t> next{ 0 };
+			auto work = [&](size_t w) {
+				Worker& worker = *m_workers[w];
+				try {
+					for (size_t i = next++; i < results.size(); i = next++) {
+						run(worker, base, std::max(frameskip, 1U), observe && !ram, &results[i]);
+						if (ram) {
+							copyRam(worker.data.addressSpace(), &results[i].obs);
+						} else if (observe) {
+							results[i].width = worker.emulator.getImageWidth();
+							results[i].height = worker.emulator.getImageHeight();
+							results[i].obs.resize(results[i].width * results[i].height * 3);
+							copyScreen(worker.emulator, results[i].obs.data());
+						}
+					}
+				} catch (...) {
+					errors[w] = std::current_exception();
+					next = results.size();
+				}
+			};
+			std::vector<std::thread> threads;
+			try {
+				for (size_t i = 1; i < std::min(m_workers.size(), results.size()); ++i) {
+					threads.emplace_back(work, i);
+				}
+			} catch (...) {
+				errors[0] = std::current_exception();
+				next = results.size();
+			}
+			if (!errors[0]) {
+				work(0);
+			}
+			for (auto& thread : threads) {
+				thread.join();
+			}
+		}
+		for (const auto& error : errors) {
+			if (error) {
+				std::rethrow_exception(error);
+			}
+		}
+
+		py::array_t<float> rewards({ results.size(), static_cast<size_t>(players) });
+		py::array_t<bool> dones(results.size());
+		py::list states;
+		py::list observations;
+		for (size_t i = 0; i < results.size(); ++i) {
+			const Branch& branch = results[i];
+			for (unsigned p = 0; p < players; ++p) {
+				rewards.mutable_at(i, p) = branch.rewards[p];
+			}
+			dones.mutable_at(i) = branch.done;
+			states.append(py::bytes(reinterpret_cast<const char*>(branch.state.data()), branch.state.size()));
+			if (ram) {
+				py::array_t<uint8_t> obs(branch.obs.size());
+				memcpy(obs.mutable_data(), branch.obs.data(), branch.obs.size());
+				observations.append(obs);
+			} else if (observe) {
+				py::array_t<uint8_t> obs({ branch.height, branch.width, py::ssize_t(3) });
+				memcpy(obs.mutable_data(), branch.obs.data(), branch.obs.size());
+				observations.append(m_game.cropScreen(obs));
+			}
+		}
+		return py::make_tuple(rewards, dones, states, observe ? py::object(observations) : py::none());
+	}
+
+	static void run(Worker& worker, const std::string& state, unsigned frameskip, bool render, Branch* branch) {
+		Retro::Emulator& emu = worker.emulator;
+		if (!emu.unserialize(state.data(), state.size())) {
+			throw std::runtime_error("Could not load state");
+		}
+		worker.scen.restart();
+		worker.data.updateRam();
+		for (const auto& masks : branch->actions) {
+			for (unsigned p = 0; p < masks.size(); ++p) {
+				for (int key = 0; key < N_BUTTONS; ++key) {
+					emu.setKey(p, key, (masks[p] >> key) & 1);
+				}
+			}
+			for (unsigned frame = 0; frame < frameskip && !branch->done; ++frame) {
+				// A branch can end on any frame, so screens are only skipped
+				// when none is returned
+				emu.run(render);
+				worker.data.updateRam();
+				worker.scen.update();
+				for (unsigned p = 0; p < branch->rewards.size(); ++p) {
+					branch->rewards[p] += worker.scen.currentReward(p);
+				}
+				branch->done = worker.scen.isDone();
+			}
+			if (branch->done) {
+				break;
+			}
+		}
+		branch->state.resize(emu.serializeSize());
+		if (!emu.serialize(branch->state.data(), branch->state.size())) {
+			throw std::runtime_error("Could not save state");
+		}
+	}
+};
+
 struct PyMovie {
 	std::unique_ptr<Retro::Movie> m_movie;
 	bool recording = false;
@@ -459,25 +1328,63 @@ py::str dataPath(py::handle hint = py::none()) {
 	return Retro::GameData::dataPath(py::str(hint));
 }
 
+py::list coreProfiles(const string& core) {
+	py::list profiles;
+	for (const auto& profile : Retro::coreProfiles(core)) {
+		profiles.append(profile);
+	}
+	return profiles;
+}
+
 PYBIND11_MODULE(_retro, m) {
 	m.doc() = "libretro bindings";
 
 	py::class_<PyRetroEmulator>(m, "RetroEmulator")
-		.def(py::init<const string&>())
-		.def("step", &PyRetroEmulator::step)
+		.def(py::init<const string&, py::object, py::dict>(), py::arg("rom_path"), py::arg("profile") = py::none(), py::arg("options") = py::dict())
+		.def("step", &PyRetroEmulator::step, py::arg("render") = true, py::call_guard<py::gil_scoped_release>())
 		.def("set_button_mask", &PyRetroEmulator::setButtonMask, py::arg("mask"), py::arg("player") = 0)
 		.def("get_state", &PyRetroEmulator::getState)
+		.def("get_state_into", &PyRetroEmulator::getStateInto, py::arg("buffer"))
 		.def("set_state", &PyRetroEmulator::setState)
+		.def("state_size", &PyRetroEmulator::stateSize)
 		.def("get_screen", &PyRetroEmulator::getScreen)
 		.def("get_screen_rate", &PyRetroEmulator::getScreenRate)
 		.def("get_audio", &PyRetroEmulator::getAudio)
+		.def("get_audio_view", &PyRetroEmulator::getAudioView)
+		.def("consume_audio", &PyRetroEmulator::consumeAudio)
+		.def("set_audio_buffer", &PyRetroEmulator::setAudioBuffer, py::arg("capacity"), py::arg("accumulate") = false)
+		.def("set_audio_resample_rate", &PyRetroEmulator::setAudioResampleRate)
 		.def("get_audio_rate", &PyRetroEmulator::getAudioRate)
+		.def("set_audio_enabled", &PyRetroEmulator::setAudioEnabled)
+		.def("set_video_enabled", &PyRetroEmulator::setVideoEnabled)
+		.def("set_screen_pool", &PyRetroEmulator::setScreenPool, py::arg("mode") = "max")
+		.def("set_track_changes", &PyRetroEmulator::setTrackChanges, py::arg("track") = true)
+		.def("frame_changed", &PyRetroEmulator::frameChanged)
+		.def("changed_rows", &PyRetroEmulator::changedRows)
+		.def("image_version", &PyRetroEmulator::imageVersion)
+		.def("set_core_profile", &PyRetroEmulator::setCoreProfile)
+		.def("set_core_option", &PyRetroEmulator::setCoreOption)
+		.def("get_core_options", &PyRetroEmulator::getCoreOptions)
 		.def("get_resolution", &PyRetroEmulator::getResolution)
 		.def("configure_data", &PyRetroEmulator::configureData)
+		.def("run_sequence", &PyRetroEmulator::runSequence, py::arg("masks"), py::arg("data") = py::none(), py::arg("rewards") = py::none(), py::arg("variables") = py::none(), py::arg("trace") = py::none(), py::arg("skip_video") = false)
 		.def("add_cheat", &PyRetroEmulator::addCheat)
 		.def("clear_cheats", &PyRetroEmulator::clearCheats)
 		.def_static("load_core_info", &PyRetroEmulator::loadCoreInfo);
 
+	py::class_<PyStateBuffer>(m, "StateBuffer", py::buffer_protocol())
+		.def_buffer([](PyStateBuffer& state) {
+			return py::buffer_info(state.m_data.data(), state.m_data.size(), true);
+		})
+		.def("__len__", &PyStateBuffer::size)
+		.def("__bytes__", &PyStateBuffer::bytes);
+
+	py::class_<PyStatePool>(m, "StatePool")
+		.def(py::init<py::object, size_t>(), py::arg("emulator"), py::arg("capacity") = 16)
+		.def("save", &PyStatePool::save)
+		.def("load", &PyStatePool::load, py::arg("state"))
+		.def("available", &PyStatePool::available);
+
 	py::class_<PyMemoryView>(m, "Memory")
 		.def(py::init<Retro::AddressSpace&>())
 		.def("extract", &PyMemoryView::extract, py::arg("address"), py::arg("type"))
@@ -501,6 +1408,10 @@ PYBIND11_MODULE(_retro, m) {
 		.def("filter_action", &PyGameData::filterAction)
 		.def("valid_actions", &PyGameData::validActions)
 		.def("update_ram", &PyGameData::updateRam)
+		.def("set_shadow_ram", &PyGameData::setShadowRam, py::arg("shadow") = true)
+		.def("shadow_ram", &PyGameData::shadowRam)
+		.def("step", &PyGameData::step, py::arg("emulator"), py::arg("action"), py::arg("actions") = static_cast<int>(ActionType::FILTERED), py::arg("players") = 1, py::arg("frameskip") = 1, py::arg("obs_type") = static_cast<int>(ObservationType::IMAGE), py::arg("skip_video") = false, py::arg("observation") = nullptr)
+		.def("get_ram", &PyGameData::getRam)
 		.def("lookup_value", &PyGameData::lookupValue)
 		.def("set_value", &PyGameData::setValue)
 		.def("lookup_all", &PyGameData::lookupAll)
@@ -508,6 +1419,8 @@ PYBIND11_MODULE(_retro, m) {
 		.def("set_variable", &PyGameData::setVariable)
 		.def("remove_variable", &PyGameData::removeVariable)
 		.def("list_variables", &PyGameData::listVariables)
+		.def("variable_names", &PyGameData::variableNames)
+		.def("lookup_array", &PyGameData::lookupArray)
 		.def("search", &PyGameData::search)
 		.def("delta_search", &PyGameData::deltaSearch)
 		.def("get_search", &PyGameData::getSearch)
@@ -519,6 +1432,18 @@ PYBIND11_MODULE(_retro, m) {
 		.def("crop_info", &PyGameData::cropInfo, py::arg("player") = 0)
 		.def_property_readonly("memory", &PyGameData::memory);
 
+	py::class_<PyObservation>(m, "Observation")
+		.def(py::init<size_t, size_t, bool, unsigned, const string&, const string&, const string&, const string&>(), py::arg("width") = 0, py::arg("height") = 0, py::arg("grayscale") = false, py::arg("stack") = 1, py::arg("filter") = "nearest", py::arg("layout") = "hwc", py::arg("dtype") = "uint8", py::arg("color") = "rgb")
+		.def("set_crop", &PyObservation::setCrop, py::arg("x"), py::arg("y"), py::arg("width"), py::arg("height"))
+		.def("reset", &PyObservation::reset)
+		.def("palette", &PyObservation::palette)
+		.def("update", &PyObservation::update, py::arg("emulator"), py::arg("data") = py::none());
+
+	py::class_<PyBranchEvaluator>(m, "BranchEvaluator")
+		.def(py::init<py::object, py::object, unsigned>(), py::arg("emulator"), py::arg("data"), py::arg("workers") = 1)
+		.def("workers", &PyBranchEvaluator::workers)
+		.def("evaluate", &PyBranchEvaluator::evaluate, py::arg("state"), py::arg("branches"), py::arg("actions") = static_cast<int>(ActionType::FILTERED), py::arg("players") = 1, py::arg("frameskip") = 1, py::arg("obs_type") = py::none());
+
 	py::class_<PyMovie>(m, "Movie")
 		.def(py::init<py::str, bool, unsigned>(), py::arg("path"), py::arg("record") = false, py::arg("players") = 1)
 		.def("configure", &PyMovie::configure)
@@ -532,5 +1457,6 @@ PYBIND11_MODULE(_retro, m) {
 		.def("set_state", &PyMovie::setState);
 
 	m.def("core_path", &::corePath, py::arg("hint") = py::none());
+	m.def("core_profiles", &::coreProfiles, py::arg("core"));
 	m.def("data_path", &::dataPath, py::arg("hint") = py::none());
 }
@@ -174,42 +174,52 @@ void Search::search(const AddressSpace& mem, int64_t value) {
 void Search::delta(const AddressSpace& mem, const AddressSpace& oldMem, Operation op, int64_t reference) {
 	vector<DataType> newTypes;
 	multimap<size_t, DataType> results;
+	vector<size_t> offsets;
+	vector<int64_t> values;
+	vector<int64_t> oldValues;
 	for (const auto& type : m_types) {
 		for (const auto& block : mem.blocks()) {
 			const MemoryView<>& oldBlock = oldMem.block(block.first);
-			const DynamicMemoryView dynmem(const_cast<void*>(block.second.offset(0)), block.second.size(), type, mem.overlay());
-			const DynamicMemoryView dynmemOld(const_cast<void*>(oldBlock.offset(0)), oldBlock.size(), type, mem.overlay());
-			vector<size_t> addresses;
+			size_t count;
+			offsets.clear();
 			if (m_hasStarted) {
 				for (const auto& result : m_current) {
 					if (result.type == type && result.address >= block.first && result.address + type.width - block.first <= block.second.size()) {
-						addresses.push_back(result.address);
+						offsets.push_back(result.address - block.first);
 					}
 				}
-				if (!addresses.size()) {
+				if (!offsets.size()) {
 					continue;
 				}
+				count = offsets.size();
+			} else if (block.second.size() >= type.width) {
+				count = block.second.size() + 1 - type.width;
+			} else {
+				continue;
 			}
-
-			if (addresses.size()) {
-				for (const auto& i : addresses) {
-					int64_t delta = dynmem[i - block.first] - dynmemOld[i - block.first];
-					if (calculate(op, reference, delta)) {
-						if (!newTypes.size() || newTypes.back() != type) {
-							newTypes.emplace_back(type);
-						}
-						results.emplace(i, type);
-					}
+			const size_t* offsetData = offsets.size() ? offsets.data() : nullptr;
+
+			values.resize(count);
+			oldValues.resize(count);
+			if (mem.overlay().width > 1) {
+				const DynamicMemoryView dynmem(const_cast<void*>(block.second.offset(0)), block.second.size(), type, mem.overlay());
+				const DynamicMemoryView dynmemOld(const_cast<void*>(oldBlock.offset(0)), oldBlock.size(), type, mem.overlay());
+				for (size_t i = 0; i < count; ++i) {
+					size_t offset = offsetData ? offsetData[i] : i;
+					values[i] = dynmem[offset];
+					oldValues[i] = dynmemOld[offset];
 				}
 			} else {
-				for (size_t i = 0; i + type.width <= block.second.size(); ++i) {
-					int64_t delta = dynmem[i] - dynmemOld[i];
-					if (calculate(op, reference, delta)) {
-						if (!newTypes.size() || newTypes.back() != type) {
-							newTypes.emplace_back(type);
-						}
-						results.emplace(i + block.first, type);
+				type.decodeMany(block.second.offset(0), offsetData, count, values.data());
+				type.decodeMany(oldBlock.offset(0), offsetData, count, oldValues.data());
+			}
+
+			for (size_t i = 0; i < count; ++i) {
+				if (calculate(op, reference, values[i] - oldValues[i])) {
+					if (!newTypes.size() || newTypes.back() != type) {
+						newTypes.emplace_back(type);
 					}
+					results.emplace((offsetData ? offsetData[i] : i) + block.first, type);
 				}
 			}
 		}
@@ -86,6 +86,72 @@ TEST(GameData, Load) {
 	EXPECT_THAT(data.listVariables(), UnorderedElementsAre(make_pair("foo", Variable("|u1", 0))));
 }
 
+TEST(GameData, LookupVariables) {
+	GameData data;
+	uint8_t ram[] = { 1, 2, 3, 4 };
+	data.addressSpace().addBlock(0, sizeof(ram), ram);
+	data.setVariable("foo", { ">u2", 0 });
+	data.setVariable("bar", { "|u1", 2, 0x6 });
+	data.setVariable("baz", { "|u1", 8 });
+	EXPECT_THAT(data.variableNames(), ElementsAre("bar", "baz", "foo"));
+
+	int64_t values[3];
+	data.lookupVariables(values);
+	EXPECT_THAT(values, ElementsAre(2, 0, 0x102));
+
+	ram[2] = 5;
+	data.lookupVariables(values);
+	EXPECT_THAT(values, ElementsAre(4, 0, 0x102));
+
+	// Remapping memory or changing variables recompiles the table
+	uint8_t moved[] = { 6, 7, 8, 9 };
+	data.addressSpace().reset();
+	data.addressSpace().addBlock(0, sizeof(moved), moved);
+	data.removeVariable("baz");
+	EXPECT_THAT(data.variableNames(), ElementsAre("bar", "foo"));
+	data.lookupVariables(values);
+	EXPECT_THAT(make_pair(values[0], values[1]), Pair(0, 0x607));
+
+	data.addressSpace().setOverlay(MemoryOverlay{ '=', '>', 2 });
+	data.lookupVariables(values);
+	EXPECT_THAT(make_pair(values[0], values[1]), Pair(static_cast<int64_t>(data.lookupValue("bar")), static_cast<int64_t>(data.lookupValue("foo"))));
+
+	data.reset();
+	EXPECT_THAT(data.variableNames(), IsEmpty());
+}
+
+TEST(GameData, ShadowRam) {
+	GameData data;
+	uint8_t ram[] = { 1, 2, 3, 4 };
+	data.addressSpace().addBlock(0, sizeof(ram), ram);
+	data.addressSpace().setOverlay(MemoryOverlay{ '=', '>', 2 });
+	data.setVariable("foo", { ">u2", 0 });
+	data.setVariable("bar", { "|u1", 3 });
+	data.updateRam();
+	const GameData& cdata = data;
+	EXPECT_EQI(cdata.lookupValue("foo"), 0x201);
+	EXPECT_EQI(cdata.lookupValue("bar"), 3);
+
+	data.setShadowRam(true);
+	EXPECT_EQI(cdata.lookupValue("foo"), 0x201);
+	EXPECT_EQI(cdata.lookupValue("bar"), 3);
+	EXPECT_THAT(cdata.lookupAll(), ValuesAre(({ make_pair("foo", 0x201), make_pair("bar", 3) })));
+	int64_t values[2];
+	data.lookupVariables(values);
+	EXPECT_THAT(values, ElementsAre(3, 0x201));
+
+	ram[2] = 5;
+	data.updateRam();
+	EXPECT_EQI(cdata.lookupValue("bar"), 5);
+	EXPECT_EQ(data.lookupDelta("bar"), 2);
+	data.lookupVariables(values);
+	EXPECT_THAT(values, ElementsAre(5, 0x201));
+
+	data.setValue("foo", 0x607);
+	EXPECT_THAT(ram, ElementsAre(7, 6, 5, 4));
+	EXPECT_EQI(cdata.lookupValue("foo"), 0x607);
+}
+
 TEST(GameData, FailLoad) {
 	GameData data;
 	uint8_t ram[] = { 1 };
@@ -371,6 +437,42 @@ TEST(Scenario, ManualDone) {
 	EXPECT_TRUE(scen.isDone());
 }
 
+TEST(Scenario, ShadowRam) {
+	GameData data;
+	Scenario scen(data);
+
+	uint8_t ram[] = { 1, 2, 3, 4 };
+	data.addressSpace().addBlock(0, sizeof(ram), ram);
+	data.addressSpace().setOverlay(MemoryOverlay{ '=', '>', 2 });
+	data.setVariable("foo", { ">u2", 0 });
+	data.setVariable("bar", { "|u1", 3 });
+	data.setShadowRam(true);
+
+	scen.setRewardVariable("foo", { M::ABSOLUTE, O::NOOP, 0, 1, 0 });
+	scen.setDoneVariable("bar", { M::ABSOLUTE, O::ZERO, 0 });
+
+	data.updateRam();
+	scen.update();
+	EXPECT_FLOAT_EQ(scen.currentReward(), 0x201);
+	EXPECT_FALSE(scen.isDone());
+
+	// Scoring only reads, so it leaves the shadow built by updateRam() alone and
+	// a change the shadow wasn't told about stays unseen
+	const GameData& cdata = data;
+	ram[0] = 9;
+	EXPECT_EQI(cdata.lookupValue("foo"), 0x201);
+
+	// Writes make the shadow stale
+	data.setValue("bar", 0);
+	EXPECT_EQI(cdata.lookupValue("bar"), 0);
+	EXPECT_EQI(cdata.lookupValue("foo"), 0x209);
+
+	data.updateRam();
+	scen.update();
+	EXPECT_FLOAT_EQ(scen.currentReward(), 0x209);
+	EXPECT_TRUE(scen.isDone());
+}
+
 TEST(Scenario, MultipleReward) {
 	GameData data;
 	Scenario scen(data);
@@ -2,10 +2,13 @@
 #include "gmock/gmock.h"
 
 #include "coreinfo.h"
+#include "data.h"
 #include "emulator.h"
 
+#include <cstring>
 #include <sstream>
 #include <fstream>
+#include <thread>
 
 using namespace std;
 using namespace ::testing;
@@ -61,6 +64,15 @@ TEST_P(EmulatorTest, Load) {
 	e.run();
 }
 
+TEST_P(EmulatorTest, LoadMissing) {
+	const auto& param = GetParam();
+	Emulator e;
+	string ext = param.rom.substr(param.rom.rfind('.'));
+	EXPECT_FALSE(e.loadRom("roms/missing" + ext));
+	ASSERT_TRUE(e.loadRom("roms/" + param.rom));
+	e.run();
+}
+
 TEST_P(EmulatorTest, AutoUnload) {
 	const auto& param = GetParam();
 	{
@@ -111,6 +123,166 @@ TEST_P(EmulatorTest, Output) {
 	EXPECT_THAT(e.getAudioData(), NotNull());
 }
 
+TEST_P(EmulatorTest, Headless) {
+	const auto& param = GetParam();
+	Emulator e;
+	ASSERT_TRUE(e.loadRom("roms/" + param.rom));
+	e.setAudioEnabled(false);
+	e.setVideoEnabled(false);
+	e.run();
+	e.run();
+	EXPECT_EQ(e.getAudioSamples(), 0);
+
+	e.setAudioEnabled(true);
+	e.setVideoEnabled(true);
+	e.run();
+	e.run();
+	EXPECT_GT(e.getAudioSamples(), 0);
+	EXPECT_THAT(e.getImageData(), NotNull());
+}
+
+TEST_P(EmulatorTest, RenderSkip) {
+	const auto& param = GetParam();
+	Emulator e;
+	Emulator reference;
+	ASSERT_TRUE(e.loadRom("roms/" + param.rom));
+	ASSERT_TRUE(reference.loadRom("roms/" + param.rom));
+	for (int i = 0; i < 120; ++i) {
+		// Hold a different button every few frames to get past title screens
+		e.setButtonMask(0, 1 << (i / 8 % N_BUTTONS));
+		reference.setButtonMask(0, 1 << (i / 8 % N_BUTTONS));
+		e.run(false);
+		reference.run();
+		EXPECT_GT(e.getAudioSamples(), 0);
+		EXPECT_TRUE(e.videoEnabled());
+	}
+
+	// Skipping a frame doesn't change what it emulates, sprite collisions included
+	GameData data;
+	GameData expectedData;
+	e.configureData(&data);
+	reference.configureData(&expectedData);
+	ASSERT_EQ(data.addressSpace().blocks().size(), expectedData.addressSpace().blocks().size());
+	for (const auto& block : expectedData.addressSpace().blocks()) {
+		const auto& ram = static_cast<const GameData&>(data).addressSpace().block(block.first);
+		ASSERT_EQ(ram.size(), block.second.size());
+		EXPECT_EQ(memcmp(ram.offset(0), block.second.offset(0), ram.size()), 0) << block.first;
+	}
+
+	e.run(true);
+	reference.run();
+	ASSERT_THAT(e.getImageData(), NotNull());
+	ASSERT_THAT(reference.getImageData(), NotNull());
+	ASSERT_EQ(e.getImageWidth(), reference.getImageWidth());
+	ASSERT_EQ(e.getImageHeight(), reference.getImageHeight());
+	ASSERT_EQ(e.getImageDepth(), reference.getImageDepth());
+
+	// Skipped frames still advance emulation, so the next rendered frame matches
+	size_t rowSize = e.getImageWidth() * ((e.getImageDepth() + 7) / 8);
+	const uint8_t* image = static_cast<const uint8_t*>(e.getImageData());
+	const uint8_t* expected = static_cast<const uint8_t*>(reference.getImageData());
+	for (int y = 0; y < e.getImageHeight(); ++y) {
+		ASSERT_EQ(memcmp(&image[y * e.getImagePitch()], &expected[y * reference.getImagePitch()], rowSize), 0) << y;
+	}
+}
+
+TEST_P(EmulatorTest, RunSequence) {
+	const auto& param = GetParam();
+	Emulator e;
+	ASSERT_TRUE(e.loadRom("roms/" + param.rom));
+	vector<uint16_t> masks{ 0, 0, 1, 0, 0x80, 0, 0xFFFF, 0 };
+	vector<size_t> seen;
+	size_t frames = e.runSequence(masks.data(), 4, 2, [&](size_t frame) {
+		seen.push_back(frame);
+		return true;
+	});
+	EXPECT_EQ(frames, 4);
+	EXPECT_EQ(seen, (vector<size_t>{ 0, 1, 2, 3 }));
+	EXPECT_TRUE(e.getKey(0, 0));
+	EXPECT_TRUE(e.getKey(0, 15));
+	EXPECT_FALSE(e.getKey(1, 0));
+
+	frames = e.runSequence(masks.data(), 4, 2, [](size_t frame) { return frame < 1; }, false);
+	EXPECT_EQ(frames, 2);
+	EXPECT_FALSE(e.getKey(0, 7));
+	EXPECT_TRUE(e.getKey(0, 0));
+}
+
+TEST_P(EmulatorTest, AudioAccumulate) {
+	const auto& param = GetParam();
+	Emulator e;
+	ASSERT_TRUE(e.loadRom("roms/" + param.rom));
+	e.run();
+	int perFrame = e.getAudioSamples();
+	ASSERT_GT(perFrame, 0);
+
+	e.setAudioAccumulate(true);
+	e.consumeAudio(perFrame);
+	EXPECT_EQ(e.getAudioSamples(), 0);
+	for (int i = 0; i < 10; ++i) {
+		e.run();
+	}
+	int total = e.getAudioSamples();
+	EXPECT_GT(total, perFrame);
+
+	vector<int16_t> last(&e.getAudioData()[(total - 1) * 2], &e.getAudioData()[total * 2]);
+	e.consumeAudio(total - 1);
+	ASSERT_EQ(e.getAudioSamples(), 1);
+	EXPECT_EQ(vector<int16_t>(e.getAudioData(), &e.getAudioData()[2]), last);
+
+	e.setAudioCapacity(16);
+	e.run();
+	EXPECT_EQ(e.getAudioSamples(), 16);
+}
+
+TEST_P(EmulatorTest, AudioResample) {
+	const auto& param = GetParam();
+	Emulator e;
+	ASSERT_TRUE(e.loadRom("roms/" + param.rom));
+	double rate = e.getAudioRate();
+	e.setAudioAccumulate(true);
+	e.run();
+	e.consumeAudio(e.getAudioSamples());
+	for (int i = 0; i < 10; ++i) {
+		e.run();
+	}
+	double native = e.getAudioSamples();
+
+	e.setAudioResampleRate(rate / 2);
+	EXPECT_EQ(e.getAudioRate(), rate / 2);
+	e.consumeAudio(e.getAudioSamples());
+	for (int i = 0; i < 10; ++i) {
+		e.run();
+	}
+	EXPECT_NEAR(e.getAudioSamples(), native / 2, native / 50 + 2);
+}
+
+TEST_P(EmulatorTest, CoreOptions) {
+	const auto& param = GetParam();
+	Emulator e;
+	e.setCoreOption("retro_test_option", "before");
+	ASSERT_TRUE(e.loadRom("roms/" + param.rom));
+	EXPECT_EQ(e.coreOption("retro_test_option"), "before");
+	for (const auto& core : Retro::cores()) {
+		if (Retro::libForCore(core) == Retro::libForCore(param.system)) {
+			EXPECT_EQ(Retro::coreOptions(core), Retro::coreOptions(param.system));
+		}
+	}
+	e.run();
+
+	e.setCoreOption("retro_test_option", "after");
+	EXPECT_EQ(e.coreOption("retro_test_option"), "after");
+	for (const auto& profile : Retro::coreProfiles(param.system)) {
+		e.setCoreProfile(profile);
+		for (const auto& option : Retro::coreOptions(param.system, profile)) {
+			EXPECT_EQ(e.coreOption(option.first), option.second);
+		}
+		e.run();
+		e.run();
+	}
+	EXPECT_EQ(e.coreOption("retro_test_option"), "after");
+}
+
 TEST_P(EmulatorTest, States) {
 	const auto& param = GetParam();
 	Emulator e;
@@ -129,6 +301,137 @@ TEST_P(EmulatorTest, States) {
 	e.run();
 }
 
+TEST_P(EmulatorTest, StateDeterminism) {
+	const auto& param = GetParam();
+	vector<uint8_t> state;
+	vector<vector<uint8_t>> runs;
+	auto play = [&](Emulator& e, int frames) {
+		for (int i = 0; i < frames; ++i) {
+			e.setButtonMask(0, 1 << (i / 8 % N_BUTTONS));
+			e.run();
+		}
+	};
+	// Plays on from the state and returns the RAM and image it ends up with
+	auto record = [&](Emulator& e) {
+		EXPECT_TRUE(e.unserialize(state.data(), state.size()));
+		play(e, 60);
+		vector<uint8_t> out;
+		const uint8_t* audio = reinterpret_cast<const uint8_t*>(e.getAudioData());
+		out.insert(out.end(), audio, audio + e.getAudioSamples() * 4);
+		GameData data;
+		e.configureData(&data);
+		for (const auto& block : static_cast<const GameData&>(data).addressSpace().blocks()) {
+			const uint8_t* ram = static_cast<const uint8_t*>(block.second.offset(0));
+			out.insert(out.end(), ram, ram + block.second.size());
+		}
+		size_t rowSize = e.getImageWidth() * ((e.getImageDepth() + 7) / 8);
+		const uint8_t* image = static_cast<const uint8_t*>(e.getImageData());
+		for (int y = 0; y < e.getImageHeight(); ++y) {
+			out.insert(out.end(), &image[y * e.getImagePitch()], &image[y * e.getImagePitch() + rowSize]);
+		}
+		return out;
+	};
+
+	// Loading a state mid-game gives the same run as loading it into a freshly
+	// loaded game
+	{
+		Emulator e;
+		ASSERT_TRUE(e.loadRom("roms/" + param.rom));
+		play(e, 30);
+		state.resize(e.serializeSize());
+		ASSERT_TRUE(e.serialize(state.data(), state.size()));
+		play(e, 90);
+		runs.emplace_back(record(e));
+	}
+	{
+		Emulator e;
+		ASSERT_TRUE(e.loadRom("roms/" + param.rom));
+		runs.emplace_back(record(e));
+	}
+	ASSERT_EQ(runs[0].size(), runs[1].size());
+	EXPECT_TRUE(runs[0] == runs[1]);
+}
+
+TEST_P(EmulatorTest, TrackChanges) {
+	const auto& param = GetParam();
+	Emulator e;
+	ASSERT_TRUE(e.loadRom("roms/" + param.rom));
+	e.setTrackChanges(true);
+	e.run();
+	EXPECT_TRUE(e.frameChanged());
+	unsigned begin, end;
+	e.getChangedRows(&begin, &end);
+	EXPECT_EQ(begin, 0);
+	EXPECT_EQ(end, e.getImageHeight());
+
+	// Replaying a frame draws the same image again
+	vector<uint8_t> state(e.serializeSize());
+	ASSERT_TRUE(e.serialize(state.data(), state.size()));
+	e.run();
+	uint64_t version = e.imageVersion();
+	ASSERT_TRUE(e.unserialize(state.data(), state.size()));
+	e.run();
+	EXPECT_FALSE(e.frameChanged());
+	EXPECT_EQ(e.imageVersion(), version);
+	e.getChangedRows(&begin, &end);
+	EXPECT_EQ(begin, end);
+
+	e.setTrackChanges(false);
+	e.run();
+	EXPECT_TRUE(e.frameChanged());
+	EXPECT_EQ(e.imageVersion(), version + 1);
+}
+
+TEST_P(EmulatorTest, MultipleInstances) {
+	const auto& param = GetParam();
+	Emulator e;
+	Emulator f;
+	ASSERT_TRUE(e.loadRom("roms/" + param.rom));
+	ASSERT_TRUE(f.loadRom("roms/" + param.rom));
+	EXPECT_TRUE(Emulator::isLoaded());
+
+	vector<uint8_t> initial(e.serializeSize());
+	ASSERT_TRUE(e.serialize(initial.data(), initial.size()));
+	for (int i = 0; i < 10; ++i) {
+		f.run();
+	}
+	vector<uint8_t> v(e.serializeSize());
+	ASSERT_TRUE(e.serialize(v.data(), v.size()));
+	EXPECT_EQ(v, initial);
+
+	e.unloadCore();
+	f.run();
+}
+
+TEST_P(EmulatorTest, Threads) {
+	const auto& param = GetParam();
+	Emulator emulators[4];
+	for (auto& e : emulators) {
+		ASSERT_TRUE(e.loadRom("roms/" + param.rom));
+	}
+	vector<thread> threads;
+	for (auto& e : emulators) {
+		threads.emplace_back([&e]() {
+			for (int i = 0; i < 60; ++i) {
+				e.run();
+			}
+		});
+	}
+	for (auto& t : threads) {
+		t.join();
+	}
+
+	// Savestates can embed host pointers, so compare the rendered frames instead
+	auto frame = [](Emulator& e) {
+		const uint8_t* data = static_cast<const uint8_t*>(e.getImageData());
+		return vector<uint8_t>(data, data + e.getImagePitch() * e.getImageHeight());
+	};
+	vector<uint8_t> first = frame(emulators[0]);
+	for (auto& e : emulators) {
+		EXPECT_EQ(frame(e), first);
+	}
+}
+
 vector<EmulatorTestParam> s_systems{
 	{ "Nes", "Dr88-FamiconIntro.nes" },
 	{ "Snes", "Anthrox-SineDotDemo.sfc" },
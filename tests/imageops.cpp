@@ -0,0 +1,594 @@
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+
+#include "imageops.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace ::testing;
+
+struct ImageOpsTestParam {
+	string system;
+	size_t w;
+	size_t h;
+};
+
+struct ImageOpsTestParamName {
+	string operator()(const TestParamInfo<ImageOpsTestParam>& info) const {
+		return info.param.system;
+	}
+};
+
+class ImageOpsTest : public TestWithParam<ImageOpsTestParam> {
+public:
+	virtual void TearDown() override;
+};
+
+void ImageOpsTest::TearDown() {
+	Retro::Image::useKernels(Retro::Image::bestKernels());
+}
+
+namespace Retro {
+
+static const pair<Image::Kernels, const char*> s_kernels[] = {
+	{ Image::Kernels::SCALAR, "scalar" },
+	{ Image::Kernels::SSSE3, "ssse3" },
+	{ Image::Kernels::AVX2, "avx2" },
+	{ Image::Kernels::AVX512, "avx512" },
+	{ Image::Kernels::NEON, "neon" },
+};
+
+struct ImageOp {
+	const char* name;
+	Image::Format format;
+	size_t depth;
+	int divisor;
+};
+
+static const ImageOp s_ops[] = {
+	{ "565-to-888", Image::Format::RGB565, 2, 1 },
+	{ "1555-to-888", Image::Format::RGB1555, 2, 1 },
+	{ "x888-to-888", Image::Format::RGBX888, 4, 1 },
+	{ "halve-565", Image::Format::RGB565, 2, 2 },
+	{ "halve-1555", Image::Format::RGB1555, 2, 2 },
+	{ "halve-x888", Image::Format::RGBX888, 4, 2 },
+	{ "quarter-565", Image::Format::RGB565, 2, 4 },
+	{ "quarter-1555", Image::Format::RGB1555, 2, 4 },
+	{ "quarter-x888", Image::Format::RGBX888, 4, 4 },
+};
+
+/* Rows are padded so that they don't start on vector boundaries, and the output
+ * has a guard band to catch writes past the end */
+static const size_t s_padding = 5;
+static const size_t s_guard = 64;
+static const uint8_t s_guardByte = 0xA5;
+
+static vector<uint8_t> makeInput(const ImageOp& op, size_t w, size_t h) {
+	vector<uint8_t> input((w + s_padding) * h * op.depth + op.depth);
+	mt19937 rng(w * h);
+	for (auto& byte : input) {
+		byte = rng();
+	}
+	return input;
+}
+
+static vector<uint8_t> makeOutput(const ImageOp& op, size_t w, size_t h) {
+	size_t depth = op.divisor == 1 ? 3 : 1;
+	return vector<uint8_t>((w / op.divisor) * (h / op.divisor) * depth + s_guard, s_guardByte);
+}
+
+static void convert(const ImageOp& op, const vector<uint8_t>& input, vector<uint8_t>* output, size_t w, size_t h) {
+	Image in(op.format, static_cast<const void*>(&input[op.depth]), w, h, (w + s_padding) * op.depth);
+	size_t ow = w / op.divisor;
+	size_t oh = h / op.divisor;
+	if (op.divisor == 1) {
+		Image out(Image::Format::RGB888, static_cast<void*>(output->data()), ow, oh, ow * 3);
+		in.copyTo(&out);
+	} else {
+		Image out(Image::Format::G8, static_cast<void*>(output->data()), ow, oh, ow);
+		in.divideTo(op.divisor, &out);
+	}
+}
+
+TEST(ImageOps, Kernels) {
+	EXPECT_TRUE(Image::supportsKernels(Image::Kernels::SCALAR));
+	EXPECT_TRUE(Image::supportsKernels(Image::bestKernels()));
+	EXPECT_EQ(Image::activeKernels(), Image::bestKernels());
+	for (const auto& kernels : s_kernels) {
+		if (Image::supportsKernels(kernels.first)) {
+			Image::useKernels(kernels.first);
+			EXPECT_EQ(Image::activeKernels(), kernels.first);
+		} else {
+			EXPECT_THROW(Image::useKernels(kernels.first), invalid_argument);
+		}
+	}
+	Image::useKernels(Image::bestKernels());
+}
+
+TEST_P(ImageOpsTest, MatchesScalar) {
+	const auto& param = GetParam();
+	for (const auto& op : s_ops) {
+		vector<uint8_t> input = makeInput(op, param.w, param.h);
+		Image::useKernels(Image::Kernels::SCALAR);
+		vector<uint8_t> expected = makeOutput(op, param.w, param.h);
+		convert(op, input, &expected, param.w, param.h);
+		for (size_t i = expected.size() - s_guard; i < expected.size(); ++i) {
+			ASSERT_EQ(expected[i], s_guardByte) << op.name;
+		}
+		for (const auto& kernels : s_kernels) {
+			if (!Image::supportsKernels(kernels.first)) {
+				continue;
+			}
+			Image::useKernels(kernels.first);
+			vector<uint8_t> output = makeOutput(op, param.w, param.h);
+			convert(op, input, &output, param.w, param.h);
+			EXPECT_EQ(output, expected) << op.name << " " << kernels.second;
+		}
+	}
+}
+
+TEST_P(ImageOpsTest, Channels) {
+	const auto& param = GetParam();
+	vector<uint16_t> rgb565(param.w * param.h, 0xF81F);
+	vector<uint16_t> rgb1555(param.w * param.h, 0x7D41);
+	vector<uint32_t> xrgb(param.w * param.h, 0xFF123456);
+	vector<uint8_t> output(param.w * param.h * 3);
+	for (const auto& kernels : s_kernels) {
+		if (!Image::supportsKernels(kernels.first)) {
+			continue;
+		}
+		Image::useKernels(kernels.first);
+		Image out(Image::Format::RGB888, static_cast<void*>(output.data()), param.w, param.h, param.w * 3);
+
+		Image(Image::Format::RGB565, static_cast<const void*>(rgb565.data()), param.w, param.h, param.w * 2).copyTo(&out);
+		EXPECT_THAT(vector<uint8_t>(output.end() - 3, output.end()), ElementsAre(0xF8, 0x00, 0xF8)) << kernels.second;
+		EXPECT_THAT(vector<uint8_t>(output.begin(), output.begin() + 3), ElementsAre(0xF8, 0x00, 0xF8)) << kernels.second;
+
+		Image(Image::Format::RGB1555, static_cast<const void*>(rgb1555.data()), param.w, param.h, param.w * 2).copyTo(&out);
+		EXPECT_THAT(vector<uint8_t>(output.end() - 3, output.end()), ElementsAre(0xF8, 0x50, 0x08)) << kernels.second;
+		EXPECT_THAT(vector<uint8_t>(output.begin(), output.begin() + 3), ElementsAre(0xF8, 0x50, 0x08)) << kernels.second;
+
+		Image(Image::Format::RGBX888, static_cast<const void*>(xrgb.data()), param.w, param.h, param.w * 4).copyTo(&out);
+		EXPECT_THAT(vector<uint8_t>(output.end() - 3, output.end()), ElementsAre(0x12, 0x34, 0x56)) << kernels.second;
+		EXPECT_THAT(vector<uint8_t>(output.begin(), output.begin() + 3), ElementsAre(0x12, 0x34, 0x56)) << kernels.second;
+	}
+}
+
+/* 0RGB1555 holds the same colors as 565 with the low bit of green clear */
+TEST_P(ImageOpsTest, Matches565) {
+	const auto& param = GetParam();
+	vector<uint16_t> rgb1555(param.w * param.h);
+	vector<uint16_t> rgb565(param.w * param.h);
+	mt19937 rng(param.h);
+	for (size_t i = 0; i < rgb1555.size(); ++i) {
+		rgb1555[i] = rng() & 0x7FFF;
+		rgb565[i] = ((rgb1555[i] & 0x7FE0) << 1) | (rgb1555[i] & 0x001F);
+	}
+	Image in1555(Image::Format::RGB1555, static_cast<const void*>(rgb1555.data()), param.w, param.h, param.w * 2);
+	Image in565(Image::Format::RGB565, static_cast<const void*>(rgb565.data()), param.w, param.h, param.w * 2);
+	for (int divisor : { 1, 2, 4 }) {
+		size_t ow = param.w / divisor;
+		size_t oh = param.h / divisor;
+		Image::Format format = divisor == 1 ? Image::Format::RGB888 : Image::Format::G8;
+		vector<uint8_t> expected(ow * oh * Image::depth(format));
+		vector<uint8_t> output(expected.size());
+		Image expectedImage(format, static_cast<void*>(expected.data()), ow, oh, ow * Image::depth(format));
+		Image outputImage(format, static_cast<void*>(output.data()), ow, oh, ow * Image::depth(format));
+		in565.divideTo(divisor, &expectedImage);
+		in1555.divideTo(divisor, &outputImage);
+		EXPECT_EQ(output, expected) << divisor;
+	}
+	vector<uint8_t> expected(84 * 84 * 3);
+	vector<uint8_t> output(expected.size());
+	Image expectedImage(Image::Format::RGB888, static_cast<void*>(expected.data()), 84, 84, 84 * 3);
+	Image outputImage(Image::Format::RGB888, static_cast<void*>(output.data()), 84, 84, 84 * 3);
+	in565.resizeTo(&expectedImage, Image::Filter::BILINEAR);
+	in1555.resizeTo(&outputImage, Image::Filter::BILINEAR);
+	EXPECT_EQ(output, expected);
+}
+
+/* A frame of a few colours in runs of random length, like older consoles draw */
+template<typename T>
+static vector<T> makeRuns(size_t w, size_t h, size_t stride, size_t colors, T mask) {
+	vector<T> frame(stride * h);
+	mt19937 rng(w + h);
+	vector<T> palette(colors);
+	for (auto& color : palette) {
+		color = rng() & mask;
+	}
+	T color = palette[0];
+	for (size_t y = 0; y < h; ++y) {
+		for (size_t x = 0; x < stride; ++x) {
+			if (rng() % 8 == 0) {
+				color = palette[rng() % colors];
+			}
+			/* The unused byte of 0RGB888 varies */
+			frame[stride * y + x] = color | (sizeof(T) == 4 ? (rng() & 0xFF000000) : 0);
+		}
+	}
+	return frame;
+}
+
+template<typename T>
+static void checkIndex(Image::Format format, const vector<T>& frame, size_t w, size_t h, size_t stride) {
+	Image in(format, static_cast<const void*>(frame.data()), w, h, stride * sizeof(T));
+	vector<uint8_t> expected(w * h * 3);
+	Image rgb(Image::Format::RGB888, static_cast<void*>(expected.data()), w, h, w * 3);
+	in.copyTo(&rgb);
+
+	vector<uint8_t> indices((w + 3) * h);
+	Image out(Image::Format::P8, static_cast<void*>(indices.data()), w, h, w + 3);
+	Palette palette;
+	in.indexTo(&out, &palette);
+	EXPECT_LE(palette.size(), 40);
+	for (size_t y = 0; y < h; ++y) {
+		for (size_t x = 0; x < w; ++x) {
+			uint8_t index = indices[(w + 3) * y + x];
+			ASSERT_LT(index, palette.size());
+			for (size_t c = 0; c < 3; ++c) {
+				ASSERT_EQ(palette.colors()[index * 3 + c], expected[(w * y + x) * 3 + c]) << x << " " << y;
+			}
+		}
+	}
+
+	/* Indices stay the same for later frames */
+	vector<uint8_t> again(indices.size());
+	Image outAgain(Image::Format::P8, static_cast<void*>(again.data()), w, h, w + 3);
+	size_t colors = palette.size();
+	in.indexTo(&outAgain, &palette);
+	EXPECT_EQ(palette.size(), colors);
+	EXPECT_EQ(again, indices);
+}
+
+TEST_P(ImageOpsTest, Index) {
+	const auto& param = GetParam();
+	size_t stride = param.w + s_padding;
+	checkIndex(Image::Format::RGB565, makeRuns<uint16_t>(param.w, param.h, stride, 40, 0xFFFF), param.w, param.h, stride);
+	checkIndex(Image::Format::RGB1555, makeRuns<uint16_t>(param.w, param.h, stride, 40, 0x7FFF), param.w, param.h, stride);
+	checkIndex(Image::Format::RGBX888, makeRuns<uint32_t>(param.w, param.h, stride, 40, 0xFFFFFF), param.w, param.h, stride);
+}
+
+TEST(ImageOps, PaletteFull) {
+	vector<uint32_t> xrgb(257);
+	for (size_t i = 0; i < xrgb.size(); ++i) {
+		xrgb[i] = i * 0x010203;
+	}
+	vector<uint8_t> indices(xrgb.size());
+	Image in(Image::Format::RGBX888, static_cast<const void*>(xrgb.data()), 256, 1, 256 * 4);
+	Image out(Image::Format::P8, static_cast<void*>(indices.data()), 256, 1, 256);
+	Palette palette;
+	in.indexTo(&out, &palette);
+	EXPECT_EQ(palette.size(), 256);
+	EXPECT_EQ(indices[255], 255);
+	EXPECT_THAT(vector<uint8_t>(palette.colors() + 3, palette.colors() + 6), ElementsAre(0x01, 0x02, 0x03));
+
+	Image full(Image::Format::RGBX888, static_cast<const void*>(xrgb.data()), 257, 1, 257 * 4);
+	Image fullOut(Image::Format::P8, static_cast<void*>(indices.data()), 257, 1, 257);
+	EXPECT_THROW(full.indexTo(&fullOut, &palette), length_error);
+	palette.clear();
+	EXPECT_EQ(palette.size(), 0);
+}
+
+TEST_P(ImageOpsTest, To565) {
+	const auto& param = GetParam();
+	size_t stride = param.w + s_padding;
+	vector<uint16_t> rgb1555 = makeRuns<uint16_t>(param.w, param.h, stride, 200, 0x7FFF);
+	vector<uint32_t> xrgb = makeRuns<uint32_t>(param.w, param.h, stride, 200, 0xFFFFFF);
+	vector<uint16_t> output(param.w * param.h);
+	Image out(Image::Format::RGB565, static_cast<void*>(output.data()), param.w, param.h, param.w * 2);
+
+	Image(Image::Format::RGB1555, static_cast<const void*>(rgb1555.data()), param.w, param.h, stride * 2).copyTo(&out);
+	for (size_t y = 0; y < param.h; ++y) {
+		for (size_t x = 0; x < param.w; ++x) {
+			uint16_t in = rgb1555[stride * y + x];
+			ASSERT_EQ(output[param.w * y + x], ((in & 0x7FE0) << 1) | (in & 0x001F));
+		}
+	}
+
+	Image(Image::Format::RGBX888, static_cast<const void*>(xrgb.data()), param.w, param.h, stride * 4).copyTo(&out);
+	for (size_t y = 0; y < param.h; ++y) {
+		for (size_t x = 0; x < param.w; ++x) {
+			uint32_t in = xrgb[stride * y + x];
+			ASSERT_EQ(output[param.w * y + x], ((in >> 8) & 0xF800) | ((in >> 5) & 0x07E0) | ((in >> 3) & 0x001F));
+		}
+	}
+}
+
+struct ResizeOp {
+	const char* name;
+	Image::Format format;
+	size_t depth;
+	Image::Filter filter;
+	bool gray;
+};
+
+static const ResizeOp s_resizes[] = {
+	{ "area-565", Image::Format::RGB565, 2, Image::Filter::AREA, false },
+	{ "area-x888-g8", Image::Format::RGBX888, 4, Image::Filter::AREA, true },
+	{ "bilinear-x888", Image::Format::RGBX888, 4, Image::Filter::BILINEAR, false },
+	{ "bilinear-565-g8", Image::Format::RGB565, 2, Image::Filter::BILINEAR, true },
+	{ "nearest-565", Image::Format::RGB565, 2, Image::Filter::NEAREST, false },
+	{ "area-1555-g8", Image::Format::RGB1555, 2, Image::Filter::AREA, true },
+};
+
+static const pair<size_t, size_t> s_resizeTargets[] = {
+	{ 84, 84 },
+	{ 96, 96 },
+	{ 64, 64 },
+	{ 333, 250 },
+};
+
+static vector<uint8_t> resize(const ResizeOp& op, const vector<uint8_t>& input, size_t w, size_t h, size_t ow, size_t oh) {
+	size_t depth = op.gray ? 1 : 3;
+	Image in(op.format, static_cast<const void*>(&input[op.depth]), w, h, (w + s_padding) * op.depth);
+	vector<uint8_t> output((ow + s_padding) * oh * depth + s_guard, s_guardByte);
+	Image out(op.gray ? Image::Format::G8 : Image::Format::RGB888, static_cast<void*>(output.data()), ow, oh, (ow + s_padding) * depth);
+	in.resizeTo(&out, op.filter);
+	return output;
+}
+
+/* Straightforward floating point resampling to check the fixed point sums against */
+static vector<pair<size_t, double>> referenceWeights(size_t in, size_t out, size_t o, Image::Filter filter) {
+	vector<pair<size_t, double>> weights;
+	double scale = double(in) / out;
+	if (filter == Image::Filter::AREA && scale >= 1) {
+		for (size_t i = o * scale; i < in && i < (o + 1) * scale; ++i) {
+			weights.emplace_back(i, (min<double>(i + 1, (o + 1) * scale) - max<double>(i, o * scale)) / scale);
+		}
+	} else {
+		double position = max(0.0, (o + 0.5) * scale - 0.5);
+		size_t i = min<size_t>(position, in - 1);
+		double fraction = i + 1 < in ? position - i : 0;
+		weights.emplace_back(i, 1 - fraction);
+		weights.emplace_back(min(i + 1, in - 1), fraction);
+	}
+	return weights;
+}
+
+TEST_P(ImageOpsTest, ResizeMatchesScalar) {
+	const auto& param = GetParam();
+	for (const auto& op : s_resizes) {
+		for (const auto& target : s_resizeTargets) {
+			vector<uint8_t> input = makeInput({ op.name, op.format, op.depth, 1 }, param.w, param.h);
+			Image::useKernels(Image::Kernels::SCALAR);
+			vector<uint8_t> expected = resize(op, input, param.w, param.h, target.first, target.second);
+			for (size_t i = expected.size() - s_guard; i < expected.size(); ++i) {
+				ASSERT_EQ(expected[i], s_guardByte) << op.name;
+			}
+			for (const auto& kernels : s_kernels) {
+				if (!Image::supportsKernels(kernels.first)) {
+					continue;
+				}
+				Image::useKernels(kernels.first);
+				EXPECT_EQ(resize(op, input, param.w, param.h, target.first, target.second), expected) << op.name << " " << kernels.second << " " << target.first << "x" << target.second;
+			}
+		}
+	}
+}
+
+TEST_P(ImageOpsTest, ResizeReference) {
+	const auto& param = GetParam();
+	vector<uint32_t> input(param.w * param.h);
+	mt19937 rng(param.w);
+	for (auto& pixel : input) {
+		pixel = rng();
+	}
+	Image in(Image::Format::RGBX888, static_cast<const void*>(input.data()), param.w, param.h, param.w * 4);
+	for (Image::Filter filter : { Image::Filter::AREA, Image::Filter::BILINEAR }) {
+		for (const auto& target : s_resizeTargets) {
+			size_t ow = target.first;
+			size_t oh = target.second;
+			vector<uint8_t> output(ow * oh * 3);
+			Image out(Image::Format::RGB888, static_cast<void*>(output.data()), ow, oh, ow * 3);
+			in.resizeTo(&out, filter);
+			for (size_t y = 0; y < oh; ++y) {
+				auto rows = referenceWeights(param.h, oh, y, filter);
+				for (size_t x = 0; x < ow; ++x) {
+					auto columns = referenceWeights(param.w, ow, x, filter);
+					for (size_t c = 0; c < 3; ++c) {
+						double sum = 0;
+						for (const auto& row : rows) {
+							for (const auto& column : columns) {
+								sum += row.second * column.second * ((input[row.first * param.w + column.first] >> (16 - c * 8)) & 0xFF);
+							}
+						}
+						ASSERT_NEAR(output[(y * ow + x) * 3 + c], sum, 1.0) << x << " " << y << " " << ow << "x" << oh;
+					}
+				}
+			}
+		}
+	}
+}
+
+TEST(ImageOps, ResizeReuse) {
+	vector<uint16_t> input(320 * 224);
+	mt19937 rng(320);
+	for (auto& pixel : input) {
+		pixel = rng();
+	}
+	Resampler resampler;
+	for (int pass = 0; pass < 2; ++pass) {
+		for (Image::Filter filter : { Image::Filter::AREA, Image::Filter::BILINEAR }) {
+			for (const auto& target : s_resizeTargets) {
+				size_t ow = target.first;
+				size_t oh = target.second;
+				Image in(Image::Format::RGB1555, static_cast<const void*>(input.data()), 320 - pass * 64, 224, 640);
+				vector<uint8_t> expected(ow * oh);
+				vector<uint8_t> output(ow * oh);
+				Image expectedImage(Image::Format::G8, static_cast<void*>(expected.data()), ow, oh, ow);
+				Image outputImage(Image::Format::G8, static_cast<void*>(output.data()), ow, oh, ow);
+				in.resizeTo(&expectedImage, filter);
+				in.resizeTo(&outputImage, filter, &resampler);
+				ASSERT_EQ(output, expected) << ow << "x" << oh;
+				in.resizeTo(&outputImage, filter, &resampler);
+				ASSERT_EQ(output, expected) << ow << "x" << oh;
+			}
+		}
+	}
+}
+
+TEST(ImageOps, ResizeConstant) {
+	vector<uint16_t> input(320 * 224, 0x7BEF);
+	for (Image::Filter filter : { Image::Filter::NEAREST, Image::Filter::AREA, Image::Filter::BILINEAR }) {
+		vector<uint8_t> output(84 * 84 * 3);
+		Image out(Image::Format::RGB888, static_cast<void*>(output.data()), 84, 84, 84 * 3);
+		Image(Image::Format::RGB565, static_cast<const void*>(input.data()), 320, 224, 640).resizeTo(&out, filter);
+		for (size_t i = 0; i < output.size(); i += 3) {
+			ASSERT_THAT(vector<uint8_t>(&output[i], &output[i + 3]), ElementsAre(0x78, 0x7C, 0x78));
+		}
+	}
+	vector<uint8_t> output(1);
+	Image out(Image::Format::G8, static_cast<void*>(output.data()), 0, 0, 0);
+	EXPECT_THROW(Image(Image::Format::RGB565, static_cast<const void*>(input.data()), 320, 224, 640).resizeTo(&out), invalid_argument);
+}
+
+static const ImageOp s_pools[] = {
+	{ "pool-565", Image::Format::RGB565, 2, 1 },
+	{ "pool-1555", Image::Format::RGB1555, 2, 1 },
+	{ "pool-x888", Image::Format::RGBX888, 4, 1 },
+};
+
+static void pool(const ImageOp& op, const vector<uint8_t>& input, const vector<uint8_t>& previous, vector<uint8_t>* output, size_t w, size_t h, Image::Pool mode, Image::Format format = Image::Format::RGB888) {
+	size_t stride = (w + s_padding) * op.depth;
+	Image in(op.format, static_cast<const void*>(&input[op.depth]), w, h, stride);
+	Image old(op.format, static_cast<const void*>(&previous[op.depth]), w, h, stride);
+	Image out(format, static_cast<void*>(output->data()), w, h, w * Image::depth(format));
+	in.poolTo(&out, &old, mode);
+}
+
+TEST_P(ImageOpsTest, PoolMatchesScalar) {
+	const auto& param = GetParam();
+	for (const auto& op : s_pools) {
+		vector<uint8_t> input = makeInput(op, param.w, param.h);
+		vector<uint8_t> previous = makeInput(op, param.w + 1, param.h);
+		previous.resize(input.size());
+		for (Image::Pool mode : { Image::Pool::MAX, Image::Pool::MEAN }) {
+			Image::useKernels(Image::Kernels::SCALAR);
+			vector<uint8_t> expected = makeOutput(op, param.w, param.h);
+			pool(op, input, previous, &expected, param.w, param.h, mode);
+			for (size_t i = expected.size() - s_guard; i < expected.size(); ++i) {
+				ASSERT_EQ(expected[i], s_guardByte) << op.name;
+			}
+			for (const auto& kernels : s_kernels) {
+				if (!Image::supportsKernels(kernels.first)) {
+					continue;
+				}
+				Image::useKernels(kernels.first);
+				vector<uint8_t> output = makeOutput(op, param.w, param.h);
+				pool(op, input, previous, &output, param.w, param.h, mode);
+				EXPECT_EQ(output, expected) << op.name << " " << kernels.second;
+			}
+
+			/* Pooling to XRGB keeps the same channels */
+			vector<uint8_t> xrgb(param.w * param.h * 4);
+			pool(op, input, previous, &xrgb, param.w, param.h, mode, Image::Format::RGBX888);
+			for (size_t i = 0; i < param.w * param.h; ++i) {
+				ASSERT_EQ(xrgb[i * 4 + 2], expected[i * 3]) << op.name;
+				ASSERT_EQ(xrgb[i * 4 + 1], expected[i * 3 + 1]) << op.name;
+				ASSERT_EQ(xrgb[i * 4], expected[i * 3 + 2]) << op.name;
+			}
+		}
+	}
+}
+
+TEST(ImageOps, PoolChannels) {
+	vector<uint16_t> rgb565{ 0xF800, 0x07E0 };
+	vector<uint16_t> old565{ 0x001F, 0x0000 };
+	vector<uint32_t> xrgb{ 0xFF123456 };
+	vector<uint32_t> oldXrgb{ 0xFF563412 };
+	vector<uint8_t> output(6);
+	Image out(Image::Format::RGB888, static_cast<void*>(output.data()), 2, 1, 6);
+	Image in565(Image::Format::RGB565, static_cast<const void*>(rgb565.data()), 2, 1, 4);
+	Image previous565(Image::Format::RGB565, static_cast<const void*>(old565.data()), 2, 1, 4);
+
+	in565.poolTo(&out, &previous565, Image::Pool::MAX);
+	EXPECT_THAT(output, ElementsAre(0xF8, 0x00, 0xF8, 0x00, 0xFC, 0x00));
+	in565.poolTo(&out, &previous565, Image::Pool::MEAN);
+	EXPECT_THAT(output, ElementsAre(0x7C, 0x00, 0x7C, 0x00, 0x7E, 0x00));
+
+	Image outX888(Image::Format::RGB888, static_cast<void*>(output.data()), 1, 1, 3);
+	Image inX888(Image::Format::RGBX888, static_cast<const void*>(xrgb.data()), 1, 1, 4);
+	Image previousX888(Image::Format::RGBX888, static_cast<const void*>(oldXrgb.data()), 1, 1, 4);
+	inX888.poolTo(&outX888, &previousX888, Image::Pool::MAX);
+	EXPECT_THAT(vector<uint8_t>(output.begin(), output.begin() + 3), ElementsAre(0x56, 0x34, 0x56));
+	inX888.poolTo(&outX888, &previousX888, Image::Pool::MEAN);
+	EXPECT_THAT(vector<uint8_t>(output.begin(), output.begin() + 3), ElementsAre(0x34, 0x34, 0x34));
+
+	EXPECT_THROW(inX888.poolTo(&outX888, &previous565, Image::Pool::MAX), invalid_argument);
+}
+
+/* Run with --gtest_also_run_disabled_tests to print timings per kernel */
+template<typename F>
+static void benchmark(const char* system, size_t w, size_t h, const char* name, F run) {
+	printf("%-8s %4zux%-4zu %-16s", system, w, h, name);
+	for (const auto& kernels : s_kernels) {
+		if (!Image::supportsKernels(kernels.first)) {
+			continue;
+		}
+		Image::useKernels(kernels.first);
+		run();
+		size_t iterations = 0;
+		auto start = chrono::steady_clock::now();
+		chrono::duration<double, micro> elapsed;
+		do {
+			for (int i = 0; i < 100; ++i) {
+				run();
+			}
+			iterations += 100;
+			elapsed = chrono::steady_clock::now() - start;
+		} while (elapsed.count() < 100000);
+		printf(" %s %7.2f us", kernels.second, elapsed.count() / iterations);
+	}
+	printf("\n");
+}
+
+TEST_P(ImageOpsTest, DISABLED_Benchmark) {
+	const auto& param = GetParam();
+	for (const auto& op : s_ops) {
+		vector<uint8_t> input = makeInput(op, param.w, param.h);
+		vector<uint8_t> output = makeOutput(op, param.w, param.h);
+		benchmark(param.system.c_str(), param.w, param.h, op.name, [&]() {
+			convert(op, input, &output, param.w, param.h);
+		});
+	}
+	for (const auto& op : s_resizes) {
+		vector<uint8_t> input = makeInput({ op.name, op.format, op.depth, 1 }, param.w, param.h);
+		benchmark(param.system.c_str(), param.w, param.h, op.name, [&]() {
+			resize(op, input, param.w, param.h, 84, 84);
+		});
+	}
+	for (const auto& op : s_pools) {
+		vector<uint8_t> input = makeInput(op, param.w, param.h);
+		vector<uint8_t> output = makeOutput(op, param.w, param.h);
+		benchmark(param.system.c_str(), param.w, param.h, op.name, [&]() {
+			pool(op, input, input, &output, param.w, param.h, Image::Pool::MAX);
+		});
+	}
+	vector<uint16_t> runs = makeRuns<uint16_t>(param.w, param.h, param.w, 40, 0xFFFF);
+	vector<uint8_t> indices(param.w * param.h);
+	Palette palette;
+	benchmark(param.system.c_str(), param.w, param.h, "index-565", [&]() {
+		Image in(Image::Format::RGB565, static_cast<const void*>(runs.data()), param.w, param.h, param.w * 2);
+		Image out(Image::Format::P8, static_cast<void*>(indices.data()), param.w, param.h, param.w);
+		in.indexTo(&out, &palette);
+	});
+}
+
+static const ImageOpsTestParam s_resolutions[] = {
+	{ "GameBoy", 160, 144 },
+	{ "Nes", 256, 240 },
+	{ "Genesis", 320, 224 },
+	{ "Snes", 512, 448 },
+	{ "Saturn", 704, 512 },
+	{ "Odd", 251, 203 },
+};
+
+INSTANTIATE_TEST_CASE_P(ImageOps, ImageOpsTest, ValuesIn(s_resolutions), ImageOpsTestParamName());
+
+}
@@ -48,6 +48,36 @@ TEST_P(MemoryOverlayTest, Unparse) {
 	EXPECT_THAT(unparsed, ElementsAreArray(param.in));
 }
 
+TEST_P(MemoryOverlayTest, ParseBlock) {
+	const auto& param = GetParam();
+
+	vector<uint8_t> expected(param.in.size());
+	param.overlay.parse(reinterpret_cast<const void*>(&param.in[0]), 0, reinterpret_cast<void*>(&expected[0]), param.in.size());
+	vector<uint8_t> parsed(param.in.size());
+	param.overlay.parseBlock(reinterpret_cast<const void*>(&param.in[0]), reinterpret_cast<void*>(&parsed[0]), param.in.size());
+	EXPECT_THAT(parsed, ElementsAreArray(expected));
+}
+
+TEST(MemoryOverlay, ParseBlockSwap) {
+	vector<uint8_t> in(67);
+	for (size_t i = 0; i < in.size(); ++i) {
+		in[i] = i;
+	}
+	for (size_t width : { 2, 4, 8 }) {
+		for (const auto& endians : { make_pair(Endian::LITTLE, Endian::BIG), make_pair(Endian::BIG, Endian::LITTLE) }) {
+			MemoryOverlay overlay(endians.first, endians.second, width);
+			vector<uint8_t> parsed(in.size());
+			overlay.parseBlock(reinterpret_cast<const void*>(&in[0]), reinterpret_cast<void*>(&parsed[0]), in.size());
+			size_t words = in.size() - in.size() % width;
+			for (size_t i = 0; i < words; ++i) {
+				EXPECT_EQ(parsed[i], in[i - i % width + width - 1 - i % width]) << width << " " << i;
+			}
+			for (size_t i = words; i < in.size(); ++i) {
+				EXPECT_EQ(parsed[i], in[i]) << width << " " << i;
+			}
+		}
+	}
+}
 
 #define INSTANTIATE_OVERLAY_TEST_CASE(NAME, ...) \
 	INSTANTIATE_TEST_CASE_P(NAME, MemoryOverlayTest, Values(MemoryOverlayTestParam{ __VA_ARGS__ }));
@@ -3,6 +3,8 @@
 
 #include "memory.h"
 
+#include <chrono>
+#include <cstring>
 #include <vector>
 
 using namespace std;
@@ -1487,4 +1489,237 @@ TEST(DataTypeEncode, x01020304) {
 	EXPECT_THAT(mem, ElementsAre(3, 4, 1, 2));
 }
 
+// Mirrors the type list the search module scans
+static const char* const s_types[] = {
+	">d8", ">n8",
+	">d6", ">n6",
+	"<u4", ">u4", "><u4", "<>u4", ">=u4", "<=u4", "=u4",
+	"<i4", ">i4", "><i4", "<>i4", ">=i4", "<=i4", "=i4",
+	"<d4", ">d4", "><d4", "<>d4", ">=d4", "<=d4", "=d4",
+	"<n4", ">n4", "><n4", "<>n4", ">=n4", "<=n4", "=n4",
+	"<u2", ">u2", "=u2",
+	"<i2", ">i2", "=i2",
+	"<d2", ">d2", "=d2",
+	"|u1", "|i1", "|d1"
+};
+
+TEST(DataTypeCodec, Generic) {
+	vector<const char*> types(begin(s_types), end(s_types));
+	types.insert(types.end(), { "<u8", ">u8", "><u8", "<>u8", "<i8", ">i8", "><u2", "<>i2", "<u3", ">i3", "<=i8", ">=u2", "<d8", "><d8", "<>n6", ">d3", "<n5", "=d2" });
+	uint8_t mem[16];
+	uint64_t seed = 0x9E3779B97F4A7C15;
+	for (const char* name : types) {
+		DataType type(name);
+		for (int i = 0; i < 256; ++i) {
+			seed = seed * 6364136223846793005 + 1442695040888963407;
+			memcpy(mem, &seed, sizeof(seed));
+			memcpy(&mem[8], &seed, sizeof(seed));
+			mem[0] = i;
+			EXPECT_EQ(type.decode(mem), DataType::decodeGeneric(type, mem)) << name << " " << i;
+
+			uint8_t encoded[8]{};
+			uint8_t expected[8]{};
+			int64_t value = static_cast<int64_t>(seed) >> (i & 63);
+			type.encode(encoded, value);
+			DataType::encodeGeneric(type, expected, value);
+			EXPECT_THAT(encoded, ElementsAreArray(expected)) << name << " " << value;
+		}
+
+		size_t offsets[] = { 0, 7, 3, 1 };
+		int64_t many[4];
+		type.decodeMany(mem, offsets, 4, many);
+		for (int i = 0; i < 4; ++i) {
+			EXPECT_EQ(many[i], type.decode(&mem[offsets[i]])) << name;
+		}
+		type.decodeMany(mem, nullptr, 4, many);
+		for (int i = 0; i < 4; ++i) {
+			EXPECT_EQ(many[i], type.decode(&mem[i])) << name;
+		}
+	}
+}
+
+/* Run with --gtest_also_run_disabled_tests to print decode timings per type */
+TEST(DataTypeCodec, DISABLED_Benchmark) {
+	vector<uint8_t> mem(0x10008);
+	uint64_t seed = 1;
+	for (auto& byte : mem) {
+		seed = seed * 6364136223846793005 + 1442695040888963407;
+		byte = seed >> 56;
+	}
+	vector<int64_t> out(0x10000);
+	for (const char* name : s_types) {
+		DataType type(name);
+		printf("%-5s", name);
+		for (int generic = 1; generic >= 0; --generic) {
+			size_t iterations = 0;
+			auto start = chrono::steady_clock::now();
+			chrono::duration<double, micro> elapsed;
+			do {
+				if (generic) {
+					DataType::decodeManyGeneric(type, mem.data(), nullptr, out.size(), out.data());
+				} else {
+					type.decodeMany(mem.data(), nullptr, out.size(), out.data());
+				}
+				++iterations;
+				elapsed = chrono::steady_clock::now() - start;
+			} while (elapsed.count() < 20000);
+			printf(" %s %8.2f us", generic ? "generic" : "codec", elapsed.count() / iterations);
+		}
+		printf("\n");
+	}
+}
+
+TEST(AddressSpace, Lookup) {
+	uint8_t low[0x10];
+	uint8_t high[0x20];
+	for (size_t i = 0; i < sizeof(low); ++i) {
+		low[i] = i;
+	}
+	for (size_t i = 0; i < sizeof(high); ++i) {
+		high[i] = 0x80 + i;
+	}
+	AddressSpace mem;
+	mem.addBlock(0x100, sizeof(high), static_cast<void*>(high));
+	mem.addBlock(0x10, sizeof(low), static_cast<void*>(low));
+	const AddressSpace& cmem = mem;
+
+	EXPECT_FALSE(mem.hasBlock(0));
+	EXPECT_FALSE(mem.hasBlock(0xF));
+	EXPECT_TRUE(mem.hasBlock(0x10));
+	EXPECT_TRUE(mem.hasBlock(0x1F));
+	EXPECT_FALSE(mem.hasBlock(0x20));
+	EXPECT_FALSE(mem.hasBlock(0xFF));
+	EXPECT_TRUE(mem.hasBlock(0x11F));
+	EXPECT_FALSE(mem.hasBlock(0x120));
+
+	EXPECT_EQ(mem.block(0x18).offset(0), low);
+	EXPECT_EQ(cmem.block(0x104).offset(0), high);
+	EXPECT_THROW(mem.block(0x80), out_of_range);
+
+	EXPECT_EQ(cmem[0x10], 0);
+	EXPECT_EQ(cmem[0x1F], 0xF);
+	EXPECT_EQ(cmem[0x100], 0x80);
+	EXPECT_EQ(cmem[(Variable{ DataType(">u2"), 0x102 })], 0x8283);
+	EXPECT_EQ(static_cast<int64_t>(mem[0x11F]), 0x9F);
+	EXPECT_THROW(cmem[0x20], out_of_range);
+	EXPECT_THROW(cmem[0x120], out_of_range);
+
+	mem[0x11] = 0x42;
+	EXPECT_EQ(low[1], 0x42);
+	mem[(Variable{ DataType("<u2"), 0x110 })] = 0x1234;
+	EXPECT_EQ(high[0x10], 0x34);
+	EXPECT_EQ(high[0x11], 0x12);
+
+	AddressSpace moved;
+	moved = move(mem);
+	EXPECT_FALSE(mem.hasBlock(0x10));
+	EXPECT_EQ(static_cast<int64_t>(moved[0x11]), 0x42);
+
+	AddressSpace copy;
+	copy.clone(moved);
+	copy.clone();
+	copy[0x12] = 0x55;
+	EXPECT_EQ(low[2], 2);
+	EXPECT_EQ(static_cast<int64_t>(copy[0x12]), 0x55);
+
+	moved.reset();
+	EXPECT_FALSE(moved.hasBlock(0x10));
+	EXPECT_THROW(moved[0x10], out_of_range);
+}
+
+TEST(AddressSpace, Overlap) {
+	uint8_t low[0x10]{};
+	uint8_t high[0x10];
+	memset(high, 0xFF, sizeof(high));
+	AddressSpace mem;
+	mem.addBlock(0, sizeof(low), static_cast<void*>(low));
+	mem.addBlock(8, sizeof(high), static_cast<void*>(high));
+	const AddressSpace& cmem = mem;
+	EXPECT_EQ(cmem[0xF], 0);
+	EXPECT_EQ(cmem[0x10], 0xFF);
+	EXPECT_EQ(cmem.block(0xF).offset(0), low);
+	EXPECT_EQ(cmem.block(0x17).offset(0), high);
+	EXPECT_FALSE(cmem.hasBlock(0x18));
+}
+
+TEST(AddressSpace, Shadow) {
+	uint8_t ram[0x42];
+	for (size_t i = 0; i < sizeof(ram); ++i) {
+		ram[i] = i;
+	}
+	AddressSpace mem;
+	mem.addBlock(0x100, sizeof(ram), static_cast<void*>(ram));
+	const AddressSpace& cmem = mem;
+	EXPECT_EQ(&cmem.shadow(), &cmem);
+
+	mem.setOverlay(MemoryOverlay{ '=', '>', 2 });
+	const AddressSpace& shadow = cmem.shadow();
+	EXPECT_NE(&shadow, &cmem);
+	EXPECT_EQ(shadow.overlay().width, 1);
+	for (size_t i = 0x100; i + 1 < 0x100 + sizeof(ram); ++i) {
+		EXPECT_EQ(shadow[i], cmem[i]) << i;
+		EXPECT_EQ(shadow[(Variable{ DataType(">u2"), i })], cmem[(Variable{ DataType(">u2"), i })]) << i;
+	}
+
+	// Direct changes to the backing memory wait for an invalidation
+	ram[4] = 0xAA;
+	EXPECT_EQ(cmem.shadow()[0x105], 4);
+	mem.invalidateShadow();
+	EXPECT_EQ(cmem.shadow()[0x105], 0xAA);
+
+	// Writes through the address space invalidate it themselves
+	mem[0x110] = 0x55;
+	EXPECT_EQ(ram[0x11], 0x55);
+	EXPECT_EQ(cmem.shadow()[0x110], 0x55);
+
+	mem.addBlock(0, 4);
+	EXPECT_TRUE(cmem.shadow().hasBlock(0));
+	EXPECT_EQ(cmem.shadow()[0x110], 0x55);
+}
+
+template<typename F>
+static void benchmark(const char* name, F run) {
+	size_t iterations = 0;
+	auto start = chrono::steady_clock::now();
+	chrono::duration<double, nano> elapsed;
+	do {
+		for (int i = 0; i < 100; ++i) {
+			run(i);
+		}
+		iterations += 100;
+		elapsed = chrono::steady_clock::now() - start;
+	} while (elapsed.count() < 100000000);
+	printf("%-24s %9.2f ns\n", name, elapsed.count() / iterations);
+}
+
+/* Run with --gtest_also_run_disabled_tests to print lookup timings */
+TEST(AddressSpace, DISABLED_Benchmark) {
+	// Shaped like a Genesis map: 64k of work RAM well above a handful of smaller blocks
+	AddressSpace mem;
+	for (size_t i = 0; i < 8; ++i) {
+		mem.addBlock(i * 0x10000, 0x2000);
+	}
+	mem.addBlock(0xFF0000, 0x10000);
+	const AddressSpace& cmem = mem;
+	const Variable var{ DataType(">u2"), 0xFFF000 };
+
+	int64_t sum = 0;
+	benchmark("lookup", [&](int i) {
+		sum += cmem[Variable{ var.type, var.address + (i & 0xFFE), var.mask }];
+	});
+	mem.setOverlay(MemoryOverlay{ '=', '>', 2 });
+	benchmark("lookup overlay", [&](int i) {
+		sum += cmem[Variable{ var.type, var.address + (i & 0xFFE), var.mask }];
+	});
+	const AddressSpace& shadow = cmem.shadow();
+	benchmark("lookup shadow", [&](int i) {
+		sum += shadow[Variable{ var.type, var.address + (i & 0xFFE), var.mask }];
+	});
+	benchmark("refresh shadow", [&](int) {
+		mem.invalidateShadow();
+		sum += cmem.shadow().ok();
+	});
+	EXPECT_NE(sum, 0);
+}
+
 }
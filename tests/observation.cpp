@@ -0,0 +1,352 @@
+#include "gtest/gtest.h"
+
+#include "observation.h"
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+using namespace std;
+
+namespace Retro {
+
+/* A frame whose pixels encode their own coordinates, so that sampling can be
+ * checked without a reference implementation of the conversion */
+static vector<uint32_t> makeFrame(size_t w, size_t h, size_t stride) {
+	vector<uint32_t> frame(stride * h);
+	for (size_t y = 0; y < h; ++y) {
+		for (size_t x = 0; x < w; ++x) {
+			frame[stride * y + x] = 0xFF000000 | (x << 16) | (y << 8) | ((x + y) & 0xFF);
+		}
+	}
+	return frame;
+}
+
+TEST(Observation, Crop) {
+	vector<uint32_t> frame = makeFrame(64, 48, 70);
+	Image image(Image::Format::RGBX888, static_cast<const void*>(frame.data()), 64, 48, 70 * 4);
+
+	Observation obs;
+	obs.setCrop(8, 4, 32, 100);
+	EXPECT_TRUE(obs.setFrameSize(64, 48));
+	EXPECT_FALSE(obs.setFrameSize(64, 48));
+	ASSERT_EQ(obs.width(), 32);
+	ASSERT_EQ(obs.height(), 44);
+	ASSERT_EQ(obs.channels(), 3);
+
+	vector<uint8_t> out(obs.size());
+	obs.update(image, out.data());
+	for (size_t y = 0; y < obs.height(); ++y) {
+		for (size_t x = 0; x < obs.width(); ++x) {
+			const uint8_t* pixel = &out[(y * obs.width() + x) * 3];
+			EXPECT_EQ(pixel[0], x + 8);
+			EXPECT_EQ(pixel[1], y + 4);
+			EXPECT_EQ(pixel[2], (x + y + 12) & 0xFF);
+		}
+	}
+
+	obs.setCrop(64, 0, 0, 0);
+	EXPECT_THROW(obs.setFrameSize(64, 48), invalid_argument);
+}
+
+TEST(Observation, Resize) {
+	vector<uint32_t> frame = makeFrame(256, 240, 256);
+	Image image(Image::Format::RGBX888, static_cast<const void*>(frame.data()), 256, 240, 256 * 4);
+
+	Observation obs(84, 84);
+	obs.setFrameSize(256, 240);
+	ASSERT_EQ(obs.size(), 84 * 84 * 3);
+	vector<uint8_t> out(obs.size());
+	obs.update(image, out.data());
+	for (size_t y = 0; y < 84; ++y) {
+		for (size_t x = 0; x < 84; ++x) {
+			const uint8_t* pixel = &out[(y * 84 + x) * 3];
+			EXPECT_EQ(pixel[0], (2 * x + 1) * 256 / 168);
+			EXPECT_EQ(pixel[1], (2 * y + 1) * 240 / 168);
+		}
+	}
+}
+
+TEST(Observation, Grayscale) {
+	vector<uint16_t> rgb565{ 0xFFFF, 0xF800, 0x07E0, 0x001F };
+	Image image(Image::Format::RGB565, static_cast<const void*>(rgb565.data()), 4, 1, 8);
+
+	Observation obs(0, 0, true);
+	obs.setFrameSize(4, 1);
+	ASSERT_EQ(obs.channels(), 1);
+	vector<uint8_t> out(obs.size());
+	obs.update(image, out.data());
+	/* White is 0xF8, 0xFC, 0xF8 after expanding to 8 bits */
+	EXPECT_EQ(out, (vector<uint8_t>{ 250, 75, 148, 28 }));
+}
+
+TEST(Observation, Stack) {
+	mt19937 rng(0);
+	vector<vector<uint32_t>> frames(6, vector<uint32_t>(16 * 8));
+	for (auto& frame : frames) {
+		for (auto& pixel : frame) {
+			pixel = rng();
+		}
+	}
+
+	Observation single(8, 4);
+	Observation stacked(8, 4, false, 4);
+	single.setFrameSize(16, 8);
+	stacked.setFrameSize(16, 8);
+	ASSERT_EQ(stacked.channels(), 12);
+
+	vector<vector<uint8_t>> expected;
+	vector<uint8_t> out(stacked.size());
+	for (size_t i = 0; i < frames.size(); ++i) {
+		if (i == 3) {
+			stacked.reset();
+			expected.clear();
+		}
+		Image image(Image::Format::RGBX888, static_cast<const void*>(frames[i].data()), 16, 8, 16 * 4);
+		expected.emplace_back(single.size());
+		single.update(image, expected.back().data());
+		stacked.update(image, out.data());
+
+		/* A reset fills the stack with the first frame after it */
+		for (size_t slot = 0; slot < 4; ++slot) {
+			size_t frame = slot + expected.size() < 4 ? 0 : slot + expected.size() - 4;
+			for (size_t pixel = 0; pixel < 8 * 4; ++pixel) {
+				for (size_t c = 0; c < 3; ++c) {
+					ASSERT_EQ(out[pixel * 12 + slot * 3 + c], expected[frame][pixel * 3 + c]) << i << " " << slot;
+				}
+			}
+		}
+	}
+}
+
+TEST(Observation, Filter) {
+	vector<uint32_t> frame = makeFrame(320, 224, 320);
+	Image image(Image::Format::RGBX888, static_cast<const void*>(frame.data()), 320, 224, 320 * 4);
+	for (Image::Filter filter : { Image::Filter::AREA, Image::Filter::BILINEAR }) {
+		vector<uint8_t> expected(84 * 84);
+		Image resized(Image::Format::G8, static_cast<void*>(expected.data()), 84, 84, 84);
+		image.crop(0, 16, 320, 192).resizeTo(&resized, filter);
+
+		Observation obs(84, 84, true, 2, filter);
+		obs.setCrop(0, 16, 0, 192);
+		obs.setFrameSize(320, 224);
+		vector<uint8_t> out(obs.size());
+		obs.update(image, out.data());
+		for (size_t i = 0; i < expected.size(); ++i) {
+			ASSERT_EQ(out[i * 2], expected[i]);
+			ASSERT_EQ(out[i * 2 + 1], expected[i]);
+		}
+	}
+}
+
+TEST(Observation, Pool) {
+	mt19937 rng(0);
+	vector<vector<uint32_t>> frames(2, vector<uint32_t>(16 * 8));
+	for (auto& frame : frames) {
+		for (auto& pixel : frame) {
+			pixel = rng();
+		}
+	}
+	Image current(Image::Format::RGBX888, static_cast<const void*>(frames[0].data()), 16, 8, 16 * 4);
+	Image previous(Image::Format::RGBX888, static_cast<const void*>(frames[1].data()), 16, 8, 16 * 4);
+
+	/* Sampling and cropping commute with taking the maximum of each channel */
+	for (size_t width : { 0, 8 }) {
+		Observation obs(width, width / 2);
+		obs.setCrop(2, 1, 0, 0);
+		obs.setFrameSize(16, 8);
+		vector<uint8_t> a(obs.size());
+		vector<uint8_t> b(obs.size());
+		vector<uint8_t> out(obs.size());
+		obs.update(current, a.data());
+		obs.update(previous, b.data());
+		obs.update(current, out.data(), &previous, Image::Pool::MAX);
+		for (size_t i = 0; i < out.size(); ++i) {
+			ASSERT_EQ(out[i], max(a[i], b[i])) << width;
+		}
+	}
+}
+
+TEST(Observation, Repeat) {
+	vector<uint32_t> first = makeFrame(16, 8, 16);
+	vector<uint32_t> second = first;
+	for (auto& pixel : second) {
+		pixel ^= 0xFFFFFF;
+	}
+	Image firstImage(Image::Format::RGBX888, static_cast<const void*>(first.data()), 16, 8, 16 * 4);
+	Image secondImage(Image::Format::RGBX888, static_cast<const void*>(second.data()), 16, 8, 16 * 4);
+
+	/* Repeating pushes the same frame that an update would */
+	Observation updated(8, 4, true, 3);
+	Observation repeated(8, 4, true, 3);
+	updated.setFrameSize(16, 8);
+	repeated.setFrameSize(16, 8);
+	vector<uint8_t> expected(updated.size());
+	vector<uint8_t> out(repeated.size());
+	EXPECT_FALSE(repeated.repeat(out.data()));
+	for (Observation* obs : { &updated, &repeated }) {
+		uint8_t* data = obs == &updated ? expected.data() : out.data();
+		obs->update(firstImage, data);
+		obs->update(secondImage, data);
+	}
+	updated.update(secondImage, expected.data());
+	EXPECT_TRUE(repeated.repeat(out.data()));
+	EXPECT_EQ(out, expected);
+
+	updated.reset();
+	repeated.reset();
+	updated.update(secondImage, expected.data());
+	EXPECT_TRUE(repeated.repeat(out.data()));
+	EXPECT_EQ(out, expected);
+
+	repeated.setCrop(1, 0, 0, 0);
+	repeated.setFrameSize(16, 8);
+	EXPECT_FALSE(repeated.repeat(out.data()));
+}
+
+TEST(Observation, Output) {
+	mt19937 rng(0);
+	vector<uint32_t> frame(16 * 8);
+	for (auto& pixel : frame) {
+		pixel = rng();
+	}
+	Image image(Image::Format::RGBX888, static_cast<const void*>(frame.data()), 16, 8, 16 * 4);
+
+	Observation reference(8, 4, false, 2);
+	reference.setFrameSize(16, 8);
+	vector<uint8_t> expected(reference.size());
+	reference.update(image, expected.data());
+
+	Observation planar(8, 4, false, 2);
+	planar.setOutput(Observation::Layout::CHW, Observation::Type::UINT8);
+	EXPECT_TRUE(planar.setFrameSize(16, 8));
+	vector<uint8_t> bytes(planar.size());
+	planar.update(image, bytes.data());
+
+	Observation floats(8, 4, false, 2);
+	floats.setOutput(Observation::Layout::CHW, Observation::Type::FLOAT32);
+	floats.setFrameSize(16, 8);
+	ASSERT_EQ(floats.elementSize(), 4);
+	vector<float> values(floats.size());
+	floats.update(image, values.data());
+
+	Observation halves(8, 4, false, 2);
+	halves.setOutput(Observation::Layout::HWC, Observation::Type::FLOAT16);
+	halves.setFrameSize(16, 8);
+	vector<uint16_t> bits(halves.size());
+	halves.update(image, bits.data());
+
+	for (size_t c = 0; c < 6; ++c) {
+		for (size_t i = 0; i < 8 * 4; ++i) {
+			uint8_t value = expected[i * 6 + c];
+			ASSERT_EQ(bytes[c * 8 * 4 + i], value);
+			ASSERT_EQ(values[c * 8 * 4 + i], value / 255.f);
+		}
+	}
+	/* Half precision bit patterns of 0, 1/255, 128/255 and 1 */
+	for (size_t i = 0; i < expected.size(); ++i) {
+		switch (expected[i]) {
+		case 0:
+			ASSERT_EQ(bits[i], 0);
+			break;
+		case 1:
+			ASSERT_EQ(bits[i], 0x1C04);
+			break;
+		case 128:
+			ASSERT_EQ(bits[i], 0x3804);
+			break;
+		case 255:
+			ASSERT_EQ(bits[i], 0x3C00);
+			break;
+		}
+	}
+}
+
+TEST(Observation, Color) {
+	mt19937 rng(0);
+	vector<uint16_t> colors{ 0x0000, 0xF800, 0x07E0, 0x001F, 0xFFFF };
+	vector<vector<uint16_t>> frames(3, vector<uint16_t>(16 * 8));
+	for (auto& frame : frames) {
+		for (auto& pixel : frame) {
+			pixel = colors[rng() % colors.size()];
+		}
+	}
+
+	/* Both keep the exact colors of a 16-bit frame, resized or not */
+	for (size_t width : { 0, 8 }) {
+		for (unsigned stack : { 1, 2 }) {
+			Observation rgb(width, width / 2, false, stack);
+			Observation indexed(width, width / 2, false, stack);
+			Observation packed(width, width / 2, false, stack);
+			indexed.setColor(Observation::Color::INDEXED);
+			packed.setColor(Observation::Color::RGB565);
+			for (Observation* obs : { &rgb, &indexed, &packed }) {
+				obs->setCrop(2, 1, 0, 0);
+				obs->setFrameSize(16, 8);
+			}
+			ASSERT_EQ(indexed.channels(), stack);
+			ASSERT_EQ(packed.channels(), stack);
+			ASSERT_EQ(packed.elementSize(), 2);
+			vector<uint8_t> expected(rgb.size());
+			vector<uint8_t> indices(indexed.size());
+			vector<uint16_t> pixels(packed.size());
+			for (size_t i = 0; i < frames.size(); ++i) {
+				Image image(Image::Format::RGB565, static_cast<const void*>(frames[i].data()), 16, 8, 16 * 2);
+				rgb.update(image, expected.data());
+				indexed.update(image, indices.data());
+				packed.update(image, pixels.data());
+			}
+			EXPECT_LE(indexed.palette().size(), colors.size());
+			const uint8_t* palette = indexed.palette().colors();
+			for (size_t i = 0; i < indices.size(); ++i) {
+				for (size_t c = 0; c < 3; ++c) {
+					ASSERT_EQ(palette[indices[i] * 3 + c], expected[i * 3 + c]) << width;
+				}
+				uint16_t pixel = ((expected[i * 3] & 0xF8) << 8) | ((expected[i * 3 + 1] & 0xFC) << 3) | (expected[i * 3 + 2] >> 3);
+				ASSERT_EQ(pixels[i], pixel) << width;
+			}
+
+			indexed.reset();
+			EXPECT_EQ(indexed.palette().size(), 0);
+			EXPECT_FALSE(indexed.repeat(indices.data()));
+		}
+	}
+
+	/* More than 256 distinct colors can't be indexed */
+	vector<uint16_t> gradient(32 * 16);
+	for (size_t i = 0; i < gradient.size(); ++i) {
+		gradient[i] = i;
+	}
+	for (unsigned stack : { 1, 2 }) {
+		Observation overflow(0, 0, false, stack);
+		overflow.setColor(Observation::Color::INDEXED);
+		overflow.setFrameSize(32, 16);
+		vector<uint8_t> indices(overflow.size());
+		Image image(Image::Format::RGB565, static_cast<const void*>(gradient.data()), 32, 16, 32 * 2);
+		EXPECT_THROW(overflow.update(image, indices.data()), length_error);
+		EXPECT_FALSE(overflow.repeat(indices.data()));
+	}
+
+	Observation area(8, 4, false, 1, Image::Filter::AREA);
+	area.setColor(Observation::Color::INDEXED);
+	EXPECT_THROW(area.setFrameSize(16, 8), invalid_argument);
+	Observation planar;
+	planar.setColor(Observation::Color::RGB565);
+	planar.setOutput(Observation::Layout::CHW, Observation::Type::UINT8);
+	EXPECT_THROW(planar.setFrameSize(16, 8), invalid_argument);
+}
+
+TEST(Observation, FrameSize) {
+	Observation obs(0, 0, true, 2);
+	EXPECT_TRUE(obs.setFrameSize(256, 224));
+	EXPECT_EQ(obs.size(), 256 * 224 * 2);
+	EXPECT_TRUE(obs.setFrameSize(256, 240));
+	EXPECT_EQ(obs.size(), 256 * 240 * 2);
+
+	vector<uint16_t> frame(256 * 224);
+	vector<uint8_t> out(obs.size());
+	Image image(Image::Format::RGB565, static_cast<const void*>(frame.data()), 256, 224, 512);
+	EXPECT_THROW(obs.update(image, out.data()), invalid_argument);
+	EXPECT_THROW(Observation(84, 84, false, 0), invalid_argument);
+}
+}
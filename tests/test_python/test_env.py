@@ -87,3 +87,516 @@ def test_env_data(generate_test_env):
     with pytest.raises(KeyError):
         val = env.data["foo"]
         assert val
+
+
+def test_env_branches(generate_test_env, tmp_path):
+    import json
+
+    json_path = os.path.join(os.path.dirname(__file__), "../dummy.json")
+
+    env = generate_test_env(info=json_path, scenario=json_path, render_mode=None)
+    env.reset()
+    state = env.em.get_state()
+    branches = [[env.action_space.sample() for _ in range(10)] for _ in range(3)]
+    rews, dones, states, obs = env.evaluate_branches(branches, workers=2, observe=True)
+    assert rews.shape == (3,)
+    assert dones.shape == (3,)
+    assert len(states) == 3
+    assert len(obs) == 3
+
+    env.em.set_state(state)
+    for act in branches[0]:
+        last, _rew, _terminated, _truncated, _info = env.step(act)
+    assert (last == obs[0]).all()
+
+    # A truncated state fails in the workers and surfaces as an exception
+    with pytest.raises(RuntimeError):
+        env.evaluate_branches(branches, state=state[:16], workers=2)
+    rews2, _dones, _states, _obs = env.evaluate_branches(branches, state=state, workers=2)
+    assert (rews2 == rews).all()
+
+    # Workers are kept between calls and follow changes to the scenario
+    assert not dones.any()
+    scenario = tmp_path / "done.json"
+    condition = {"op": "greater-than", "reference": -1}
+    scenario.write_text(json.dumps({"done": {"variables": {env.system: condition}}}))
+    assert env.data.load(scen=str(scenario))
+    _rews, dones, _states, _obs = env.evaluate_branches(branches, state=state, workers=2)
+    assert dones.all()
+
+
+def test_env_headless_terminal(generate_test_env, tmp_path):
+    import json
+
+    import numpy as np
+
+    json_path = os.path.join(os.path.dirname(__file__), "../dummy.json")
+
+    env = generate_test_env(
+        info=json_path,
+        scenario=json_path,
+        render_mode=None,
+        headless=True,
+        frameskip=4,
+    )
+    env.reset()
+    for _ in range(10):
+        env.step(env.action_space.sample())
+
+    # The episode ends on the first of four frames, none of which is drawn
+    scenario = tmp_path / "done.json"
+    condition = {"op": "greater-than", "reference": -1}
+    scenario.write_text(json.dumps({"done": {"variables": {env.system: condition}}}))
+    assert env.data.load(scen=str(scenario))
+    state = env.em.get_state()
+    action = env.action_space.sample()
+    obs, _rew, terminated, _truncated, _info = env.step(action)
+    assert terminated
+    obs = np.array(obs)
+
+    # The terminal frame is followed by one more frame, which is drawn
+    env.em.set_state(state)
+    _obs, _rews, done, _info = env.data.step(
+        env.em,
+        action,
+        env.use_restricted_actions.value,
+        env.players,
+        1,
+        env._obs_type.value,
+        False,
+    )
+    assert done
+    env.em.step()
+    assert (obs == env.get_screen()).all()
+
+
+@pytest.mark.parametrize("actions", [retro.Actions.DISCRETE, retro.Actions.MULTI_DISCRETE])
+def test_env_action_range(actions, generate_test_env):
+    import numpy as np
+
+    json_path = os.path.join(os.path.dirname(__file__), "../dummy.json")
+
+    env = generate_test_env(
+        info=json_path,
+        scenario=json_path,
+        render_mode=None,
+        use_restricted_actions=actions,
+    )
+    env.reset()
+    if actions == retro.Actions.DISCRETE:
+        highest = env.action_space.n - 1
+        invalid = [-1, env.action_space.n]
+    else:
+        highest = env.action_space.nvec - 1
+        invalid = [np.full_like(highest, -1), highest + np.eye(len(highest), dtype=highest.dtype)[0]]
+    env.step(highest)
+    for action in invalid:
+        with pytest.raises(ValueError):
+            env.step(action)
+
+
+def test_env_audio_view(generate_test_env):
+    json_path = os.path.join(os.path.dirname(__file__), "../dummy.json")
+
+    env = generate_test_env(info=json_path, scenario=json_path, render_mode=None)
+    env.reset()
+    env.step(env.action_space.sample())
+    view = env.em.get_audio_view()
+    assert (view == env.em.get_audio()).all()
+    assert not view.flags.writeable
+    with pytest.raises(ValueError):
+        view[:] = 0
+
+    # The ring can't be reallocated while any view of it is alive
+    part = view[1:]
+    del view
+    with pytest.raises(RuntimeError):
+        env.em.set_audio_buffer(4096)
+    del part
+    env.em.set_audio_buffer(4096)
+
+
+def test_env_sequence(generate_test_env):
+    import numpy as np
+
+    json_path = os.path.join(os.path.dirname(__file__), "../dummy.json")
+
+    env = generate_test_env(info=json_path, scenario=json_path, render_mode=None)
+    env.reset()
+    state = env.em.get_state()
+    masks = np.random.randint(1 << env.num_buttons, size=(20, 1), dtype=np.uint16)
+    rewards = np.zeros((20, 1), dtype=np.float32)
+    trace = np.zeros((20, 1), dtype=np.int64)
+    frames = env.em.run_sequence(masks, env.data, rewards, [env.system], trace)
+    assert 0 < frames <= 20
+    last = env.em.get_screen()
+
+    env.em.set_state(state)
+    for frame in range(frames):
+        bits = [(masks[frame, 0] >> i) & 1 for i in range(env.num_buttons)]
+        env.em.set_button_mask(np.array(bits, dtype=np.uint8), 0)
+        env.em.step()
+        env.data.update_ram()
+        assert env.data.lookup_value(env.system) == trace[frame, 0]
+    assert (env.em.get_screen() == last).all()
+
+    with pytest.raises(ValueError):
+        env.em.run_sequence(masks, env.data, rewards.astype(np.float64))
+
+
+def test_env_sequence_skip_video(generate_test_env, tmp_path):
+    import json
+
+    import numpy as np
+
+    json_path = os.path.join(os.path.dirname(__file__), "../dummy.json")
+
+    env = generate_test_env(info=json_path, scenario=json_path, render_mode=None)
+    env.reset()
+    for _ in range(10):
+        env.step(env.action_space.sample())
+    scenario = tmp_path / "done.json"
+    condition = {"op": "greater-than", "reference": -1}
+    scenario.write_text(json.dumps({"done": {"variables": {env.system: condition}}}))
+    assert env.data.load(scen=str(scenario))
+    state = env.em.get_state()
+    masks = np.random.randint(1 << env.num_buttons, size=(4, 1), dtype=np.uint16)
+
+    # The scenario ends the sequence on its first frame, which isn't drawn, and
+    # one more frame brings the screen up to date
+    screens = []
+    for skip_video in (True, False):
+        env.em.set_state(state)
+        assert env.em.run_sequence(masks, env.data, skip_video=skip_video) == 1
+        env.em.step()
+        screens.append(env.em.get_screen())
+    assert (screens[0] == screens[1]).all()
+
+
+def test_env_state_buffers(generate_test_env):
+    import numpy as np
+
+    json_path = os.path.join(os.path.dirname(__file__), "../dummy.json")
+
+    env = generate_test_env(info=json_path, scenario=json_path, render_mode=None)
+    env.reset()
+    state = env.em.get_state()
+    assert env.em.state_size() == len(state)
+
+    # Any bytes a core leaves unwritten must not carry over from the buffer
+    buf = np.full(len(state) + 16, 0xFF, dtype=np.uint8)
+    assert env.em.get_state_into(buf) == len(state)
+    assert bytes(buf[: len(state)]) == state
+    assert env.em.set_state(buf[: len(state)])
+    with pytest.raises(ValueError):
+        env.em.get_state_into(bytearray(1))
+
+    pool = retro.StatePool(env.em, capacity=1)
+    saved = pool.save()
+    assert len(saved) == len(state)
+    assert bytes(saved) == state
+    assert env.em.set_state(saved)
+    del saved
+    assert pool.available() == 1
+    saved = pool.save()
+    assert pool.available() == 0
+    assert pool.load(saved)
+
+
+def test_env_observation(generate_test_env):
+    import numpy as np
+
+    json_path = os.path.join(os.path.dirname(__file__), "../dummy.json")
+
+    env = generate_test_env(
+        info=json_path,
+        scenario=json_path,
+        render_mode=None,
+        resize=(84, 84),
+        grayscale=True,
+        frame_stack=4,
+    )
+    assert env.observation_space.shape == (84, 84, 4)
+
+    def expected():
+        screen = env.get_screen().astype(np.uint32)
+        h, w = screen.shape[:2]
+        rows = (2 * np.arange(84) + 1) * h // 168
+        columns = (2 * np.arange(84) + 1) * w // 168
+        screen = screen[rows][:, columns]
+        luma = screen[..., 0] * 77 + screen[..., 1] * 150 + screen[..., 2] * 29 + 128
+        return (luma >> 8).astype(np.uint8)
+
+    obs, _info = env.reset()
+    assert obs in env.observation_space
+    for slot in range(4):
+        assert (obs[..., slot] == expected()).all()
+
+    frames = [expected()]
+    for _ in range(3):
+        obs, _rew, _terminated, _truncated, _info = env.step(env.action_space.sample())
+        frames.append(expected())
+    for slot in range(4):
+        assert (obs[..., slot] == frames[slot]).all()
+
+
+@pytest.mark.parametrize("reuse_obs", [False, True])
+def test_env_observation_reuse(reuse_obs, generate_test_env):
+    import numpy as np
+
+    json_path = os.path.join(os.path.dirname(__file__), "../dummy.json")
+
+    env = generate_test_env(
+        info=json_path,
+        scenario=json_path,
+        render_mode=None,
+        resize=(84, 84),
+        grayscale=True,
+        frame_stack=2,
+        reuse_obs=reuse_obs,
+    )
+    first, _info = env.reset()
+    second, _rew, _terminated, _truncated, _info = env.step(env.action_space.sample())
+    assert np.shares_memory(first, second) == reuse_obs
+    if reuse_obs:
+        assert not second.flags.writeable
+        return
+
+    expected = second.copy()
+    second[:] = 0
+    third, _rew, _terminated, _truncated, _info = env.step(env.action_space.sample())
+    assert (third[..., 0] == expected[..., 1]).all()
+
+
+@pytest.mark.parametrize("dtype", ["float16", "float32"])
+def test_env_observation_chw(dtype, generate_test_env):
+    import numpy as np
+
+    json_path = os.path.join(os.path.dirname(__file__), "../dummy.json")
+
+    env = generate_test_env(
+        info=json_path,
+        scenario=json_path,
+        render_mode=None,
+        frame_stack=2,
+        channels_first=True,
+        obs_dtype=dtype,
+    )
+    obs, _info = env.reset()
+    height, width = env.get_screen().shape[:2]
+    assert obs.shape == (6, height, width)
+    assert obs.dtype == np.dtype(dtype)
+    assert obs in env.observation_space
+
+    obs, _rew, _terminated, _truncated, _info = env.step(env.action_space.sample())
+    expected = env.get_screen().transpose(2, 0, 1).astype(np.float32) / 255
+    assert (obs[3:] == expected.astype(dtype)).all()
+
+
+@pytest.mark.parametrize("color", ["indexed", "rgb565"])
+def test_env_observation_color(color, generate_test_env):
+    import numpy as np
+
+    json_path = os.path.join(os.path.dirname(__file__), "../dummy.json")
+
+    if color == "indexed":
+        env = generate_test_env(info=json_path, scenario=json_path, render_mode=None)
+        system = env.system
+        env.close()
+        if system not in retro.RetroEnv.INDEXED_SYSTEMS:
+            # The palette could overflow mid-episode, so it is refused upfront
+            with pytest.raises(ValueError):
+                generate_test_env(info=json_path, scenario=json_path, obs_color=color)
+            return
+
+    env = generate_test_env(
+        info=json_path,
+        scenario=json_path,
+        render_mode=None,
+        frame_stack=2,
+        obs_color=color,
+    )
+    obs, _info = env.reset()
+    assert obs in env.observation_space
+    for _ in range(3):
+        obs, _rew, _terminated, _truncated, _info = env.step(env.action_space.sample())
+    screen = env.get_screen()
+    if color == "indexed":
+        assert (env.get_palette()[obs[..., 1]] == screen).all()
+    else:
+        screen = screen.astype(np.uint16)
+        packed = ((screen[..., 0] & 0xF8) << 8) | ((screen[..., 1] & 0xFC) << 3) | (screen[..., 2] >> 3)
+        assert (obs[..., 1] == packed).all()
+
+
+def test_env_frame_pool(generate_test_env):
+    import numpy as np
+
+    json_path = os.path.join(os.path.dirname(__file__), "../dummy.json")
+
+    env = generate_test_env(info=json_path, scenario=json_path, render_mode=None)
+    env.reset()
+    em = env.em
+    # Some demos change resolution while starting up
+    for _ in range(10):
+        em.step()
+    state = em.get_state()
+    screens = []
+    for _ in range(3):
+        em.step()
+        screens.append(em.get_screen().astype(np.uint32))
+
+    # There is no previous frame right after loading a state
+    em.set_state(state)
+    em.set_screen_pool("max")
+    em.step()
+    assert (em.get_screen() == screens[0]).all()
+    em.step()
+    assert (em.get_screen() == np.maximum(screens[0], screens[1])).all()
+    em.set_screen_pool("mean")
+    em.step()
+    assert (em.get_screen() == (screens[1] + screens[2] + 1) >> 1).all()
+    em.set_screen_pool(None)
+    assert (em.get_screen() == screens[2]).all()
+
+
+def test_env_track_changes(generate_test_env):
+    import numpy as np
+
+    json_path = os.path.join(os.path.dirname(__file__), "../dummy.json")
+
+    env = generate_test_env(
+        info=json_path,
+        scenario=json_path,
+        render_mode=None,
+        grayscale=True,
+        frame_stack=2,
+        track_changes=True,
+    )
+    env.reset()
+    em = env.em
+    action = np.zeros(env.action_space.shape, dtype=env.action_space.dtype)
+    state = em.get_state()
+    first, _rew, _terminated, _truncated, _info = env.step(action)
+    first = first.copy()
+    version = em.image_version()
+
+    # Replaying the same frame leaves the image unchanged
+    em.set_state(state)
+    obs, _rew, _terminated, _truncated, _info = env.step(action)
+    assert not em.frame_changed()
+    begin, end = em.changed_rows()
+    assert begin == end
+    assert em.image_version() == version
+    assert (obs[..., 0] == first[..., 1]).all()
+    assert (obs[..., 1] == first[..., 1]).all()
+
+
+def test_env_lookup_array(generate_test_env):
+    json_path = os.path.join(os.path.dirname(__file__), "../dummy.json")
+
+    env = generate_test_env(info=json_path, scenario=json_path, render_mode=None)
+    env.reset()
+    names = env.data.variable_names()
+    assert names == sorted(names)
+    values = env.data.lookup_array()
+    assert values.dtype == "int64"
+    assert len(values) == len(names)
+    for _ in range(3):
+        env.step(env.action_space.sample())
+        assert env.data.lookup_array() is values
+        info = env.data.lookup_all()
+        # Variables outside the mapped memory are left out of lookup_all and read as 0
+        for name, value in zip(names, values):
+            assert info.get(name, 0) == value
+
+
+def test_env_shadow_ram(generate_test_env):
+    json_path = os.path.join(os.path.dirname(__file__), "../dummy.json")
+
+    env = generate_test_env(
+        info=json_path,
+        scenario=json_path,
+        render_mode=None,
+        shadow_ram=True,
+    )
+    env.reset()
+    assert env.data.shadow_ram()
+    for _ in range(3):
+        _obs, _rew, _terminated, _truncated, info = env.step(env.action_space.sample())
+        values = env.data.lookup_array().copy()
+        env.data.set_shadow_ram(False)
+        assert env.data.lookup_all() == info
+        assert (env.data.lookup_array() == values).all()
+        env.data.set_shadow_ram(True)
+
+
+def test_game_pool(monkeypatch):
+    import retro.data
+
+    path = os.path.join(os.path.dirname(__file__), "../roms")
+    json_path = os.path.join(os.path.dirname(__file__), "../dummy.json")
+    monkeypatch.setattr(
+        retro.data,
+        "get_romfile_path",
+        lambda game, *args, **kwargs: [
+            os.path.join(path, rom) for rom in os.listdir(path) if rom.startswith(game)
+        ][0],
+    )
+
+    games = ["Dr88", "automaton", "Dekadence"]
+    pool = retro.GamePool(
+        capacity=2,
+        state=retro.State.NONE,
+        info=json_path,
+        scenario=json_path,
+        render_mode=None,
+    )
+    for game in games:
+        obs, info = pool.switch_game(game, retro.State.NONE)
+        assert obs in pool.env.observation_space
+        pool.env.step(pool.env.action_space.sample())
+    assert len(pool) == 2
+    assert games[0] not in pool
+
+    env = pool.env
+    pool.switch_game(games[-1], retro.State.NONE)
+    assert pool.env is env
+    pool.switch_game(games[0], retro.State.NONE)
+    assert games[1] not in pool
+    pool.close()
+
+
+def _fork_worker(env, path):
+    obs, _info = env.reset()
+    for _ in range(10):
+        obs, _rew, _terminated, _truncated, _info = env.step(env.action_space.sample())
+    with open(path, "w") as f:
+        f.write(str(obs.shape))
+
+
+@pytest.mark.skipif(not hasattr(os, "fork"), reason="requires os.fork")
+def test_fork_server(tmp_path, monkeypatch):
+    import retro.data
+
+    path = os.path.join(os.path.dirname(__file__), "../roms")
+    json_path = os.path.join(os.path.dirname(__file__), "../dummy.json")
+    monkeypatch.setattr(
+        retro.data,
+        "get_romfile_path",
+        lambda game, *args, **kwargs: [
+            os.path.join(path, rom) for rom in os.listdir(path) if rom.startswith(game)
+        ][0],
+    )
+
+    with retro.ForkServer(
+        "Dr88",
+        retro.State.NONE,
+        info=json_path,
+        scenario=json_path,
+        render_mode=None,
+    ) as server:
+        pids = [server.spawn(_fork_worker, str(tmp_path / str(i))) for i in range(3)]
+        assert [server.wait(pid) for pid in pids] == [0, 0, 0]
+    for i in range(3):
+        assert (tmp_path / str(i)).read_text() == "(224, 240, 3)"